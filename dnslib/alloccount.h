@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_ALLOCCOUNT_H
+#define _DNS_ALLOCCOUNT_H
+
+/*
+ * Count heap allocations of a program in allocCount, eg: to check allocation-free code paths or to report
+ * allocations/op. It replaces the global operator new and delete, so it must be included by exactly one source file
+ * of the program (the one with main), never by the library.
+ */
+
+#include <cstdlib>
+#include <new>
+
+static size_t allocCount = 0;
+
+void *operator new(size_t size) {
+    allocCount++;
+    auto p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+// GCC 11+ takes free() after the replaced operator new for a mismatch once both are inlined into the same function
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept {
+    free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+#endif /* _DNS_ALLOCCOUNT_H */
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include <new>
+
+#include "arena.h"
+
+using namespace dns;
+
+const size_t Arena::kAlign;
+const size_t Arena::kMaxPooledSize;
+
+Arena::~Arena() {
+    for (auto block : mBlocks) {
+        ::operator delete(block);
+    }
+}
+
+void *Arena::allocate(size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    if (size > kMaxPooledSize) {
+        return ::operator new(size);
+    }
+
+    size_t sizeClass = (size - 1) / kAlign;
+    auto chunk = mFreeLists[sizeClass];
+    if (chunk) {
+        mFreeLists[sizeClass] = chunk->next;
+        return chunk;
+    }
+
+    size_t chunkSize = (sizeClass + 1) * kAlign;
+    while (mBlockIndex < mBlocks.size() && mBlockUsed + chunkSize > mBlockSize) {
+        mBlockIndex++;
+        mBlockUsed = 0;
+    }
+    if (mBlockIndex == mBlocks.size()) {
+        // ::operator new returns memory aligned for any fundamental type, which is enough for kAlign
+        mBlocks.push_back(static_cast<uint8_t *>(::operator new(mBlockSize)));
+        mBlockUsed = 0;
+    }
+    auto p = mBlocks[mBlockIndex] + mBlockUsed;
+    mBlockUsed += chunkSize;
+    return p;
+}
+
+void Arena::deallocate(void *p, size_t size) {
+    if (!p) {
+        return;
+    }
+    if (size == 0) {
+        size = 1;
+    }
+    if (size > kMaxPooledSize) {
+        ::operator delete(p);
+        return;
+    }
+
+    size_t sizeClass = (size - 1) / kAlign;
+    auto chunk = static_cast<FreeChunk *>(p);
+    chunk->next = mFreeLists[sizeClass];
+    mFreeLists[sizeClass] = chunk;
+}
+
+void Arena::reset() {
+    for (auto &freeList : mFreeLists) {
+        freeList = nullptr;
+    }
+    mBlockIndex = 0;
+    mBlockUsed = 0;
+}
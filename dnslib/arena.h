@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_ARENA_H
+#define _DNS_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dns {
+
+/**
+ * Memory arena for decoding messages without heap allocation.
+ *
+ * Memory is taken from large blocks, freed chunks are kept in free lists (one list per 16-byte size class) and
+ * handed out again, so after warm-up a steady stream of allocations and deallocations never reaches malloc.
+ * Chunks larger than kMaxPooledSize are forwarded to the global operator new.
+ *
+ * The arena is not thread-safe, use one arena per thread. It must outlive everything allocated from it.
+ */
+class Arena {
+public:
+    static const size_t kAlign = 16;
+    static const size_t kMaxPooledSize = 512;
+
+    explicit Arena(size_t blockSize = 64 * 1024) : mBlockSize(blockSize < kMaxPooledSize ? kMaxPooledSize : blockSize) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena();
+
+    void *allocate(size_t size);
+    void deallocate(void *p, size_t size);
+
+    // forget all chunks (allocated or free) and reuse the blocks from the beginning,
+    // only call it when nothing allocated from the arena is alive any more
+    void reset();
+
+    inline size_t blockCount() const { return mBlocks.size(); }
+
+private:
+    struct FreeChunk {
+        FreeChunk *next;
+    };
+
+    size_t mBlockSize;
+    std::vector<uint8_t *> mBlocks;
+    size_t mBlockIndex = 0; // block used for new chunks
+    size_t mBlockUsed = 0; // used bytes in that block
+    FreeChunk *mFreeLists[kMaxPooledSize / kAlign] = {};
+};
+
+/** STL allocator which allocates from an Arena, eg: std::allocate_shared<T>(ArenaAllocator<T>(arena)) */
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(Arena &arena) : mArena(&arena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : mArena(other.mArena) {} // NOLINT(google-explicit-constructor)
+
+    T *allocate(size_t n) { return static_cast<T *>(mArena->allocate(n * sizeof(T))); }
+    void deallocate(T *p, size_t n) { mArena->deallocate(p, n * sizeof(T)); }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return mArena == other.mArena; }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return mArena != other.mArena; }
+
+private:
+    template<typename U> friend class ArenaAllocator;
+    Arena *mArena;
+};
+
+} // namespace
+#endif /* _DNS_ARENA_H */
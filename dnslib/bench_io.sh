@@ -0,0 +1,34 @@
+#!/bin/sh
+# Compare the I/O modes of fakesrv: blocking recvfrom/sendto, recvmmsg/sendmmsg batches and io_uring.
+#
+# usage: bench_io.sh [build-dir] [qps] [seconds]   (run it from the build directory by default)
+#
+# fakecli sends queries at the target rate in every mode and reports throughput, loss and latency percentiles.
+# The io_uring mode is skipped if fakesrv is built without DNSLIB_WITH_URING.
+
+BUILD_DIR=${1:-.}
+QPS=${2:-200000}
+SECONDS_PER_MODE=${3:-5}
+FAKESRV=$BUILD_DIR/fakesrv
+FAKECLI=$BUILD_DIR/fakecli
+PORT=6666
+
+run_mode() {
+    name=$1
+    shift
+    "$FAKESRV" -p $PORT -e none "$@" > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    if ! kill -0 $pid 2> /dev/null; then
+        echo "$name: skipped (fakesrv $* failed to start)"
+        return
+    fi
+    echo "$name:"
+    "$FAKECLI" -p $PORT -q "$QPS" -d "$SECONDS_PER_MODE" -t 2 -s 4 127.0.0.1 | sed -n '/^====/,$p' | tail -n +2 | sed 's/^/  /'
+    kill $pid
+    wait $pid 2> /dev/null
+}
+
+run_mode "blocking" -w 1
+run_mode "recvmmsg/sendmmsg" -w 1 -b 32
+run_mode "io_uring" -w 1 -u
@@ -0,0 +1,656 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Copyright (c) 2014 Michal Nezerka (https://github.com/mnezerka/, mailto:michal.nezerka@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+/*
+ * Microbenchmarks of the library code (no network I/O).
+ *
+ * Usage: benchmarks [name-filter]
+ *
+ * Every benchmark reports ns/op, bytes/op (size of the packet or name processed by one op) and heap allocations/op.
+ * The results are written to stdout as JSON, progress is written to stderr, eg:
+ *
+ *     ./benchmarks > result.json
+ *     ./benchmarks rdata.MX
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "alloccount.h"
+#include "arena.h"
+#include "cache.h"
+#include "message.h"
+#include "rr.h"
+#include "stream.h"
+#include "template.h"
+#include "view.h"
+#include "writer.h"
+#include "zone.h"
+#include "zonefile.h"
+#include "zoneimage.h"
+
+using namespace std;
+
+struct BenchResult {
+    string name;
+    size_t iterations;
+    double nsPerOp;
+    double bytesPerOp;
+    double allocsPerOp;
+};
+
+static vector<BenchResult> results;
+static string nameFilter;
+
+// run one op repeatedly for about 200ms (after a warm-up op), op returns the number of bytes it processed
+static void bench(const string &name, const function<size_t()> &op) {
+    if (!nameFilter.empty() && name.find(nameFilter) == string::npos) {
+        return;
+    }
+
+    size_t bytes = op(); // warm-up, fills caches and lets reused containers grow
+    auto minDuration = chrono::milliseconds(200);
+    size_t iterations = 0, batch = 1;
+    size_t allocCountStart = allocCount;
+    auto start = chrono::steady_clock::now();
+    auto elapsed = chrono::steady_clock::duration::zero();
+    while (elapsed < minDuration) {
+        for (size_t i = 0; i < batch; i++) {
+            bytes = op();
+        }
+        iterations += batch;
+        batch *= 2;
+        elapsed = chrono::steady_clock::now() - start;
+    }
+    size_t allocs = allocCount - allocCountStart;
+
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nsPerOp = (double) chrono::duration_cast<chrono::nanoseconds>(elapsed).count() / iterations;
+    result.bytesPerOp = (double) bytes;
+    result.allocsPerOp = (double) allocs / iterations;
+    results.push_back(result);
+    cerr << name << ": " << result.nsPerOp << " ns/op, " << result.bytesPerOp << " bytes/op, " << result.allocsPerOp << " allocs/op" << endl;
+}
+
+static void printJson() {
+    cout << "{\"benchmarks\": [" << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        auto &r = results[i];
+        cout << "  {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+             << ", \"ns_per_op\": " << r.nsPerOp << ", \"bytes_per_op\": " << r.bytesPerOp
+             << ", \"allocs_per_op\": " << r.allocsPerOp << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    cout << "]}" << endl;
+}
+
+static void check(bool ok, const string &what) {
+    if (!ok) {
+        cerr << "benchmark setup failed: " << what << endl;
+        exit(1);
+    }
+}
+
+static dns::ResourceRecord makeRecord(const string &name, const shared_ptr<dns::RData> &rdata, dns::RecordType type = dns::RecordType::kNone) {
+    dns::ResourceRecord rr;
+    rr.mName = name;
+    rr.mType = type;
+    rr.mClass = dns::RecordClass::kIN;
+    rr.mTtl = 300;
+    rr.setRData(rdata);
+    return rr;
+}
+
+// a response with "count" MX answers, each exchange is a different host in the same zone
+static dns::Message makeMXResponse(size_t count) {
+    dns::Message m;
+    m.mId = 1;
+    m.mQr = 1;
+    m.questions.emplace_back("example.com", dns::RecordType::kMX);
+    for (size_t i = 0; i < count; i++) {
+        auto rdata = std::make_shared<dns::RDataMX>();
+        rdata->mPreference = (uint16_t) i;
+        rdata->mExchange = "mx" + std::to_string(i) + ".mail.example.com";
+        m.answers.emplace_back(makeRecord("example.com", rdata));
+    }
+    return m;
+}
+
+// RData of every class in rr.h, as it would appear in real responses
+static shared_ptr<dns::RData> makeRData(size_t i, dns::RecordType &type) {
+    type = dns::RecordType::kNone;
+    switch (i) {
+        case 0: {
+            auto rd = make_shared<dns::RDataA>();
+            rd->setAddress("192.0.2.1");
+            return rd;
+        }
+        case 1: {
+            auto rd = make_shared<dns::RDataAAAA>();
+            uint8_t addr[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+            rd->setAddress(addr);
+            return rd;
+        }
+        case 2: {
+            auto rd = make_shared<dns::RDataCNAME>();
+            rd->mName = "edge.cdn.example.net";
+            return rd;
+        }
+        case 3: {
+            auto rd = make_shared<dns::RDataNS>();
+            rd->mName = "ns1.example.com";
+            return rd;
+        }
+        case 4: {
+            auto rd = make_shared<dns::RDataPTR>();
+            rd->mName = "host-1.example.com";
+            return rd;
+        }
+        case 5: {
+            auto rd = make_shared<dns::RDataMX>();
+            rd->mPreference = 10;
+            rd->mExchange = "mx1.example.com";
+            return rd;
+        }
+        case 6: {
+            auto rd = make_shared<dns::RDataSOA>();
+            rd->mMName = "ns1.example.com";
+            rd->mRName = "hostmaster.example.com";
+            rd->mSerial = 2022010101;
+            rd->mRefresh = 7200;
+            rd->mRetry = 3600;
+            rd->mExpire = 1209600;
+            rd->mMinimum = 300;
+            return rd;
+        }
+        case 7: {
+            auto rd = make_shared<dns::RDataTXT>();
+            rd->mTexts.emplace_back("v=spf1 include:_spf.example.com ~all");
+            rd->mTexts.emplace_back("google-site-verification=0123456789abcdef0123456789abcdef");
+            return rd;
+        }
+        case 8: {
+            auto rd = make_shared<dns::RDataSRV>();
+            rd->mPriority = 10;
+            rd->mWeight = 60;
+            rd->mPort = 5060;
+            rd->mTarget = "sip1.example.com";
+            return rd;
+        }
+        case 9: {
+            auto rd = make_shared<dns::RDataNAPTR>();
+            rd->mOrder = 100;
+            rd->mPreference = 10;
+            rd->mFlags = "S";
+            rd->mServices = "SIP+D2U";
+            rd->mRegExp = "";
+            rd->mReplacement = "_sip._udp.example.com";
+            return rd;
+        }
+        case 10: {
+            auto rd = make_shared<dns::RDataHINFO>();
+            rd->mCpu = "x86_64";
+            rd->mOs = "Linux";
+            return rd;
+        }
+        case 11: {
+            auto rd = make_shared<dns::RDataMINFO>();
+            rd->mRMailBx = "admin.example.com";
+            rd->mMailBx = "errors.example.com";
+            return rd;
+        }
+        case 12: {
+            auto rd = make_shared<dns::RDataMB>();
+            rd->mName = "mail.example.com";
+            return rd;
+        }
+        case 13: {
+            auto rd = make_shared<dns::RDataMD>();
+            rd->mName = "mail.example.com";
+            return rd;
+        }
+        case 14: {
+            auto rd = make_shared<dns::RDataMF>();
+            rd->mName = "mail.example.com";
+            return rd;
+        }
+        case 15: {
+            auto rd = make_shared<dns::RDataMG>();
+            rd->mName = "member.example.com";
+            return rd;
+        }
+        case 16: {
+            auto rd = make_shared<dns::RDataMR>();
+            rd->mName = "renamed.example.com";
+            return rd;
+        }
+        case 17: {
+            auto rd = make_shared<dns::RDataWKS>();
+            uint8_t addr[4] = {192, 0, 2, 1};
+            rd->setAddress(addr);
+            rd->mProtocol = 6;
+            rd->mBitmap.assign(16, 0xA5);
+            return rd;
+        }
+        case 18: {
+            auto rd = make_shared<dns::RDataOPT>();
+            rd->mData = {0, 10, 0, 8, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08}; // COOKIE option
+            return rd;
+        }
+        case 19: {
+            auto rd = make_shared<dns::RDataUnknown>();
+            rd->mData = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+            type = (dns::RecordType) 65280; // private use
+            return rd;
+        }
+        default:
+            return nullptr;
+    }
+}
+
+static void benchMessages() {
+    // a typical query and a typical response (www.google.com CNAME www.l.google.com, 4 A records)
+    dns::Message query;
+    query.mId = 0x1234;
+    query.mRD = 1;
+    query.questions.emplace_back("www.google.com", dns::RecordType::kA);
+    vector<uint8_t> queryPacket;
+    check(query.encode(queryPacket) == dns::BufferResult::NoError, "query");
+
+    dns::Message response = query;
+    response.mQr = 1;
+    response.mRA = 1;
+    auto cname = make_shared<dns::RDataCNAME>();
+    cname->mName = "www.l.google.com";
+    response.answers.emplace_back(makeRecord("www.google.com", cname));
+    for (auto addr : {"66.249.91.104", "66.249.91.99", "66.249.91.103", "66.249.91.147"}) {
+        auto a = make_shared<dns::RDataA>();
+        a->setAddress(addr);
+        response.answers.emplace_back(makeRecord("www.l.google.com", a));
+    }
+    vector<uint8_t> responsePacket;
+    check(response.encode(responsePacket) == dns::BufferResult::NoError, "response");
+
+    dns::Message decoded;
+    bench("message.decode/query", [&]() {
+        decoded.decode(queryPacket.data(), queryPacket.size());
+        return queryPacket.size();
+    });
+    bench("message.decode/response", [&]() {
+        decoded.decode(responsePacket.data(), responsePacket.size());
+        return responsePacket.size();
+    });
+    dns::Arena arena;
+    dns::Message decodedArena;
+    bench("message.decode_arena/response", [&]() {
+        decodedArena.decode(responsePacket.data(), responsePacket.size(), arena);
+        return responsePacket.size();
+    });
+    bench("message.decode_new/response", [&]() {
+        dns::Message m;
+        m.decode(responsePacket.data(), responsePacket.size());
+        return responsePacket.size();
+    });
+
+    uint8_t buf[4096];
+    size_t encodedSize = 0;
+    bench("message.encode/query", [&]() {
+        query.encode(buf, sizeof(buf), encodedSize);
+        return encodedSize;
+    });
+    bench("message.encode/response", [&]() {
+        response.encode(buf, sizeof(buf), encodedSize);
+        return encodedSize;
+    });
+    vector<uint8_t> out;
+    bench("message.encode_growable/response", [&]() {
+        response.encode(out);
+        return out.size();
+    });
+    bench("message.encode_truncated/response", [&]() {
+        response.encodeTruncated(buf, sizeof(buf), 64, encodedSize);
+        return encodedSize;
+    });
+    bench("message.encoded_size/response", [&]() {
+        return response.encodedSize();
+    });
+
+    dns::MessageView view;
+    dns::QuestionKey key;
+    bench("view.parse/response", [&]() {
+        view.parse(responsePacket.data(), responsePacket.size());
+        return responsePacket.size();
+    });
+    bench("view.parse_question/query", [&]() {
+        view.parseQuestion(queryPacket.data(), queryPacket.size(), key);
+        return queryPacket.size();
+    });
+
+    // the same response made from the query with a pre-encoded template
+    dns::Message templateResponse = response;
+    templateResponse.answers[0].mName = dns::ResponseTemplate::kQName;
+    dns::ResponseTemplate tpl;
+    check(tpl.build(templateResponse) == dns::BufferResult::NoError, "template");
+    bench("template.apply/response", [&]() {
+        tpl.apply(queryPacket.data(), queryPacket.size(), buf, sizeof(buf), encodedSize);
+        return encodedSize;
+    });
+}
+
+static void benchNameCompression() {
+    // encoding and decoding cost should grow linearly with the number of names
+    for (size_t count : {16, 256, 4096}) {
+        auto m = makeMXResponse(count);
+        vector<uint8_t> packet;
+        check(m.encode(packet) == dns::BufferResult::NoError, "MX response");
+        vector<uint8_t> buf(packet.size());
+        size_t encodedSize = 0;
+        bench("message.encode/mx" + to_string(count), [&]() {
+            m.encode(buf.data(), buf.size(), encodedSize);
+            return encodedSize;
+        });
+        dns::Message decoded;
+        bench("message.decode/mx" + to_string(count), [&]() {
+            decoded.decode(packet.data(), packet.size());
+            return packet.size();
+        });
+    }
+}
+
+static void benchDomainNames() {
+    vector<string> names = {"www.example.com", "mail.example.com", "www.example.com", "a.very.long.host.name.in.a.deep.zone.example.org"};
+    uint8_t buf[1024];
+    size_t written = 0;
+    bench("buffer.write_domain_name", [&]() {
+        dns::Buffer buff(buf, sizeof(buf));
+        for (auto &name : names) {
+            buff.writeDomainName(name);
+        }
+        written = buff.pos();
+        return written;
+    });
+
+    string name;
+    bench("buffer.read_domain_name", [&]() {
+        dns::Buffer buff(buf, written);
+        for (size_t i = 0; i < names.size(); i++) {
+            buff.readDomainName(name);
+        }
+        return written;
+    });
+}
+
+static void benchRData() {
+    // a response with 4 records of the type, for every RData class
+    dns::RecordType type;
+    for (size_t i = 0; makeRData(i, type); i++) {
+        dns::Message m;
+        m.mId = 1;
+        m.mQr = 1;
+        auto sample = makeRData(i, type);
+        auto typeName = dns::toString(type != dns::RecordType::kNone ? type : sample->getType()); // RDataUnknown has no own type
+        for (size_t j = 0; j < 4; j++) {
+            auto rd = makeRData(i, type);
+            if (type == dns::RecordType::kNone && rd->getType() == dns::RecordType::kOPT) {
+                m.additions.emplace_back(makeRecord("", rd));
+                break; // only one OPT record is allowed
+            }
+            m.answers.emplace_back(makeRecord("host.example.com", rd, type));
+        }
+        if (m.answers.empty()) {
+            m.questions.emplace_back("host.example.com", dns::RecordType::kA);
+        } else {
+            m.questions.emplace_back("host.example.com", m.answers[0].getType());
+        }
+
+        vector<uint8_t> packet;
+        check(m.encode(packet) == dns::BufferResult::NoError, "RData " + typeName);
+        uint8_t buf[4096];
+        size_t encodedSize = 0;
+        bench("rdata." + typeName + ".encode", [&]() {
+            m.encode(buf, sizeof(buf), encodedSize);
+            return encodedSize;
+        });
+        dns::Message decoded;
+        bench("rdata." + typeName + ".decode", [&]() {
+            decoded.decode(packet.data(), packet.size());
+            return packet.size();
+        });
+    }
+}
+
+static void benchZone() {
+    // answers from a zone with 100000 names
+    auto zone = make_shared<dns::Zone>("example.com");
+    auto soa = make_shared<dns::RDataSOA>();
+    soa->mMName = "ns1.example.com";
+    soa->mRName = "admin.example.com";
+    soa->mMinimum = 60;
+    check(zone->add(makeRecord("example.com", soa)) == dns::BufferResult::NoError, "soa");
+    for (size_t i = 0; i < 100000; i++) {
+        auto a = make_shared<dns::RDataA>();
+        a->setAddress("192.0.2." + to_string(i % 256));
+        check(zone->add(makeRecord("host" + to_string(i) + ".example.com", a)) == dns::BufferResult::NoError, "zone");
+    }
+    dns::ZoneStore store;
+    store.update(zone);
+    dns::ZoneStore::Reader reader(store);
+
+    dns::Message query, response;
+    query.questions.emplace_back("host12345.example.com", dns::RecordType::kA);
+    uint8_t buf[512];
+    size_t encodedSize = 0;
+    bench("zone.answer/a", [&]() {
+        reader.answer(query, response);
+        response.encode(buf, sizeof(buf), encodedSize);
+        return encodedSize;
+    });
+    dns::Message nxQuery;
+    nxQuery.questions.emplace_back("nx.example.com", dns::RecordType::kA);
+    bench("zone.answer/nxdomain", [&]() {
+        reader.answer(nxQuery, response);
+        response.encode(buf, sizeof(buf), encodedSize);
+        return encodedSize;
+    });
+
+    // the same answers from the compiled image, and its startup cost
+    vector<uint8_t> bytes;
+    check(dns::ZoneImage::compile(*zone, bytes) == dns::BufferResult::NoError, "zone image");
+    dns::ZoneImage image;
+    bench("zoneimage.attach", [&]() {
+        image.attach(bytes.data(), bytes.size());
+        return bytes.size();
+    });
+    vector<uint8_t> queryWire;
+    check(query.encode(queryWire) == dns::BufferResult::NoError, "zone image query");
+    bench("zoneimage.answer/a", [&]() {
+        image.answer(queryWire.data(), queryWire.size(), buf, sizeof(buf), encodedSize);
+        return encodedSize;
+    });
+}
+
+static void benchZoneFile() {
+    string text = "$ORIGIN example.com.\n$TTL 300\n@ SOA ns1 admin 1 7200 1800 604800 60\n  NS ns1\n";
+    for (size_t i = 0; i < 10000; i++) {
+        auto n = to_string(i);
+        text += "host" + n + " A 192.0.2." + to_string(i % 256) + "\n";
+        text += "  MX 10 mail" + n + "\n";
+    }
+    dns::ZoneFileParser parser;
+    bench("zonefile.parse/20k", [&]() {
+        size_t count = 0;
+        parser.parse(text.data(), text.size(), [&](dns::ResourceRecord &) { return ++count > 0; });
+        return text.size();
+    });
+}
+
+static void benchReader() {
+    // a pass over a 4 KB response (190 MX records), summing the MX preferences
+    auto m = makeMXResponse(190);
+    vector<uint8_t> packet;
+    check(m.encode(packet) == dns::BufferResult::NoError, "MX response");
+    check(packet.size() > 3500 && packet.size() < 4500, "4 KB response");
+    bench("reader.walk/mx190", [&]() {
+        dns::MessageReader reader(packet.data(), packet.size());
+        size_t sum = 0;
+        while (reader.next()) {
+            if (reader.record().mType == dns::RecordType::kMX) {
+                sum += (reader.record().mRData[0] << 8) + reader.record().mRData[1];
+            }
+        }
+        check(reader.result() == dns::BufferResult::NoError && sum == 189 * 190 / 2, "reader walk");
+        return packet.size();
+    });
+    dns::RDataMX mx;
+    bench("reader.decode_rdata/mx190", [&]() {
+        dns::MessageReader reader(packet.data(), packet.size());
+        while (reader.next()) {
+            if (reader.record().mType == dns::RecordType::kMX) {
+                reader.decodeRData(mx);
+            }
+        }
+        return packet.size();
+    });
+    dns::Message decoded;
+    bench("message.decode/mx190", [&]() {
+        decoded.decode(packet.data(), packet.size());
+        return packet.size();
+    });
+}
+
+static void benchWriter() {
+    // the typical response of benchMessages built from scratch: as a Message, and with MessageWriter
+    uint8_t addrs[4][4] = {{66, 249, 91, 104}, {66, 249, 91, 99}, {66, 249, 91, 103}, {66, 249, 91, 147}};
+    const string qname = "www.google.com", cname = "www.l.google.com";
+    vector<uint8_t> out;
+    bench("message.build_encode/response", [&]() {
+        dns::Message m;
+        m.mId = 0x1234;
+        m.mQr = 1;
+        m.mRD = 1;
+        m.mRA = 1;
+        m.questions.emplace_back(qname, dns::RecordType::kA);
+        auto rd = make_shared<dns::RDataCNAME>();
+        rd->mName = cname;
+        m.answers.emplace_back(makeRecord(qname, rd));
+        for (auto &addr : addrs) {
+            auto a = make_shared<dns::RDataA>();
+            a->setAddress(addr);
+            m.answers.emplace_back(makeRecord(cname, a));
+        }
+        m.encode(out);
+        return out.size();
+    });
+    dns::MessageWriter w(out);
+    bench("writer.build/response", [&]() {
+        w.reset();
+        w.mId = 0x1234;
+        w.mQr = 1;
+        w.mRD = 1;
+        w.mRA = 1;
+        w.addQuestion(qname, dns::RecordType::kA);
+        w.addCNAME(qname, 300, cname);
+        for (auto &addr : addrs) {
+            w.addA(cname, 300, addr);
+        }
+        size_t size;
+        w.finish(size);
+        return size;
+    });
+}
+
+static void benchStream() {
+    // 100 pipelined queries (about 3.3 KB) received in segments of 1460 bytes, so some queries are cut off
+    vector<uint8_t> stream;
+    for (size_t i = 0; i < 100; i++) {
+        dns::Message q;
+        q.mId = (uint16_t) i;
+        q.questions.emplace_back("host" + to_string(i) + ".example.com", dns::RecordType::kA);
+        check(dns::StreamFramer::encode(q, stream) == dns::BufferResult::NoError, "stream query");
+    }
+    dns::StreamFramer framer;
+    bench("stream.framer/100_queries", [&]() {
+        size_t count = 0;
+        for (size_t pos = 0; pos < stream.size(); pos += 1460) {
+            framer.feed(stream.data() + pos, std::min<size_t>(1460, stream.size() - pos));
+            const uint8_t *message;
+            size_t size;
+            while (framer.next(message, size)) {
+                count++;
+            }
+        }
+        return count;
+    });
+    dns::Message response = makeMXResponse(10);
+    vector<uint8_t> out;
+    bench("stream.encode/mx10", [&]() {
+        out.clear();
+        dns::StreamFramer::encode(response, out);
+        return out.size();
+    });
+}
+
+static void benchCache() {
+    // hits on a cache with 10000 responses, against decoding and encoding the response
+    dns::ResponseCache cache(64 << 20);
+    vector<uint8_t> response, query;
+    auto now = dns::ResponseCache::Clock::now();
+    for (size_t i = 0; i < 10000; i++) {
+        auto name = "host" + to_string(i) + ".example.com";
+        dns::Message m;
+        m.mQr = 1;
+        m.questions.emplace_back(name, dns::RecordType::kA);
+        for (size_t j = 0; j < 4; j++) {
+            auto a = make_shared<dns::RDataA>();
+            a->setAddress("192.0.2." + to_string(j));
+            m.answers.emplace_back(makeRecord(name, a));
+        }
+        check(m.encode(response) == dns::BufferResult::NoError, "cache response");
+        check(cache.insert(response.data(), response.size(), now) == dns::BufferResult::NoError, "cache insert");
+    }
+    dns::Message q;
+    q.mId = 7;
+    q.questions.emplace_back("host1234.example.com", dns::RecordType::kA);
+    check(q.encode(query) == dns::BufferResult::NoError, "cache query");
+    uint8_t buf[512];
+    size_t size = 0;
+    auto later = now + std::chrono::seconds(5);
+    bench("cache.lookup/hit", [&]() {
+        cache.lookup(query.data(), query.size(), buf, sizeof(buf), size, later);
+        return size;
+    });
+    dns::Message decoded;
+    bench("cache.decode_encode", [&]() {
+        decoded.decode(response.data(), response.size());
+        decoded.encode(buf, sizeof(buf), size);
+        return size;
+    });
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        nameFilter = argv[1];
+    }
+    benchMessages();
+    benchNameCompression();
+    benchDomainNames();
+    benchRData();
+    benchZone();
+    benchZoneFile();
+    benchCache();
+    benchStream();
+    benchWriter();
+    benchReader();
+    printJson();
+    return 0;
+}
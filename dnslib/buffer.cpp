@@ -99,38 +99,42 @@
  */
 
 #include <iostream>
-#include <algorithm>
 #include <cstring>
 
 #include "buffer.h"
 
 using namespace dns;
 
+const size_t Buffer::kNameCacheSize;
+const size_t Buffer::kNameCachePoolSize;
+
 uint8_t Buffer::readUint8() {
-    auto p = movePtr(bufPtr + 1);
+    auto p = moveTo(bufPos + 1);
     return p ? *p : 0;
 }
 
 void Buffer::writeUint8(uint8_t value) {
-    auto p = movePtr(bufPtr + 1);
+    nameCacheCount = 0;
+    auto p = moveTo(bufPos + 1);
     if (!p) return;
     *p = value & 0xFF;
 }
 
 uint16_t Buffer::readUint16() {
-    auto p = movePtr(bufPtr + 2);
+    auto p = moveTo(bufPos + 2);
     return p ? (((uint16_t) p[0]) << 8) + p[1] : 0;
 }
 
 void Buffer::writeUint16(uint16_t value) {
-    auto p = movePtr(bufPtr + 2);
+    nameCacheCount = 0;
+    auto p = moveTo(bufPos + 2);
     if (!p) return;
     p[0] = (value & 0xFF00) >> 8;
     p[1] = value & 0xFF;
 }
 
 uint32_t Buffer::readUint32() {
-    auto p = movePtr(bufPtr + 4);
+    auto p = moveTo(bufPos + 4);
     if (!p) return 0;
 
     uint32_t value = 0;
@@ -142,7 +146,8 @@ uint32_t Buffer::readUint32() {
 }
 
 void Buffer::writeUint32(uint32_t value) {
-    auto p = movePtr(bufPtr + 4);
+    nameCacheCount = 0;
+    auto p = moveTo(bufPos + 4);
     if (!p) return;
     p[0] = (value & 0xFF000000) >> 24;
     p[1] = (value & 0x00FF0000) >> 16;
@@ -150,12 +155,24 @@ void Buffer::writeUint32(uint32_t value) {
     p[3] = value & 0x000000FF;
 }
 
+Buffer::Buffer(std::vector<uint8_t> &growable, size_t origin) : bufBase(nullptr), bufLen(0), bufGrowable(&growable), bufOrigin(origin) {
+    if (growable.size() < origin) {
+        growable.resize(origin);
+    }
+    bufBase = growable.data() + origin;
+    bufLen = growable.size() - origin;
+}
+
 void Buffer::seek(size_t pos) {
-    movePtr(bufBase + pos);
+    moveTo(pos);
 }
 
 uint8_t *Buffer::readBytes(size_t count) {
-    return movePtr(bufPtr + count);
+    if (count > bufLen) {
+        markBroken(BufferResult::BufferOverflow);
+        return nullptr;
+    }
+    return moveTo(bufPos + count);
 }
 
 bool Buffer::readBytes(size_t count, std::vector<uint8_t> &out) {
@@ -176,19 +193,26 @@ void Buffer::writeBytes(const uint8_t *data, size_t count) {
     if (count == 0) {
         return; // maybe something wrong
     }
-    auto p = movePtr(bufPtr + count);
+    nameCacheCount = 0;
+    auto p = moveTo(bufPos + count);
+    if (!p) return;
     memcpy(p, data, count);
 }
 
 std::string Buffer::readCharString() {
     std::string result;
+    readCharString(result);
+    return result;
+}
+
+void Buffer::readCharString(std::string &out) {
+    out.clear();
     auto len = readUint8();    // read first octet (byte) to know length of string
     if (len > 0) {
         auto p = readBytes(len);
-        if (!p) return result;
-        result.append((char *)p, len); // read label
+        if (!p) return;
+        out.append((char *)p, len); // read label
     }
-    return result;
 }
 
 void Buffer::writeCharString(const std::string &value) {
@@ -196,21 +220,34 @@ void Buffer::writeCharString(const std::string &value) {
     writeBytes((const uint8_t *) value.c_str(), value.length());
 }
 
-std::string Buffer::readDomainName(bool compressionAllowed) { // NOLINT(misc-no-recursion)
+std::string Buffer::readDomainName(bool compressionAllowed) {
     std::string domain;
+    readDomainName(domain, compressionAllowed);
+    return domain;
+}
 
-    // store current position to avoid of endless recursion for "bad link addresses"
-    if (std::find(domainLinkPos.begin(), domainLinkPos.end(), pos()) != domainLinkPos.end()) {
-        markBroken(BufferResult::LabelCompressionLoop); // labels compression contains endless loop of links
-        return domain;
+void Buffer::readDomainName(std::string &out, bool compressionAllowed) {
+    out.clear();
+
+    // offsets where suffixes of this name start (the name itself and link targets) and where they start in out,
+    // they are added to the cache when the name is complete
+    struct {
+        size_t offset;
+        size_t start;
+    } suffixes[4];
+    size_t suffixCount = 0;
+    if (bufBase && bufPos <= 0x3FFF && bufPos < bufLen && bufBase[bufPos] >> 6 != 3) {
+        suffixes[suffixCount++] = {bufPos, 0};
     }
 
-    domainLinkPos.push_back(pos());
-
-    // read domain name from buffer
+    size_t links = 0;
+    size_t savedPos = 0;
     while (true) {
         // get first byte to decide if we are reading link, empty string or string of nonzero length
         auto ctrlCode = readUint8();
+        if (isBroken()) {
+            return;
+        }
         // if we are on the end of the string
         if (ctrlCode == 0) {
             break;
@@ -221,130 +258,366 @@ std::string Buffer::readDomainName(bool compressionAllowed) { // NOLINT(misc-no-
             // check if compression is allowed
             if (!compressionAllowed) {
                 markBroken(BufferResult::LabelCompressionDisallowed); // compression link found where links are not allowed
-                return domain;
+                return;
+            }
+
+            // every link except the last one is followed by a label, so a valid name never has more links,
+            // this avoids endless loop for "bad link addresses"
+            if (++links > kMaxDomainLen / 2 + 1) {
+                markBroken(BufferResult::LabelCompressionLoop); // labels compression contains endless loop of links
+                return;
             }
 
             // read second byte and get link address
-            auto ctrlCode2 = readUint8();
-            auto linkAddr = ((ctrlCode & 63) << 8) + ctrlCode2;
-            // change buffer position
-            auto saveBuffPos = pos();
-            seek(linkAddr);
-            std::string linkDomain = readDomainName();
-            seek(saveBuffPos);
+            size_t linkAddr = ((ctrlCode & 63) << 8) + readUint8();
+            if (links == 1) {
+                savedPos = pos(); // continue after the first link when the name is read
+            }
 
-            if (!domain.empty()) {
-                domain.push_back('.');
+            // the suffix may be decoded already
+            size_t i = 0;
+            while (i < nameCacheCount && nameCache[i].offset != linkAddr) {
+                i++;
             }
-            domain.append(linkDomain);
-            // link always terminates the domain name (no zero at the end in this case)
-            break;
+            if (i < nameCacheCount) {
+                if (nameCache[i].len) {
+                    if (!out.empty()) {
+                        out.push_back('.');
+                    }
+                    out.append(nameCachePool + nameCache[i].poolPos, nameCache[i].len);
+                }
+                break;
+            }
+
+            if (suffixCount < sizeof(suffixes) / sizeof(suffixes[0])) {
+                suffixes[suffixCount++] = {linkAddr, out.empty() ? 0 : out.length() + 1};
+            }
+            seek(linkAddr);
+            continue;
         }
 
         // otherwise, we are reading a label
-        {
-            if (ctrlCode > kMaxLabelLen) {
-                markBroken(BufferResult::LabelTooLong); // too long domain label (max length is 63 characters)
-                return domain;
-            }
+        if (ctrlCode > kMaxLabelLen) {
+            markBroken(BufferResult::LabelTooLong); // too long domain label (max length is 63 characters)
+            return;
+        }
 
-            if (!domain.empty()) {
-                domain.push_back('.');
-            }
-            auto p = readBytes(ctrlCode);
-            if (!p) return domain;
-            domain.append((char *)p, ctrlCode); // read label
+        if (!out.empty()) {
+            out.push_back('.');
+        }
+        auto p = readBytes(ctrlCode);
+        if (!p) return;
+        out.append((char *) p, ctrlCode); // read label
+        if (out.length() > kMaxDomainLen) {
+            markBroken(BufferResult::DomainTooLong); // domain name is too long
+            return;
         }
     }
 
-    domainLinkPos.pop_back();
-
-    if (domain.length() > kMaxDomainLen) {
+    if (out.length() > kMaxDomainLen) {
         markBroken(BufferResult::DomainTooLong); // domain name is too long
-        return domain;
+        return;
     }
+    if (links) {
+        seek(savedPos);
+    }
+    for (size_t i = 0; i < suffixCount; i++) {
+        auto start = suffixes[i].start < out.length() ? suffixes[i].start : out.length();
+        addNameCache(suffixes[i].offset, out.data() + start, out.length() - start);
+    }
+}
 
-    return domain;
+void Buffer::addNameCache(size_t offset, const char *suffix, size_t len) {
+    for (size_t i = 0; i < nameCacheCount; i++) {
+        if (nameCache[i].offset == offset) {
+            return;
+        }
+    }
+    if (nameCachePoolUsed + len > kNameCachePoolSize || nameCacheCount == 0) {
+        nameCacheCount = 0; // start over
+        nameCacheNext = 0;
+        nameCachePoolUsed = 0;
+    }
+    size_t i = nameCacheCount < kNameCacheSize ? nameCacheCount++ : nameCacheNext++ % kNameCacheSize;
+    nameCache[i].offset = offset;
+    nameCache[i].poolPos = nameCachePoolUsed;
+    nameCache[i].len = len;
+    memcpy(nameCachePool + nameCachePoolUsed, suffix, len);
+    nameCachePoolUsed += len;
 }
 
-void Buffer::writeDomainName(const std::string &value, bool compressionAllowed) {
+static uint32_t hashDomainLabel(const uint8_t *label, uint32_t parent) {
+    // FNV-1a over the label (with its length byte), seeded by the entry of the rest of the name
+    uint32_t hash = 2166136261u ^ parent;
+    for (size_t i = 0; i <= label[0]; i++) {
+        hash ^= label[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t Buffer::findDomainEntry(const uint8_t *label, uint32_t parent, uint32_t hash) const {
+    if (domainSlots.empty()) {
+        return 0;
+    }
+    size_t mask = domainSlots.size() - 1;
+    for (size_t i = hash & mask; domainSlots[i]; i = (i + 1) & mask) {
+        auto &entry = domainEntries[domainSlots[i] - 1];
+        if (entry.hash == hash && entry.parent == parent && memcmp((bufMeasuring ? domainLabels.data() : bufBase) + entry.labelPos, label, label[0] + 1) == 0) {
+            return domainSlots[i];
+        }
+    }
+    return 0;
+}
+
+void Buffer::addDomainEntry(uint32_t pos, uint32_t parent, uint32_t hash, const uint8_t *label) {
+    // keep the load factor below 1/2, so probing stays short
+    if ((domainEntries.size() + 1) * 2 > domainSlots.size()) {
+        domainSlots.assign(domainSlots.empty() ? 64 : domainSlots.size() * 2, 0);
+        size_t mask = domainSlots.size() - 1;
+        for (size_t e = 0; e < domainEntries.size(); e++) {
+            size_t i = domainEntries[e].hash & mask;
+            while (domainSlots[i]) i = (i + 1) & mask;
+            domainSlots[i] = e + 1;
+        }
+    }
+    // a measuring buffer does not have the written bytes, so it keeps its own copy of the labels
+    uint32_t labelPos = pos;
+    if (bufMeasuring) {
+        labelPos = domainLabels.size();
+        domainLabels.insert(domainLabels.end(), label, label + label[0] + 1);
+    }
+    domainEntries.push_back(DomainEntry{hash, pos, parent, labelPos});
+    size_t mask = domainSlots.size() - 1;
+    size_t i = hash & mask;
+    while (domainSlots[i]) i = (i + 1) & mask;
+    domainSlots[i] = domainEntries.size();
+}
+
+BufferResult Buffer::toWireDomainName(const std::string &value, uint8_t *out, size_t &outLen) {
+    outLen = 0;
     if (value.length() > kMaxDomainLen) {
-        markBroken(BufferResult::DomainTooLong); // Domain name too long to be stored in dns message
-        return;
+        return BufferResult::DomainTooLong; // Domain name too long to be stored in dns message
     }
 
-    // write empty domain
+    // empty domain
     if (value.empty() || value == ".") {
-        writeUint8(0);
-        return;
+        out[outLen++] = 0;
+        return BufferResult::NoError;
     }
 
-    std::vector<uint8_t> domain;
-    std::vector<size_t> domainLabelIndexes;
+    // convert value to <domain> without links as defined in RFC: abcd.efg.hi -> |0x4|a|b|c|d|0x3|e|f|g|0x2|h|i|0x0|
+    size_t labelStart = 0;
+    size_t valueLen = value.length();
+    if (value[valueLen - 1] == '.') {
+        valueLen--; // the trailing dot is the root label
+    }
+    for (size_t i = 0; i <= valueLen; i++) {
+        if (i == valueLen || value[i] == '.') {
+            auto labelLen = i - labelStart;
+            if (labelLen > kMaxLabelLen) {
+                outLen = 0;
+                return BufferResult::LabelTooLong; // Encoding failed because of too long domain label (max length is 63 characters)
+            }
+            if (labelLen == 0) {
+                outLen = 0;
+                return BufferResult::InvalidData; // empty label is only allowed for root
+            }
+            out[outLen++] = (uint8_t) labelLen;
+            memcpy(out + outLen, value.data() + labelStart, labelLen);
+            outLen += labelLen;
+            labelStart = i + 1;
+        }
+    }
+    out[outLen++] = 0;
+    return BufferResult::NoError;
+}
 
-    {
-        // convert value to <domain> without links as defined in RFC: abcd.efg.hi -> |0x4|a|b|c|d|0x3|e|f|g|0x2|h|i|0x0|
-        domain.push_back(0); // first byte is label length (will be set later)
-        size_t labelLenPos = 0; // position of label length byte
-        for (size_t i = 0; i <= value.length(); i++) {
-            if (i == value.length() || value[i] == '.') {
-                auto labelLen = (uint8_t) (domain.size() - labelLenPos - 1);
-                if (labelLen > kMaxLabelLen) {
-                    markBroken(BufferResult::LabelTooLong); // Encoding failed because of too long domain label (max length is 63 characters)
-                    return;
-                }
-                domain[labelLenPos] = labelLen;
-                domainLabelIndexes.push_back(labelLenPos);
-                domain.push_back(0); // start a new label (with length byte)
-                labelLenPos = domain.size() - 1;
-                if (i == value.length() - 1) {
-                    break; // do not add duplicate zero byte at the end
-                }
-            } else {
-                domain.push_back(value[i]);
+size_t Buffer::readDomainNameWire(uint8_t *out, bool compressionAllowed) {
+    size_t len = 0;
+    size_t links = 0;
+    size_t savedPos = 0;
+    while (true) {
+        auto ctrlCode = readUint8();
+        if (isBroken()) {
+            return 0;
+        }
+        if (ctrlCode == 0) {
+            break;
+        }
+
+        if (ctrlCode >> 6 == 3) {
+            if (!compressionAllowed) {
+                markBroken(BufferResult::LabelCompressionDisallowed); // compression link found where links are not allowed
+                return 0;
+            }
+            if (++links > kMaxDomainLen / 2 + 1) {
+                markBroken(BufferResult::LabelCompressionLoop); // labels compression contains endless loop of links
+                return 0;
             }
+            auto linkAddr = ((ctrlCode & 63) << 8) + readUint8();
+            if (links == 1) {
+                savedPos = pos(); // continue after the first link when the name is read
+            }
+            seek(linkAddr);
+            continue;
+        }
+
+        if (ctrlCode > kMaxLabelLen) {
+            markBroken(BufferResult::LabelTooLong); // too long domain label (max length is 63 characters)
+            return 0;
+        }
+        if (len + ctrlCode + 1 > kMaxDomainLen + 1) {
+            markBroken(BufferResult::DomainTooLong); // domain name is too long
+            return 0;
+        }
+        auto p = readBytes(ctrlCode);
+        if (!p) return 0;
+        out[len] = ctrlCode;
+        memcpy(out + len + 1, p, ctrlCode);
+        len += ctrlCode + 1;
+    }
+    out[len++] = 0;
+    if (links) {
+        seek(savedPos);
+    }
+    return len;
+}
+
+void Buffer::writeDomainName(const std::string &value, bool compressionAllowed) {
+    if (isBroken()) {
+        return;
+    }
+    uint8_t domain[kMaxDomainLen + 2];
+    size_t domainLen;
+    auto result = toWireDomainName(value, domain, domainLen);
+    if (result != BufferResult::NoError) {
+        markBroken(result);
+        return;
+    }
+    writeDomainNameWire(domain, domainLen, compressionAllowed);
+}
+
+void Buffer::writeDomainNameWire(const uint8_t *domain, size_t domainLen, bool compressionAllowed) {
+    if (isBroken()) {
+        return; // the compression dictionary may refer to positions which were never written
+    }
+
+    size_t labelIndexes[kMaxDomainLen / 2 + 1];
+    size_t labelCount = 0;
+    for (size_t i = 0; i < domainLen && domain[i]; i += domain[i] + 1) {
+        if (domain[i] > kMaxLabelLen || i + domain[i] + 1 >= domainLen || labelCount == sizeof(labelIndexes) / sizeof(labelIndexes[0])) {
+            markBroken(BufferResult::InvalidData);
+            return;
         }
+        labelIndexes[labelCount++] = i;
     }
 
-    if (!compressionAllowed) {
+    if (!compressionAllowed || labelCount == 0) {
         // compression is disabled, domain is written as it is
-        writeBytes(domain.data(), domain.size());
+        writeBytes(domain, domainLen);
         return;
     }
 
-    // look for domain name parts in buffer and look for fragments for compression
-    // loop over all domain labels
-    for (size_t i = 0; i < domainLabelIndexes.size(); i++) {
-        uint8_t *subDomain = domain.data() + domainLabelIndexes[i]; // pointer to subdomain (including initial byte for first label length)
-        size_t subDomainLen = domain.size() - domainLabelIndexes[i];
+    // look up the suffixes from the shortest one (last label) to the longest one (whole name),
+    // every suffix entry links to the entry of its parent, so a miss means no longer suffix was written before
+    uint32_t hashes[kMaxDomainLen / 2 + 1];
+    uint32_t parent = 0;
+    size_t matchIdx = labelCount; // labels [matchIdx, labelCount) have been written before
+    size_t linkIdx = labelCount; // labels [linkIdx, labelCount) will be replaced by a link
+    uint32_t linkPos = 0;
+    for (size_t i = labelCount; i-- > 0;) {
+        hashes[i] = hashDomainLabel(domain + labelIndexes[i], parent);
+        auto found = findDomainEntry(domain + labelIndexes[i], parent, hashes[i]);
+        if (!found) {
+            break;
+        }
+        parent = found;
+        matchIdx = i;
+        // a link can only address the first 16K of the message
+        if (domainEntries[found - 1].pos <= 0x3fff) {
+            linkIdx = i;
+            linkPos = domainEntries[found - 1].pos;
+        }
+    }
 
-        // find the subDomain in the domainPositions
-        for (auto &domainPos : domainPositions) {
-            if (domainPos.first.size() == subDomainLen && memcmp(domainPos.first.data(), subDomain, subDomainLen) == 0) {
-                // link starts with value 0b11000000_00000000
-                writeUint16(0xc000 + domainPos.second);
-                return;
-            }
+    // remember all new suffixes which will be written as labels
+    auto startPos = (uint32_t) pos();
+    for (size_t i = matchIdx; i-- > 0;) {
+        addDomainEntry(startPos + labelIndexes[i], parent, hashes[i], domain + labelIndexes[i]);
+        parent = domainEntries.size();
+        if (i > 0) {
+            hashes[i - 1] = hashDomainLabel(domain + labelIndexes[i - 1], parent);
         }
-        // current label didn't appear before, write current label and remember it in domainPositions
-        auto subLabelLen = (uint8_t) subDomain[0];
-        domainPositions.emplace_back(std::vector<uint8_t>(subDomain, subDomain + subDomainLen), pos());
-        writeBytes((uint8_t *) subDomain, subLabelLen + 1);
     }
 
-    writeUint8(0); // write terminating zero if no compression tip was found and all labels are written to buffer
+    if (linkIdx == labelCount) {
+        // no compression tip was found, all labels and the terminating zero are written to buffer
+        writeBytes(domain, domainLen);
+        return;
+    }
+
+    // link starts with value 0b11000000_00000000
+    writeBytes(domain, labelIndexes[linkIdx]);
+    auto linkWritePos = (uint32_t) pos();
+    writeUint16(0xc000 + linkPos);
+    if (linkLog && !isBroken()) {
+        linkLog->push_back(linkWritePos);
+    }
+}
+
+void Buffer::rollback(const Checkpoint &cp) {
+    bufResult = BufferResult::NoError;
+    bufPos = cp.pos;
+    if (domainEntries.size() > cp.domainEntryCount) {
+        domainEntries.resize(cp.domainEntryCount);
+        domainLabels.resize(cp.domainLabelSize);
+        // rebuild the hash slots from the remaining entries
+        domainSlots.assign(domainSlots.size(), 0);
+        size_t mask = domainSlots.size() - 1;
+        for (size_t e = 0; e < domainEntries.size(); e++) {
+            size_t i = domainEntries[e].hash & mask;
+            while (domainSlots[i]) i = (i + 1) & mask;
+            domainSlots[i] = e + 1;
+        }
+    }
+}
+
+void Buffer::reset() {
+    bufResult = BufferResult::NoError;
+    bufPos = 0;
+    if (bufGrowable) {
+        // the vector may have been resized since (eg: to the written size), use its current storage
+        if (bufGrowable->size() < bufOrigin) {
+            bufGrowable->resize(bufOrigin);
+        }
+        bufBase = bufGrowable->data() + bufOrigin;
+        bufLen = bufGrowable->size() - bufOrigin;
+    }
+    nameCacheCount = 0;
+    domainEntries.clear();
+    domainLabels.clear();
+    domainSlots.assign(domainSlots.size(), 0);
 }
 
-uint8_t *Buffer::movePtr(uint8_t *newPtr) {
+uint8_t *Buffer::moveTo(size_t newPos) {
     if (bufResult != BufferResult::NoError) return nullptr;
 
-    size_t p = newPtr - bufBase;
-    if (p > bufLen) {
-        markBroken(BufferResult::BufferOverflow);
-        return nullptr;
+    if (newPos > bufLen) {
+        if (!bufGrowable) {
+            markBroken(BufferResult::BufferOverflow);
+            return nullptr;
+        }
+        size_t newLen = bufLen < 256 ? 512 : bufLen * 2;
+        if (newLen < newPos) {
+            newLen = newPos;
+        }
+        bufGrowable->resize(bufOrigin + newLen);
+        bufBase = bufGrowable->data() + bufOrigin;
+        bufLen = newLen;
     }
 
-    auto oldPtr = bufPtr;
-    bufPtr = newPtr;
-    return oldPtr;
+    auto oldPos = bufPos;
+    bufPos = newPos;
+    return bufMeasuring ? nullptr : bufBase + oldPos;
 }
@@ -7,6 +7,7 @@
 #ifndef _DNS_BUFFER_H
 #define	_DNS_BUFFER_H
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -22,6 +23,8 @@ enum class BufferResult {
     LabelCompressionDisallowed,
     LabelTooLong,
     DomainTooLong,
+    LimitExceeded, // more entries than allowed by DecodeLimits
+    FileError, // writing a file failed, errno tells why
 };
 
 /**
@@ -40,13 +43,23 @@ public:
     Buffer(const Buffer&) = delete;
     Buffer& operator=(const Buffer&) = delete;
 
-    Buffer(uint8_t *buffer, size_t bufferSize) : bufBase(buffer), bufPtr(buffer), bufLen(bufferSize) {}
+    Buffer(uint8_t *buffer, size_t bufferSize) : bufBase(buffer), bufLen(bufferSize) {}
+
+    // buffer which grows the vector when writing beyond its size, the vector may have more bytes than written at the end
+    explicit Buffer(std::vector<uint8_t> &growable) : bufBase(growable.data()), bufLen(growable.size()), bufGrowable(&growable) {}
+
+    // same, but the buffer starts at origin of the vector (eg: after a length prefix), the bytes before it are kept,
+    // positions and compression links are relative to origin
+    Buffer(std::vector<uint8_t> &growable, size_t origin);
+
+    // buffer which writes nothing, it only measures the encoded size (including name compression) by pos()
+    Buffer(std::nullptr_t, size_t bufferSize) : bufBase(nullptr), bufLen(bufferSize), bufMeasuring(true) {}
 
     // for debug purpose only
     Buffer(const char *buffer, size_t bufferSize) : Buffer((uint8_t *) buffer, bufferSize) {}
 
-    inline size_t pos() const { return bufPtr - bufBase; }
-    inline uint8_t *ptr() { return bufPtr; }
+    inline size_t pos() const { return bufPos; }
+    inline uint8_t *ptr() { return bufMeasuring ? nullptr : bufBase + bufPos; }
     inline size_t size() const { return bufLen; }
     void seek(size_t pos);
 
@@ -66,27 +79,92 @@ public:
 
     // read & write <character-string> (according to RFC 1035) from buffer
     std::string readCharString();
+    void readCharString(std::string &out); // reuses the capacity of out
     void writeCharString(const std::string &value);
 
     // read & write <domain> (according to RFC 1035) from buffer
     std::string readDomainName(bool compressionAllowed = true);
+    void readDomainName(std::string &out, bool compressionAllowed = true); // reuses the capacity of out
     void writeDomainName(const std::string &value, bool compressionAllowed = true);
 
+    // read & write <domain> in uncompressed wire form (labels and the terminating zero, at most kMaxDomainLen + 2 bytes),
+    // readDomainNameWire returns the length of the name in out, 0 if the buffer is broken
+    size_t readDomainNameWire(uint8_t *out, bool compressionAllowed = true);
+    void writeDomainNameWire(const uint8_t *domain, size_t domainLen, bool compressionAllowed = true);
+
+    // convert a domain name to uncompressed wire form, out must have kMaxDomainLen + 2 bytes
+    static BufferResult toWireDomainName(const std::string &value, uint8_t *out, size_t &outLen);
+
+    // save the state, so everything written after it can be dropped again (eg: for truncation)
+    struct Checkpoint {
+        size_t pos;
+        size_t domainEntryCount;
+        size_t domainLabelSize;
+    };
+    Checkpoint checkpoint() const { return Checkpoint{bufPos, domainEntries.size(), domainLabels.size()}; }
+    void rollback(const Checkpoint &cp); // also clears the broken state
+
+    // start over at position 0 like a new buffer on the same memory (a growable vector may have been resized),
+    // the memory of the dictionary is kept for reuse
+    void reset();
+
+    // record the position of every link written by name compression, eg: to relocate the links later
+    // (positions are not removed by rollback)
+    void setLinkLog(std::vector<uint32_t> *positions) { linkLog = positions; }
+
     inline BufferResult result() { return bufResult; }
     inline bool isBroken() { return bufResult != BufferResult::NoError; }
     inline void markBroken(BufferResult b) { bufResult = b; }
+    inline void clearBroken() { bufResult = BufferResult::NoError; } // eg: to read on after a failed read
 
 private:
-    uint8_t *movePtr(uint8_t *newPtr); // returns the old pos ptr. returns nullptr if buffer is broken
+    uint8_t *moveTo(size_t newPos); // returns the old pos ptr. returns nullptr if buffer is broken (or measuring)
+    void addNameCache(size_t offset, const char *suffix, size_t len);
 
     BufferResult bufResult{};
 
     uint8_t *bufBase;
-    uint8_t *bufPtr;
+    size_t bufPos = 0;
     size_t bufLen;
-
-    std::vector<size_t> domainLinkPos; // list of link positions visited when decoding
-    std::vector<std::pair<std::vector<uint8_t>, size_t>> domainPositions; // list of domain names and their positions in buffer when encoding
+    std::vector<uint8_t> *bufGrowable = nullptr;
+    size_t bufOrigin = 0; // of the growable vector
+    bool bufMeasuring = false;
+
+    // Decoded name suffixes by offset (only offsets which links can point to), used when decoding: when many names
+    // link to the same suffix (eg: 50 records linking to the question name) its labels are walked only once.
+    // Fixed size without heap allocation, the text is kept in a small pool which starts over when it is full.
+    // Writing to the buffer invalidates the cache.
+    static const size_t kNameCacheSize = 8;
+    static const size_t kNameCachePoolSize = 1024;
+    struct NameCacheEntry {
+        uint16_t offset;
+        uint16_t poolPos;
+        uint16_t len;
+    };
+    NameCacheEntry nameCache[kNameCacheSize];
+    size_t nameCacheCount = 0;
+    size_t nameCacheNext = 0; // entry to replace when the cache is full
+    size_t nameCachePoolUsed = 0;
+    char nameCachePool[kNameCachePoolSize];
+
+    // Name compression dictionary used when encoding.
+    //
+    // Every domain name suffix written to the buffer is one entry: its first label plus a link to the entry of the
+    // remaining suffix. The label bytes are not copied, they are compared against the bytes already written at "pos".
+    // Entries are found through an open addressing hash table, so looking up a suffix costs O(1) instead of a scan.
+    struct DomainEntry {
+        uint32_t hash;
+        uint32_t pos; // position of the label length byte in buffer
+        uint32_t parent; // index + 1 of the entry for the rest of the name, 0 for root
+        uint32_t labelPos; // position of the label bytes, in buffer or in domainLabels (when measuring)
+    };
+    std::vector<DomainEntry> domainEntries;
+    std::vector<uint32_t> domainSlots; // hash slots, index + 1 into domainEntries, 0 for empty
+    std::vector<uint8_t> domainLabels; // label bytes of domainEntries when measuring
+    std::vector<uint32_t> *linkLog = nullptr;
+
+    uint32_t findDomainEntry(const uint8_t *label, uint32_t parent, uint32_t hash) const;
+    void addDomainEntry(uint32_t pos, uint32_t parent, uint32_t hash, const uint8_t *label);
 };
 
 } // namespace
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "cache.h"
+
+using namespace dns;
+
+static inline uint16_t readUint16(const uint8_t *p) {
+    return (((uint16_t) p[0]) << 8) + p[1];
+}
+
+static inline void writeUint16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline uint32_t readUint32(const uint8_t *p) {
+    return (((uint32_t) p[0]) << 24) + (((uint32_t) p[1]) << 16) + (((uint32_t) p[2]) << 8) + p[3];
+}
+
+static inline void writeUint32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+const uint32_t ResponseCache::kMaxNegativeTtl;
+
+// EDNS state of the key
+static const uint8_t kEdns = 1;
+static const uint8_t kEdnsDnssecOk = 2;
+
+struct ResponseCache::Key {
+    QuestionKey mQuestion;
+    uint8_t mEdns = 0;
+
+    bool operator==(const Key &other) const { return mEdns == other.mEdns && mQuestion == other.mQuestion; }
+};
+
+struct ResponseCache::KeyHash {
+    size_t operator()(const Key &key) const { return key.mQuestion.hash() ^ key.mEdns; }
+};
+
+// the EDNS state of the OPT record rr
+static uint8_t ednsState(const RecordView &rr) {
+    return kEdns | ((rr.mTtl & RDataOPT::kFlagDO) ? kEdnsDnssecOk : 0);
+}
+
+struct ResponseCache::Entry {
+    std::vector<uint8_t> mWire;
+    std::vector<uint16_t> mTtlPositions; // TTL fields of the records (OPT excluded)
+    size_t mQuestionEnd = 0;
+    Clock::time_point mStored;
+    Clock::time_point mExpires;
+    Clock::time_point mStaleUntil; // kept after mExpires for serve-stale
+    Clock::time_point mRefreshAt; // next time a stale hit asks for a refresh
+    bool mReferenced = false;
+    bool mUsed = false;
+
+    // the key is stored twice, in the index and in mKeys
+    size_t bytes() const { return sizeof(Entry) + 2 * sizeof(Key) + mWire.size() + mTtlPositions.size() * 2; }
+};
+
+struct ResponseCache::Shard {
+    mutable std::mutex mMutex;
+    std::unordered_map<Key, size_t, KeyHash> mIndex; // entry index by key
+    std::vector<Entry> mEntries; // the clock, unused entries are reused
+    std::vector<size_t> mFree;
+    std::vector<Key> mKeys; // key of every used entry, to remove it from the index
+    size_t mHand = 0;
+    size_t mBytes = 0;
+
+    void remove(size_t i) {
+        auto &entry = mEntries[i];
+        mBytes -= entry.bytes();
+        mIndex.erase(mKeys[i]);
+        entry.mUsed = false;
+        std::vector<uint8_t>().swap(entry.mWire);
+        std::vector<uint16_t>().swap(entry.mTtlPositions);
+        mFree.push_back(i);
+    }
+
+    // evict until size more bytes fit into maxBytes: expired entries and the ones not referenced since the last pass
+    void evict(size_t size, size_t maxBytes, Clock::time_point now) {
+        while (mBytes + size > maxBytes && mBytes) {
+            if (mHand >= mEntries.size()) {
+                mHand = 0;
+            }
+            auto &entry = mEntries[mHand];
+            if (entry.mUsed) {
+                if (entry.mReferenced && entry.mExpires > now) { // stale entries go first
+                    entry.mReferenced = false;
+                } else {
+                    remove(mHand);
+                }
+            }
+            mHand++;
+        }
+    }
+};
+
+ResponseCache::ResponseCache(size_t maxBytes, size_t shards) : mShardCount(shards ? shards : 1) {
+    mShards.reset(new Shard[mShardCount]);
+    mShardBytes = maxBytes / mShardCount;
+}
+
+ResponseCache::~ResponseCache() = default;
+
+void ResponseCache::setServeStale(uint32_t maxStale, uint32_t staleTtl) {
+    mMaxStale = maxStale;
+    mStaleTtl = staleTtl;
+}
+
+ResponseCache::Shard &ResponseCache::shardOf(const Key &key) const {
+    // the upper bits, the lower ones select the bucket of the index (all EDNS states are in the same shard)
+    return mShards[(key.mQuestion.hash() >> 16) % mShardCount];
+}
+
+BufferResult ResponseCache::insert(const uint8_t *response, size_t size, Clock::time_point now) {
+    MessageView view;
+    if (view.parseHeader(response, size) != BufferResult::NoError || !view.mQr || view.mTC || view.mOpCode != 0 ||
+        (view.mRCode != (uint16_t) ResponseCode::kNOERROR && view.mRCode != (uint16_t) ResponseCode::kNXDOMAIN) ||
+        view.mQdCount != 1) {
+        return BufferResult::InvalidData;
+    }
+    bool negative = view.mRCode == (uint16_t) ResponseCode::kNXDOMAIN || view.mAnCount == 0;
+    Key key;
+    size_t offset;
+    auto result = key.mQuestion.parse(response, size, 12, offset);
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+
+    Entry entry;
+    entry.mQuestionEnd = offset;
+    uint32_t minTtl = UINT32_MAX;
+    size_t soaTtlPos = 0;
+    uint32_t soaTtl = 0;
+    size_t count = (size_t) view.mAnCount + view.mNsCount + view.mArCount;
+    for (size_t i = 0; i < count; i++) {
+        RecordView rr;
+        result = rr.parse(response, size, offset, offset);
+        if (result != BufferResult::NoError) {
+            return result;
+        }
+        if (rr.mType == RecordType::kOPT) {
+            // its TTL holds the extended RCODE and flags, a response with an extended RCODE (BADVERS) isn't cached
+            if (key.mEdns || (rr.mTtl >> 24)) {
+                return BufferResult::InvalidData;
+            }
+            key.mEdns = ednsState(rr);
+            continue;
+        }
+        auto ttlPos = offset - rr.mRDataSize - 6;
+        if (ttlPos > 0xFFFF) {
+            return BufferResult::InvalidData;
+        }
+        entry.mTtlPositions.push_back(ttlPos);
+        auto ttl = rr.mTtl;
+        bool isAuthority = i >= view.mAnCount && i < (size_t) view.mAnCount + view.mNsCount;
+        if (negative && isAuthority && rr.mType == RecordType::SOA && !soaTtlPos && rr.mRDataSize >= 22) {
+            // the negative TTL: the TTL of the SOA limited by MINIMUM, the last field of its RDATA
+            auto minimum = readUint32(rr.mRData + rr.mRDataSize - 4);
+            ttl = std::min(std::min(ttl, minimum), kMaxNegativeTtl);
+            soaTtlPos = ttlPos;
+            soaTtl = ttl;
+        }
+        if (ttl < minTtl) {
+            minTtl = ttl;
+        }
+    }
+    if (minTtl == 0 || minTtl == UINT32_MAX || (negative && !soaTtlPos)) {
+        return BufferResult::InvalidData;
+    }
+    entry.mWire.assign(response, response + offset);
+    if (soaTtlPos) {
+        writeUint32(entry.mWire.data() + soaTtlPos, soaTtl);
+    }
+    entry.mStored = now;
+    entry.mExpires = now + std::chrono::seconds(minTtl);
+    entry.mStaleUntil = entry.mExpires + std::chrono::seconds(mMaxStale);
+    entry.mRefreshAt = entry.mExpires;
+    entry.mUsed = true;
+    auto bytes = entry.bytes();
+    if (bytes > mShardBytes) {
+        return BufferResult::BufferOverflow;
+    }
+
+    auto &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mMutex);
+    auto it = shard.mIndex.find(key);
+    if (it != shard.mIndex.end()) {
+        shard.remove(it->second);
+    }
+    shard.evict(bytes, mShardBytes, now);
+    size_t i;
+    if (!shard.mFree.empty()) {
+        i = shard.mFree.back();
+        shard.mFree.pop_back();
+        shard.mEntries[i] = std::move(entry);
+        shard.mKeys[i] = key;
+    } else {
+        i = shard.mEntries.size();
+        shard.mEntries.push_back(std::move(entry));
+        shard.mKeys.push_back(key);
+    }
+    shard.mIndex.emplace(key, i);
+    shard.mBytes += bytes;
+    return BufferResult::NoError;
+}
+
+bool ResponseCache::lookup(const uint8_t *query, size_t querySize, uint8_t *out, size_t outSize, size_t &responseSize,
+                           Clock::time_point now) {
+    bool refresh;
+    return lookup(query, querySize, out, outSize, responseSize, refresh, now);
+}
+
+bool ResponseCache::lookup(const uint8_t *query, size_t querySize, uint8_t *out, size_t outSize, size_t &responseSize,
+                           bool &refresh, Clock::time_point now) {
+    responseSize = 0;
+    refresh = false;
+    MessageView view;
+    Key key;
+    size_t offset;
+    if (view.parseHeader(query, querySize) != BufferResult::NoError || view.mQr || view.mQdCount != 1 ||
+        key.mQuestion.parse(query, querySize, 12, offset) != BufferResult::NoError) {
+        return false;
+    }
+    size_t count = (size_t) view.mAnCount + view.mNsCount + view.mArCount;
+    for (size_t i = 0; i < count; i++) {
+        RecordView rr;
+        if (rr.parse(query, querySize, offset, offset) != BufferResult::NoError) {
+            return false;
+        }
+        if (rr.mType == RecordType::kOPT) {
+            // more than one OPT record or an unknown version (BADVERS) is answered by the caller
+            if (key.mEdns || ((rr.mTtl >> 16) & 0xFF)) {
+                return false;
+            }
+            key.mEdns = ednsState(rr);
+        }
+    }
+
+    auto &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mMutex);
+    auto it = shard.mIndex.find(key);
+    if (it == shard.mIndex.end()) {
+        return false;
+    }
+    auto &entry = shard.mEntries[it->second];
+    if (entry.mStaleUntil <= now) {
+        shard.remove(it->second);
+        return false;
+    }
+    if (entry.mWire.size() > outSize) {
+        return false;
+    }
+    entry.mReferenced = true;
+
+    auto size = entry.mWire.size();
+    memcpy(out, entry.mWire.data(), size);
+    // the question of the query has the same length (same name and no links), its case is kept
+    memcpy(out + 12, query + 12, entry.mQuestionEnd - 12);
+    writeUint16(out, readUint16(query));
+    writeUint16(out + 2, (readUint16(out + 2) & ~0x0100) | (readUint16(query + 2) & 0x0100));
+    if (entry.mExpires <= now) {
+        // stale (RFC 8767 section 4): a short TTL, and one refresh per staleTtl
+        for (auto pos : entry.mTtlPositions) {
+            writeUint32(out + pos, mStaleTtl);
+        }
+        if (entry.mRefreshAt <= now) {
+            entry.mRefreshAt = now + std::chrono::seconds(mStaleTtl);
+            refresh = true;
+        }
+        responseSize = size;
+        return true;
+    }
+    auto elapsed = (uint64_t) std::chrono::duration_cast<std::chrono::seconds>(now - entry.mStored).count();
+    if (elapsed) {
+        for (auto pos : entry.mTtlPositions) {
+            auto ttl = readUint32(out + pos);
+            writeUint32(out + pos, ttl > elapsed ? ttl - elapsed : 0);
+        }
+    }
+    responseSize = size;
+    return true;
+}
+
+void ResponseCache::clear() {
+    for (size_t i = 0; i < mShardCount; i++) {
+        auto &shard = mShards[i];
+        std::lock_guard<std::mutex> lock(shard.mMutex);
+        shard.mIndex.clear();
+        shard.mEntries.clear();
+        shard.mKeys.clear();
+        shard.mFree.clear();
+        shard.mHand = 0;
+        shard.mBytes = 0;
+    }
+}
+
+size_t ResponseCache::entryCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < mShardCount; i++) {
+        std::lock_guard<std::mutex> lock(mShards[i].mMutex);
+        count += mShards[i].mIndex.size();
+    }
+    return count;
+}
+
+size_t ResponseCache::memoryUsage() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i < mShardCount; i++) {
+        std::lock_guard<std::mutex> lock(mShards[i].mMutex);
+        bytes += mShards[i].mBytes;
+    }
+    return bytes;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_CACHE_H
+#define _DNS_CACHE_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "dns.h"
+#include "buffer.h"
+#include "view.h"
+
+namespace dns {
+
+/**
+ * Cache of encoded responses, keyed by the question (QuestionKey: lowercase name, type and class) and the EDNS state
+ * of the query (no OPT record, OPT without or with the DO bit), because the response echoes it in its own OPT record.
+ * Queries with an unknown EDNS version are never answered from the cache, they get BADVERS.
+ *
+ * Responses are stored in wire form together with the positions of their TTL fields, a hit copies the response,
+ * patches the ID, RD and the question (so the case of the query is kept) and decreases every TTL by the time
+ * the response has been cached, nothing is decoded. An entry expires with its smallest TTL.
+ *
+ * Negative responses (NXDOMAIN, and NODATA: NOERROR without answers) are cached if they have the SOA of the zone
+ * in the authority section, for the TTL of the SOA limited by its MINIMUM field (RFC 2308 section 5).
+ *
+ * With serve-stale (RFC 8767), expired entries are kept for maxStale seconds more and answered with a TTL of
+ * staleTtl when the caller can't get a fresh response. The lookup with refresh tells the caller when to refresh
+ * an entry in the background, at most once per staleTtl, until insert replaces it.
+ *
+ * The cache is split into shards by the hash of the key, every shard has its own lock, so threads only contend
+ * for the same shard. Every shard holds at most maxBytes / shards bytes, entries are evicted with the CLOCK
+ * algorithm (an entry which has been hit since the hand passed it gets a second chance).
+ */
+class ResponseCache {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit ResponseCache(size_t maxBytes, size_t shards = 16);
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+    ~ResponseCache();
+
+    // negative responses are cached for at most this long, whatever their SOA says
+    static const uint32_t kMaxNegativeTtl = 3 * 3600;
+
+    // enable serve-stale, before the cache is shared (0 disables it)
+    void setServeStale(uint32_t maxStale, uint32_t staleTtl = 30);
+
+    // cache a response to a query with one question, InvalidData if it can't be cached
+    // (truncated, another RCODE or an extended RCODE, a negative response without SOA or a TTL of 0)
+    // or it is larger than a shard
+    BufferResult insert(const uint8_t *response, size_t size, Clock::time_point now = Clock::now());
+
+    // make the response of query from the cache in out, false if it is not cached (or out is too small)
+    bool lookup(const uint8_t *query, size_t querySize, uint8_t *out, size_t outSize, size_t &responseSize,
+                Clock::time_point now = Clock::now());
+    // same, refresh is set if the response is stale and the caller should ask upstream again
+    bool lookup(const uint8_t *query, size_t querySize, uint8_t *out, size_t outSize, size_t &responseSize,
+                bool &refresh, Clock::time_point now = Clock::now());
+
+    void clear();
+    size_t entryCount() const;
+    size_t memoryUsage() const; // bytes counted against maxBytes
+
+private:
+    struct Key;
+    struct KeyHash;
+    struct Entry;
+    struct Shard;
+
+    std::unique_ptr<Shard[]> mShards;
+    size_t mShardCount;
+    size_t mShardBytes;
+    uint32_t mMaxStale = 0;
+    uint32_t mStaleTtl = 30;
+
+    Shard &shardOf(const Key &key) const;
+};
+
+} // namespace
+#endif /* _DNS_CACHE_H */
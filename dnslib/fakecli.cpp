@@ -4,63 +4,426 @@
  * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
  */
 
+/*
+ * Open-loop DNS load generator.
+ *
+ * Queries are sent at the target rate no matter how fast the server answers (so a slow server can't slow down
+ * the load and hide its latency), many queries are outstanding at the same time and matched by their ID.
+ * Latency is measured from the time a query was scheduled to be sent, recorded in an HDR-style histogram.
+ */
+
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <strings.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <getopt.h>
 
 #include "message.h"
 #include "rr.h"
+#include "view.h"
 
 using namespace std;
 
-#define MAX_MSG 2000
+#define MAX_MSG 65535
+
+struct ClientOptions {
+    sockaddr_in server{};
+    double qps = 10000;
+    double duration = 10; // seconds
+    unsigned int threads = 1;
+    unsigned int sockets = 1; // per thread
+    unsigned int timeoutMs = 1000; // queries without response after this time are lost
+    std::string queryFile;
+};
+
+/**
+ * HDR-style latency histogram: each power of 2 range of values is split into 2^kSubBits linear buckets,
+ * so a recorded value is kept with a relative error below 1/2^kSubBits (< 1%) over the whole range of uint64_t.
+ */
+class LatencyHistogram {
+public:
+    static const int kSubBits = 7;
+    static const uint64_t kSubCount = 1 << kSubBits;
+
+    LatencyHistogram() : mCounts((64 - kSubBits + 1) * kSubCount) {}
+
+    void record(uint64_t value) {
+        mCounts[indexOf(value)]++;
+        mTotal++;
+        if (value > mMax) {
+            mMax = value;
+        }
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < mCounts.size(); i++) {
+            mCounts[i] += other.mCounts[i];
+        }
+        mTotal += other.mTotal;
+        if (other.mMax > mMax) {
+            mMax = other.mMax;
+        }
+    }
+
+    // the highest value (within the histogram precision) below which the given percent of values fall
+    uint64_t percentile(double percent) const {
+        if (mTotal == 0) {
+            return 0;
+        }
+        auto target = (uint64_t) (percent / 100 * mTotal + 0.5);
+        if (target == 0) {
+            target = 1;
+        }
+        uint64_t count = 0;
+        for (size_t i = 0; i < mCounts.size(); i++) {
+            count += mCounts[i];
+            if (count >= target) {
+                auto value = highestValueAt(i);
+                return value < mMax ? value : mMax;
+            }
+        }
+        return mMax;
+    }
 
-int main(int argc, char** argv) {
-    int sockfd;
+    uint64_t total() const { return mTotal; }
+    uint64_t max() const { return mMax; }
 
-    struct sockaddr_in servaddr{};
-    char bufRecv[MAX_MSG];
-    char bufSend[MAX_MSG];
+private:
+    static size_t indexOf(uint64_t value) {
+        if (value < 2 * kSubCount) {
+            return (size_t) value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - kSubBits;
+        return (shift + 1) * kSubCount + ((value >> shift) - kSubCount);
+    }
 
-    if (argc != 2) {
-        cout << "usage: fakecli <IP address>" << endl;
-        return (1);
+    static uint64_t highestValueAt(size_t index) {
+        if (index < 2 * kSubCount) {
+            return index;
+        }
+        int shift = (int) (index / kSubCount) - 1;
+        uint64_t sub = index % kSubCount + kSubCount;
+        return ((sub + 1) << shift) - 1;
     }
 
-    // prepare DNS query message
+    std::vector<uint64_t> mCounts;
+    uint64_t mTotal = 0;
+    uint64_t mMax = 0;
+};
 
-    dns::Message m;
+const uint64_t LatencyHistogram::kSubCount;
 
-    cout << "-------------------------------------------------------" << endl;
-    cout << "Message prepared for sending:" << endl;
-    cout << m.toDebugString() << endl;
-    cout << "-------------------------------------------------------" << endl;
+struct ClientStats {
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> lost{0};
+    std::atomic<uint64_t> errors{0}; // send failures, unexpected or invalid responses
+};
 
-    // add NAPTR query
-    auto qs = dns::QuestionSection("biloxi.ims", dns::RecordType::kNAPTR);
-    m.questions.emplace_back(std::move(qs));
+static uint64_t nowNs() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    bzero(&servaddr, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = inet_addr(argv[1]);
-    servaddr.sin_port = htons(6666);
+void displayUsage() {
+    cout << "Fake DNS client, an open-loop load generator" << endl;
+    cout << "usage: fakecli [-p port] [-q qps] [-d seconds] [-t threads] [-s sockets] [-T ms] [-f file] [-h] ip" << endl;
+    cout << " -p port     server port (default is 6666)" << endl;
+    cout << " -q qps      target queries per second over all threads (default is 10000)" << endl;
+    cout << " -d seconds  duration of the test (default is 10)" << endl;
+    cout << " -t threads  number of sending threads (default is 1)" << endl;
+    cout << " -s sockets  number of sockets per thread (default is 1)" << endl;
+    cout << " -T ms       queries without response after this time are lost (default is 1000)" << endl;
+    cout << " -f file     query mix, one query per line: 'name type [weight]', eg: 'example.com A 10'" << endl;
+    cout << "             (default is 'biloxi.ims NAPTR')" << endl;
+    cout << " -h          show usage" << endl;
+}
 
-    for (auto i = 0; i < 1000000; i++) {
-        m.mId = i;
+static bool parseRecordType(const std::string &text, dns::RecordType &type) {
+    for (uint32_t t = 1; t < 256; t++) {
+        if (dns::toString((dns::RecordType) t) == text) {
+            type = (dns::RecordType) t;
+            return true;
+        }
+    }
+    uint32_t t;
+    if (text.compare(0, 4, "TYPE") == 0 && std::istringstream(text.substr(4)) >> t && t < 65536) {
+        type = (dns::RecordType) t;
+        return true;
+    }
+    return false;
+}
 
-        size_t msgSize;
-        m.encode(bufSend, MAX_MSG, msgSize);
-        //cout << "sending " << msgSize << " bytes" << endl;
-        sendto(sockfd, bufSend, msgSize, 0, (struct sockaddr *) &servaddr, sizeof(servaddr));
+// encode the queries of the mix once, the ID is patched in before sending. Queries with weight N appear N times.
+static bool loadQueries(const std::string &file, std::vector<std::vector<uint8_t>> &queries) {
+    std::vector<std::pair<std::string, dns::RecordType>> mix;
+    std::vector<unsigned int> weights;
+    if (file.empty()) {
+        mix.emplace_back("biloxi.ims", dns::RecordType::kNAPTR);
+        weights.push_back(1);
+    } else {
+        std::ifstream in(file);
+        if (!in) {
+            cout << "Error reading query file '" << file << "'" << endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string name, typeText;
+            unsigned int weight = 1;
+            if (!(fields >> name) || name[0] == '#') {
+                continue;
+            }
+            dns::RecordType type = dns::RecordType::kA;
+            if (fields >> typeText && !parseRecordType(typeText, type)) {
+                cout << "Unknown record type '" << typeText << "' in query file" << endl;
+                return false;
+            }
+            fields >> weight;
+            mix.emplace_back(name, type);
+            weights.push_back(weight);
+        }
+    }
 
-        //int n = recvfrom(sockfd, bufRecv, MAX_MSG, 0, NULL, NULL);
-        recvfrom(sockfd, bufRecv, MAX_MSG, 0, nullptr, nullptr);
+    for (size_t i = 0; i < mix.size(); i++) {
+        dns::Message m;
+        m.mRD = 1;
+        m.questions.emplace_back(mix[i].first, mix[i].second);
+        std::vector<uint8_t> packet;
+        if (m.encode(packet) != dns::BufferResult::NoError) {
+            cout << "Can't encode query for '" << mix[i].first << "'" << endl;
+            return false;
+        }
+        for (unsigned int w = 0; w < weights[i]; w++) {
+            queries.push_back(packet);
+        }
+    }
+    if (queries.empty()) {
+        cout << "No queries in query file" << endl;
+        return false;
+    }
+    return true;
+}
+
+// one sending thread: queries are spread round-robin over the sockets, each socket has its own ID space
+static void runClient(const ClientOptions &options, const std::vector<std::vector<uint8_t>> &queries, size_t threadIndex,
+                      uint64_t startNs, ClientStats &stats, LatencyHistogram &histogram) {
+    struct Socket {
+        int fd;
+        uint16_t nextId;
+        std::vector<uint64_t> pending; // scheduled send time of the outstanding query with the ID, 0 if none
+    };
+    std::vector<Socket> sockets(options.sockets);
+    for (auto &s : sockets) {
+        s.fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (s.fd == -1 || connect(s.fd, (const sockaddr *) &options.server, sizeof(options.server)) == -1) {
+            cout << "Error creating socket (" << strerror(errno) << ")" << endl;
+            return;
+        }
+        fcntl(s.fd, F_SETFL, fcntl(s.fd, F_GETFL) | O_NONBLOCK);
+        s.nextId = (uint16_t) (threadIndex * 7919);
+        s.pending.assign(65536, 0);
+    }
+    std::vector<pollfd> pollFds(sockets.size());
+    for (size_t i = 0; i < sockets.size(); i++) {
+        pollFds[i].fd = sockets[i].fd;
+        pollFds[i].events = POLLIN;
+    }
+
+    double threadQps = options.qps / options.threads;
+    auto intervalNs = (uint64_t) (1e9 / threadQps);
+    auto endNs = startNs + (uint64_t) (options.duration * 1e9);
+    auto timeoutNs = (uint64_t) options.timeoutMs * 1000000;
+    uint64_t sentCount = 0;
+    size_t queryIndex = threadIndex % queries.size();
+    std::vector<uint8_t> packet;
+    std::vector<uint8_t> response(MAX_MSG);
+    dns::MessageView view;
+
+    // after the last query is sent, wait for the outstanding responses until the timeout
+    while (true) {
+        auto now = nowNs();
+        if (now >= endNs + timeoutNs) {
+            break;
+        }
+
+        // send everything which is due, the schedule doesn't depend on the responses
+        uint64_t nextSendNs = startNs + sentCount * intervalNs;
+        while (nextSendNs <= now && nextSendNs < endNs) {
+            auto &s = sockets[sentCount % sockets.size()];
+            auto id = s.nextId++;
+            if (s.pending[id]) {
+                stats.lost.fetch_add(1, std::memory_order_relaxed); // the ID wrapped, the old query is lost
+            }
+            packet = queries[queryIndex];
+            queryIndex = (queryIndex + 1) % queries.size();
+            packet[0] = id >> 8;
+            packet[1] = id & 0xFF;
+            if (send(s.fd, packet.data(), packet.size(), 0) < 0) {
+                stats.errors.fetch_add(1, std::memory_order_relaxed);
+                s.pending[id] = 0;
+            } else {
+                s.pending[id] = nextSendNs;
+                stats.sent.fetch_add(1, std::memory_order_relaxed);
+            }
+            sentCount++;
+            nextSendNs = startNs + sentCount * intervalNs;
+        }
+
+        // receive until the next query is due
+        int waitMs = 0;
+        if (nextSendNs >= endNs) {
+            waitMs = 10;
+        } else if (nextSendNs > now + 1000000) {
+            waitMs = (int) ((nextSendNs - now) / 1000000);
+        }
+        if (poll(pollFds.data(), pollFds.size(), waitMs) <= 0) {
+            continue;
+        }
+        for (size_t i = 0; i < sockets.size(); i++) {
+            if (!(pollFds[i].revents & POLLIN)) {
+                continue;
+            }
+            auto &s = sockets[i];
+            while (true) {
+                auto n = recv(s.fd, response.data(), response.size(), 0);
+                if (n < 0) {
+                    break;
+                }
+                auto received = nowNs();
+                if (view.parseHeader(response.data(), n) != dns::BufferResult::NoError || !view.mQr || !s.pending[view.mId]) {
+                    stats.errors.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                auto latency = received - s.pending[view.mId];
+                s.pending[view.mId] = 0;
+                if (latency > timeoutNs) {
+                    stats.lost.fetch_add(1, std::memory_order_relaxed); // too late
+                    continue;
+                }
+                histogram.record(latency);
+                stats.received.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    for (auto &s : sockets) {
+        for (auto sentAt : s.pending) {
+            if (sentAt) {
+                stats.lost.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        close(s.fd);
+    }
+}
+
+int main(int argc, char **argv) {
+    ClientOptions options;
+    unsigned int port = 6666;
+
+    static const char *optString = "p:q:d:t:s:T:f:h";
+    int opt = getopt(argc, argv, optString);
+    while (opt != -1) {
+        switch (opt) {
+            case 'p':
+                std::istringstream(optarg) >> port;
+                break;
+            case 'q':
+                std::istringstream(optarg) >> options.qps;
+                break;
+            case 'd':
+                std::istringstream(optarg) >> options.duration;
+                break;
+            case 't':
+                std::istringstream(optarg) >> options.threads;
+                break;
+            case 's':
+                std::istringstream(optarg) >> options.sockets;
+                break;
+            case 'T':
+                std::istringstream(optarg) >> options.timeoutMs;
+                break;
+            case 'f':
+                options.queryFile = optarg;
+                break;
+            case 'h':
+            default:
+                displayUsage();
+                return 0;
+        }
+        opt = getopt(argc, argv, optString);
+    }
+    if (optind != argc - 1 || options.qps <= 0 || options.threads == 0 || options.sockets == 0) {
+        displayUsage();
+        return 1;
+    }
+
+    options.server.sin_family = AF_INET;
+    options.server.sin_port = htons(port);
+    if (inet_aton(argv[optind], &options.server.sin_addr) == 0) {
+        cout << "Can't parse '" << argv[optind] << "' as an IP" << endl;
+        return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> queries;
+    if (!loadQueries(options.queryFile, queries)) {
+        return 1;
+    }
+
+    ClientStats stats;
+    std::vector<LatencyHistogram> histograms(options.threads);
+    std::vector<std::thread> threads;
+    auto startNs = nowNs();
+    for (unsigned int t = 0; t < options.threads; t++) {
+        threads.emplace_back(runClient, std::cref(options), std::cref(queries), t, startNs, std::ref(stats), std::ref(histograms[t]));
+    }
+
+    // progress once per second
+    std::atomic<bool> done{false};
+    std::thread progress([&]() {
+        uint64_t lastSent = 0, lastReceived = 0;
+        while (!done) {
+            for (int i = 0; i < 10 && !done; i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            auto sent = stats.sent.load(), received = stats.received.load();
+            cout << "sent: " << sent - lastSent << "/s, received: " << received - lastReceived << "/s" << endl;
+            lastSent = sent;
+            lastReceived = received;
+        }
+    });
+    for (auto &t : threads) {
+        t.join();
+    }
+    done = true;
+    progress.join();
 
-        if (i % 10000 == 0)
-            cout << "iterations: " << i << endl;
+    LatencyHistogram histogram;
+    for (auto &h : histograms) {
+        histogram.merge(h);
     }
+    auto sent = stats.sent.load(), received = stats.received.load(), lost = stats.lost.load();
+    cout << "====" << endl;
+    cout << "target qps: " << options.qps << ", duration: " << options.duration << "s" << endl;
+    cout << "sent: " << sent << ", received: " << received << ", lost: " << lost
+         << " (" << (sent ? 100.0 * lost / sent : 0.0) << "%), errors: " << stats.errors.load() << endl;
+    cout << "throughput: " << (uint64_t) (received / options.duration) << " qps" << endl;
+    cout << "latency us: p50=" << histogram.percentile(50) / 1000.0
+         << " p99=" << histogram.percentile(99) / 1000.0
+         << " p99.9=" << histogram.percentile(99.9) / 1000.0
+         << " max=" << histogram.max() / 1000.0 << endl;
     return 0;
 }
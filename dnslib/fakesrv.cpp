@@ -4,56 +4,979 @@
  * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 #include <strings.h>
 #include <getopt.h>
 
+#ifdef DNSLIB_WITH_URING
+#include <liburing.h>
+#endif
+
+#include "cache.h"
 #include "message.h"
 #include "rr.h"
+#include "stream.h"
+#include "template.h"
+#include "zone.h"
+#include "zonefile.h"
+#include "zoneimage.h"
 
 using namespace std;
 
-#define MAX_MSG 2000
+// maximal UDP payload size
+#define MAX_MSG 65535
+// UDP payload size advertised in the OPT record of responses, the size which avoids IP fragmentation (DNS flag day 2020)
+#define EDNS_PAYLOAD 1232
 
 #define VERSION_MAJOR 1
-#define VERSION_MINOR 1
+#define VERSION_MINOR 10
 
 #define VERBOSITY_NONE "none"
 #define VERBOSITY_BASIC "basic"
 
+enum eVerbosityLevel {
+    verbosityNone = 0, verbosityBasic, verbosityAll
+};
+
+struct ServerOptions {
+    eVerbosityLevel verbosityLevel = verbosityAll;
+    in_addr listenAddress{};
+    unsigned int listenPort = 53;
+    unsigned int workers = 1;
+    unsigned int batchSize = 1; // datagrams per recvmmsg/sendmmsg, 1 means recvfrom/sendto
+    unsigned int batchTimeoutUs = 0; // how long to wait for more datagrams to fill a batch
+    bool useUring = false;
+    bool useMessage = false; // decode and encode every query instead of using the response template
+    bool tcp = false; // listen on TCP too, the queries are answered by 'workers' more threads
+    unsigned int tcpMaxConnections = 1024;
+    unsigned int tcpIdleTimeout = 10; // seconds, 0 means connections are never closed for idleness
+    std::vector<std::string> zoneFiles;
+    dns::ZoneStore *zones = nullptr; // answer from the zones instead of the fake records, if zone files are given
+    std::string imageFile;
+    const dns::ZoneImage *image = nullptr; // answer from the mapped zone image
+    size_t cacheBytes = 0;
+    dns::ResponseCache *cache = nullptr; // responses of the zones and of -m, shared by the workers
+};
+
+// counters of one worker, only written by the worker and read by the main thread for the statistics,
+// padded to a cache line so the workers don't share lines
+struct WorkerStats {
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> errors{0};
+    char padding[64 - 3 * sizeof(std::atomic<uint64_t>)];
+};
+
 void displayUsage() {
     cout << "Fake DNS server" << endl;
-    cout << "usage: fakesrv [-l ip ] [-p port] [-e level] [-h]" << endl;
+    cout << "usage: fakesrv [-l ip ] [-p port] [-e level] [-w workers] [-b batch] [-t usec] [-u] [-m] [-z zonefile]... [-c image] [-i image] [-k bytes] [-T] [-C conns] [-I sec] [-h]" << endl;
     cout << " -l ip      ip address for listening (default is '127.0.0.1')" << endl;
     cout << " -p port    port for listening ((default is '53')" << endl;
     cout << " -e level   output verbosity level - 'all', 'basic', 'none' (default is 'all')" << endl;
+    cout << " -w workers number of worker threads, each one has its own SO_REUSEPORT socket and is pinned to a CPU" << endl;
+    cout << "            (default is 1, 0 means one worker per CPU)" << endl;
+    cout << " -b batch   receive and send up to 'batch' datagrams per syscall with recvmmsg/sendmmsg (default is 1)" << endl;
+    cout << " -t usec    wait up to 'usec' microseconds for more datagrams to fill a batch (default is 0)" << endl;
+    cout << " -u         use the io_uring event loop (only if built with DNSLIB_WITH_URING)" << endl;
+    cout << " -m         decode every query and encode its response, instead of patching a pre-encoded response" << endl;
+    cout << " -z file    answer authoritatively from the zone file (the first record must be its SOA), can be repeated" << endl;
+    cout << " -c image   compile the zone file of -z into a zone image and exit" << endl;
+    cout << " -i image   answer authoritatively from the mapped zone image (made by -c)" << endl;
+    cout << " -k bytes   cache the responses of -z and -m in up to 'bytes' bytes, only misses are decoded" << endl;
+    cout << " -T         listen on TCP too (only on Linux), pipelined queries are answered in parallel by 'workers' threads" << endl;
+    cout << " -C conns   maximal number of TCP connections, more are closed at once (default is 1024)" << endl;
+    cout << " -I sec     close TCP connections idle for 'sec' seconds (default is 10, 0 means never)" << endl;
     cout << " -h         show usage" << endl;
     cout << " -v         get version info" << endl;
 }
 
+static int openSocket(const ServerOptions &options) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd == -1) {
+        cout << "Error creating file descriptor" << endl;
+        return -1;
+    }
+
+    if (options.workers > 1) {
+        // every worker binds its own socket to the same address, the kernel distributes the packets between them
+        int one = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+            cout << "Error setting SO_REUSEPORT (" << strerror(errno) << ")" << endl;
+            close(sockfd);
+            return -1;
+        }
+    }
+
+    // bind socket to local address and port
+    struct sockaddr_in servaddr{};
+    bzero(&servaddr, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr = options.listenAddress;
+    servaddr.sin_port = htons(options.listenPort);
+    if (::bind(sockfd, (struct sockaddr *) &servaddr, sizeof(servaddr)) == -1) {
+        cout << "Error binding socket, addr: " << inet_ntoa(servaddr.sin_addr) << ":" << options.listenPort << ", fd:" << sockfd
+             << " (" << strerror(errno) << ")" << endl;
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static void pinToCpu(std::thread &thread, unsigned int cpu) {
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#else
+    (void) thread;
+    (void) cpu;
+#endif
+}
+
+// add the fake answers for owner to the message
+static void addAnswers(dns::Message &m, const std::string &owner) {
+
+    // add NAPTR answer
+    auto rr = dns::ResourceRecord();
+    rr.mName = owner;
+    rr.mClass = dns::RecordClass::kIN;
+    rr.mTtl = 1;
+    auto rdata = std::make_shared<dns::RDataNAPTR>();
+    rdata->mOrder = 1;
+    rdata->mPreference = 1;
+    rdata->mFlags = "u";
+    rdata->mServices = "SIP+E2U";
+    rdata->mRegExp = "!.*!domena.cz!";
+    rdata->mReplacement = "";
+    rr.setRData(rdata);
+    m.answers.emplace_back(std::move(rr));
+
+    // add A answer
+    auto rrA = dns::ResourceRecord();
+    rrA.mName = owner;
+    rrA.mClass = dns::RecordClass::kIN;
+    rrA.mTtl = 60;
+    auto rdataA = std::make_shared<dns::RDataA>();
+    uint8_t ip4[4] = {'\x01', '\x02', '\x03', '\x04' };
+    rdataA->setAddress(ip4);
+    rrA.setRData(rdataA);
+    m.answers.emplace_back(std::move(rrA));
+}
+
+// turn the query into the fake response
+static void makeResponse(dns::Message &m) {
+    // change type of message to response
+    m.mQr = 1;
+    addAnswers(m, m.questions.empty() ? std::string() : m.questions[0].mName);
+}
+
+// answer an EDNS query with an OPT record (BADVERS for unknown versions, RFC 6891 section 6.1.3),
+// returns how large the UDP response may be
+static size_t applyEdns(dns::Message &query, dns::Message &response) {
+    auto edns = query.getEdns();
+    if (!edns) {
+        return dns::kMaxMsgLen;
+    }
+    size_t limit = std::min<size_t>(edns->udpPayloadSize(), EDNS_PAYLOAD);
+    auto dnssecOk = edns->mFlags & dns::RDataOPT::kFlagDO;
+    bool badVersion = edns->mVersion != 0;
+    auto opt = response.setEdns(EDNS_PAYLOAD);
+    opt->mExtendedRCode = 0;
+    opt->mVersion = 0;
+    opt->mFlags = dnssecOk;
+    opt->mData.clear();
+    if (badVersion) {
+        response.mRCode = 0;
+        opt->mExtendedRCode = 1; // BADVERS (16) is 1 << 4 + 0
+        response.answers.clear();
+        response.authorities.clear();
+        response.additions.erase(std::remove_if(response.additions.begin(), response.additions.end(), [](dns::ResourceRecord &rr) {
+            return rr.getType() != dns::RecordType::kOPT;
+        }), response.additions.end());
+    }
+    return limit;
+}
+
+// the fake response for any question, built once per worker
+static void makeTemplate(dns::ResponseTemplate &tpl) {
+    dns::Message m;
+    addAnswers(m, dns::ResponseTemplate::kQName);
+    tpl.build(m);
+}
+
+// per-worker state, reused for every query
+struct WorkerContext {
+    dns::Message query;
+    dns::Message response;
+    dns::ResponseTemplate tpl;
+    std::unique_ptr<dns::ZoneStore::Reader> zoneReader;
+
+    explicit WorkerContext(const ServerOptions &options) {
+        makeTemplate(tpl);
+        if (options.zones) {
+            zoneReader.reset(new dns::ZoneStore::Reader(*options.zones));
+        }
+    }
+};
+
+static std::shared_ptr<dns::Zone> loadZone(const std::string &path) {
+    std::shared_ptr<dns::Zone> zone;
+    dns::BufferResult addResult = dns::BufferResult::NoError;
+    dns::ZoneFileParser parser;
+    auto result = parser.parseFile(path, [&](dns::ResourceRecord &rr) {
+        if (!zone) {
+            if (rr.getType() != dns::RecordType::SOA) {
+                cout << "Error in zone file " << path << ": the first record must be the SOA" << endl;
+                addResult = dns::BufferResult::InvalidData;
+                return false;
+            }
+            zone = std::make_shared<dns::Zone>(rr.mName, rr.mClass);
+        }
+        addResult = zone->add(std::move(rr));
+        if (addResult != dns::BufferResult::NoError) {
+            cout << "Error in zone file " << path << ": record outside of zone " << zone->origin() << endl;
+            return false;
+        }
+        return true;
+    });
+    if (result != dns::BufferResult::NoError) {
+        cout << "Error in zone file " << path << ":" << parser.errorLine() << ": " << parser.errorMessage() << endl;
+        return nullptr;
+    }
+    if (addResult != dns::BufferResult::NoError) {
+        return nullptr;
+    }
+    if (!zone) {
+        cout << "Error in zone file " << path << ": no records" << endl;
+        return nullptr;
+    }
+    cout << "zone " << (zone->origin().empty() ? "." : zone->origin()) << " loaded from " << path << ", "
+         << zone->recordCount() << " records" << endl;
+    return zone;
+}
+
+static void printMessage(dns::Message &m, const uint8_t *buf, size_t size) {
+    if (m.decode(buf, size) != dns::BufferResult::NoError) {
+        return;
+    }
+    cout << "-------------------------------------------------------" << endl;
+    cout << m.toDebugString() << endl;
+    cout << "-------------------------------------------------------" << endl;
+}
+
+// make the response of the query from the zones, with the template, or by decoding and encoding with -m,
+// responses to queries over TCP (stream) are not limited to the UDP payload size,
+// returns false if there is nothing to send (eg: the packet is a response, QR is set)
+static bool processQuery(WorkerContext &ctx, const char *query, size_t querySize, std::vector<uint8_t> &response,
+                         const ServerOptions &options, WorkerStats &stats, bool stream = false) {
+    auto verbosityLevel = options.verbosityLevel;
+    auto i = stats.received.fetch_add(1, std::memory_order_relaxed);
+    if (verbosityLevel >= verbosityBasic) {
+        cout << "Received DNS packet (" << i << ") of size " << querySize << " bytes" << endl;
+    }
+
+    auto &m = ctx.query;
+    auto &tpl = ctx.tpl;
+    if (options.image) {
+        size_t responseSize;
+        response.resize(stream ? MAX_MSG : dns::kMaxMsgLen);
+        auto result = options.image->answer((const uint8_t *) query, querySize, response.data(), response.size(), responseSize);
+        response.resize(responseSize);
+        if (result != dns::BufferResult::NoError) {
+            stats.errors.fetch_add(1, std::memory_order_relaxed);
+            cout << "DNS exception occurred when parsing incoming data" << endl;
+            return false;
+        }
+        if (verbosityLevel >= verbosityBasic)
+            cout << "Sending DNS packet (" << i << ") of size " << response.size() << " bytes" << endl;
+        if (verbosityLevel >= verbosityAll) {
+            printMessage(m, response.data(), response.size());
+        }
+        return true;
+    }
+    if (options.cache && (ctx.zoneReader || options.useMessage)) {
+        size_t responseSize;
+        response.resize(stream ? MAX_MSG : dns::kMaxMsgLen);
+        if (options.cache->lookup((const uint8_t *) query, querySize, response.data(), response.size(), responseSize)) {
+            response.resize(responseSize);
+            if (verbosityLevel >= verbosityBasic)
+                cout << "Sending cached DNS packet (" << i << ") of size " << response.size() << " bytes" << endl;
+            if (verbosityLevel >= verbosityAll) {
+                printMessage(m, response.data(), response.size());
+            }
+            return true;
+        }
+    }
+    if (ctx.zoneReader) {
+        if (m.decode(query, querySize) != dns::BufferResult::NoError || m.mQr) {
+            stats.errors.fetch_add(1, std::memory_order_relaxed);
+            cout << "DNS exception occurred when parsing incoming data" << endl;
+            return false;
+        }
+        ctx.zoneReader->answer(m, ctx.response);
+        auto limit = applyEdns(m, ctx.response);
+        if (stream) {
+            limit = MAX_MSG;
+        }
+        if (ctx.response.encodeTruncated(response, limit) != dns::BufferResult::NoError) {
+            stats.errors.fetch_add(1, std::memory_order_relaxed);
+            cout << "DNS exception occurred when encoding response" << endl;
+            return false;
+        }
+        if (options.cache) {
+            options.cache->insert(response.data(), response.size());
+        }
+        if (verbosityLevel >= verbosityBasic)
+            cout << "Sending DNS packet (" << i << ") of size " << response.size() << " bytes" << endl;
+        if (verbosityLevel >= verbosityAll) {
+            cout << "-------------------------------------------------------" << endl;
+            cout << ctx.response.toDebugString() << endl;
+            cout << "-------------------------------------------------------" << endl;
+        }
+        return true;
+    }
+
+    if (!options.useMessage) {
+        if (verbosityLevel >= verbosityAll) {
+            printMessage(m, (const uint8_t *) query, querySize);
+        }
+        if (tpl.apply((const uint8_t *) query, querySize, response) != dns::BufferResult::NoError) {
+            stats.errors.fetch_add(1, std::memory_order_relaxed);
+            cout << "DNS exception occurred when parsing incoming data" << endl;
+            return false;
+        }
+        if (verbosityLevel >= verbosityBasic)
+            cout << "Sending DNS packet (" << i << ") of size " << response.size() << " bytes" << endl;
+        if (verbosityLevel >= verbosityAll) {
+            printMessage(m, response.data(), response.size());
+        }
+        return true;
+    }
+
+    if (m.decode(query, querySize) != dns::BufferResult::NoError || m.mQr) {
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+        cout << "DNS exception occurred when parsing incoming data" << endl;
+        return false;
+    }
+
+    if (verbosityLevel >= verbosityAll) {
+        cout << "-------------------------------------------------------" << endl;
+        cout << m.toDebugString() << endl;
+        cout << "-------------------------------------------------------" << endl;
+    }
+
+    makeResponse(m);
+    auto limit = applyEdns(m, m);
+    if (stream) {
+        limit = MAX_MSG;
+    }
+
+    if (m.encodeTruncated(response, limit) != dns::BufferResult::NoError) {
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+        cout << "DNS exception occurred when encoding response" << endl;
+        return false;
+    }
+    if (options.cache) {
+        options.cache->insert(response.data(), response.size());
+    }
+
+    if (verbosityLevel >= verbosityBasic)
+        cout << "Sending DNS packet (" << i << ") of size " << response.size() << " bytes" << endl;
+
+    if (verbosityLevel >= verbosityAll) {
+        cout << "-------------------------------------------------------" << endl;
+        cout << m.toDebugString() << endl;
+        cout << "-------------------------------------------------------" << endl;
+    }
+    return true;
+}
+
+static void runWorker(int sockfd, const ServerOptions &options, WorkerStats &stats) {
+    // the message and the buffers belong to this worker and are reused for every query
+    std::vector<char> mesg(MAX_MSG);
+    std::vector<uint8_t> response;
+    WorkerContext ctx(options);
+
+    struct sockaddr_in cliaddr{};
+    socklen_t len;
+    for (;;) {
+        len = sizeof(cliaddr);
+        auto n = recvfrom(sockfd, mesg.data(), mesg.size(), 0, (struct sockaddr *) &cliaddr, &len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (!processQuery(ctx, mesg.data(), n, response, options, stats)) {
+            continue;
+        }
+        if (sendto(sockfd, response.data(), response.size(), 0, (struct sockaddr *) &cliaddr, sizeof(cliaddr)) >= 0) {
+            stats.sent.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+#ifdef __linux__
+// receive up to batchSize datagrams with one recvmmsg, answer them all, then send the responses with one sendmmsg
+static void runWorkerBatched(int sockfd, const ServerOptions &options, WorkerStats &stats) {
+    size_t batchSize = options.batchSize;
+    std::vector<std::vector<char>> queries(batchSize, std::vector<char>(MAX_MSG));
+    std::vector<std::vector<uint8_t>> responses(batchSize);
+    std::vector<sockaddr_in> addrs(batchSize);
+    std::vector<iovec> recvIov(batchSize), sendIov(batchSize);
+    std::vector<mmsghdr> recvMsgs(batchSize), sendMsgs(batchSize);
+    for (size_t k = 0; k < batchSize; k++) {
+        recvIov[k].iov_base = queries[k].data();
+        recvIov[k].iov_len = queries[k].size();
+    }
+    WorkerContext ctx(options);
+
+    for (;;) {
+        // block until the first datagram arrives, then take what is queued (and wait for more up to the timeout)
+        size_t received = 0;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(options.batchTimeoutUs);
+        while (received < batchSize) {
+            for (size_t k = received; k < batchSize; k++) {
+                memset(&recvMsgs[k].msg_hdr, 0, sizeof(recvMsgs[k].msg_hdr));
+                recvMsgs[k].msg_hdr.msg_name = &addrs[k];
+                recvMsgs[k].msg_hdr.msg_namelen = sizeof(addrs[k]);
+                recvMsgs[k].msg_hdr.msg_iov = &recvIov[k];
+                recvMsgs[k].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(sockfd, &recvMsgs[received], batchSize - received, received ? MSG_DONTWAIT : MSG_WAITFORONE, nullptr);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                    n = 0;
+                } else if (received == 0) {
+                    return;
+                } else {
+                    break;
+                }
+            }
+            received += n;
+            if (received == batchSize || options.batchTimeoutUs == 0) {
+                break;
+            }
+            auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (remain < 0) {
+                break;
+            }
+            pollfd pfd{sockfd, POLLIN, 0};
+            if (poll(&pfd, 1, (int) remain) <= 0) {
+                break;
+            }
+        }
+
+        size_t toSend = 0;
+        for (size_t k = 0; k < received; k++) {
+            if (!processQuery(ctx, queries[k].data(), recvMsgs[k].msg_len, responses[k], options, stats)) {
+                continue;
+            }
+            sendIov[toSend].iov_base = responses[k].data();
+            sendIov[toSend].iov_len = responses[k].size();
+            memset(&sendMsgs[toSend].msg_hdr, 0, sizeof(sendMsgs[toSend].msg_hdr));
+            sendMsgs[toSend].msg_hdr.msg_name = &addrs[k];
+            sendMsgs[toSend].msg_hdr.msg_namelen = recvMsgs[k].msg_hdr.msg_namelen;
+            sendMsgs[toSend].msg_hdr.msg_iov = &sendIov[toSend];
+            sendMsgs[toSend].msg_hdr.msg_iovlen = 1;
+            toSend++;
+        }
+
+        size_t sent = 0;
+        while (sent < toSend) {
+            int n = sendmmsg(sockfd, &sendMsgs[sent], toSend - sent, 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                sent++; // skip the datagram which can't be sent
+                continue;
+            }
+            sent += n;
+            stats.sent.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+}
+#endif
+
+#ifdef DNSLIB_WITH_URING
+// io_uring event loop: one multishot recvmsg keeps receiving into a ring of provided buffers registered with the kernel,
+// responses are queued as sendmsg SQEs, and everything queued while handling a round of completions is submitted
+// with one io_uring_submit_and_wait, so there is no syscall per packet under load
+static void runWorkerUring(int sockfd, const ServerOptions &options, WorkerStats &stats) {
+    const unsigned kEntries = 256; // receive buffers and send slots, a power of 2
+    const unsigned kBufSize = 4096; // larger queries are dropped
+    const int kBufGroup = 0;
+    const uint64_t kRecvTag = UINT64_MAX; // user data of the receive, send SQEs carry their slot index
+
+    struct io_uring ring;
+    int ret = io_uring_queue_init(kEntries * 2, &ring, 0);
+    if (ret < 0) {
+        cout << "Error creating io_uring (" << strerror(-ret) << ")" << endl;
+        return;
+    }
+    std::vector<uint8_t> bufs(kEntries * kBufSize);
+    auto bufRing = io_uring_setup_buf_ring(&ring, kEntries, kBufGroup, 0, &ret);
+    if (!bufRing) {
+        cout << "Error registering io_uring buffers (" << strerror(-ret) << ")" << endl;
+        io_uring_queue_exit(&ring);
+        return;
+    }
+    auto bufMask = io_uring_buf_ring_mask(kEntries);
+    for (unsigned i = 0; i < kEntries; i++) {
+        io_uring_buf_ring_add(bufRing, bufs.data() + i * kBufSize, kBufSize, i, bufMask, i);
+    }
+    io_uring_buf_ring_advance(bufRing, kEntries);
+
+    // the layout of the received buffers (sender address + payload) is described by this header
+    struct msghdr recvMsg{};
+    recvMsg.msg_namelen = sizeof(sockaddr_in);
+    auto getSqe = [&ring]() {
+        auto sqe = io_uring_get_sqe(&ring);
+        if (!sqe) {
+            io_uring_submit(&ring); // the submission queue is full, flush it
+            sqe = io_uring_get_sqe(&ring);
+        }
+        return sqe;
+    };
+    auto armRecv = [&]() {
+        auto sqe = getSqe();
+        io_uring_prep_recvmsg_multishot(sqe, sockfd, &recvMsg, 0);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufGroup;
+        io_uring_sqe_set_data64(sqe, kRecvTag);
+    };
+
+    struct SendSlot {
+        sockaddr_in addr;
+        iovec iov;
+        msghdr msg;
+        std::vector<uint8_t> response;
+    };
+    std::vector<SendSlot> slots(kEntries);
+    std::vector<unsigned> freeSlots;
+    for (unsigned i = 0; i < kEntries; i++) {
+        freeSlots.push_back(i);
+    }
+    WorkerContext ctx(options);
+
+    armRecv();
+    for (;;) {
+        ret = io_uring_submit_and_wait(&ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            cout << "Error waiting for io_uring (" << strerror(-ret) << ")" << endl;
+            break;
+        }
+
+        unsigned head, count = 0;
+        bool rearm = false;
+        struct io_uring_cqe *cqe;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            count++;
+            auto tag = io_uring_cqe_get_data64(cqe);
+            if (tag != kRecvTag) {
+                freeSlots.push_back((unsigned) tag);
+                if (cqe->res >= 0) {
+                    stats.sent.fetch_add(1, std::memory_order_relaxed);
+                }
+                continue;
+            }
+
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                rearm = true; // the multishot receive stopped (eg: no free buffer), start it again
+            }
+            if (cqe->res < 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+                continue;
+            }
+            unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            auto buf = bufs.data() + bid * kBufSize;
+            auto out = io_uring_recvmsg_validate(buf, cqe->res, &recvMsg);
+            if (out && !(out->flags & MSG_TRUNC) && out->namelen <= sizeof(sockaddr_in)) {
+                if (freeSlots.empty()) {
+                    stats.errors.fetch_add(1, std::memory_order_relaxed); // all send slots are in flight, drop the query
+                } else {
+                    auto slotIndex = freeSlots.back();
+                    auto &slot = slots[slotIndex];
+                    auto query = (const char *) io_uring_recvmsg_payload(out, &recvMsg);
+                    auto querySize = io_uring_recvmsg_payload_length(out, cqe->res, &recvMsg);
+                    if (processQuery(ctx, query, querySize, slot.response, options, stats)) {
+                        freeSlots.pop_back();
+                        memcpy(&slot.addr, io_uring_recvmsg_name(out), out->namelen);
+                        slot.iov.iov_base = slot.response.data();
+                        slot.iov.iov_len = slot.response.size();
+                        memset(&slot.msg, 0, sizeof(slot.msg));
+                        slot.msg.msg_name = &slot.addr;
+                        slot.msg.msg_namelen = out->namelen;
+                        slot.msg.msg_iov = &slot.iov;
+                        slot.msg.msg_iovlen = 1;
+                        auto sqe = getSqe();
+                        io_uring_prep_sendmsg(sqe, sockfd, &slot.msg, 0);
+                        io_uring_sqe_set_data64(sqe, slotIndex);
+                    }
+                }
+            }
+            // give the buffer back to the kernel
+            io_uring_buf_ring_add(bufRing, buf, kBufSize, bid, bufMask, 0);
+            io_uring_buf_ring_advance(bufRing, 1);
+        }
+        io_uring_cq_advance(&ring, count);
+        if (rearm) {
+            armRecv();
+        }
+    }
+
+    io_uring_free_buf_ring(&ring, bufRing, kEntries, kBufGroup);
+    io_uring_queue_exit(&ring);
+}
+#endif
+
+#ifdef __linux__
+// DNS over TCP (RFC 7766): one event loop thread accepts the connections, reads the length-prefixed queries (framed by
+// dns::StreamFramer) and writes the responses, the queries are answered by a pool of TCP workers. Pipelined queries of a connection are answered in
+// parallel and every response is written as soon as it is done, so they may be out of order (clients match the IDs).
+
+// reading from a connection stops while it has this many queries being answered or this many bytes not sent
+#define TCP_MAX_PENDING 64
+#define TCP_MAX_OUTPUT (256 * 1024)
+
+struct TcpJob {
+    uint64_t connection;
+    std::vector<char> query;
+    std::vector<uint8_t> response; // empty if there is nothing to send
+};
+
+// shared by the event loop and the TCP workers
+struct TcpServer {
+    int listenFd = -1;
+    int wakeFd = -1; // eventfd, signalled by the workers when done was empty
+    std::mutex jobsMutex;
+    std::condition_variable jobsQueued;
+    std::deque<TcpJob> jobs;
+    std::mutex doneMutex;
+    std::vector<TcpJob> done;
+};
+
+struct TcpConnection {
+    int fd = -1;
+    dns::StreamFramer framer; // keeps the received part of a query which is not complete yet
+    std::vector<uint8_t> output; // length-prefixed responses, sent up to outputPos
+    size_t outputPos = 0;
+    size_t pending = 0; // queries being answered by the workers
+    uint32_t events = 0; // registered with epoll
+    bool eof = false;
+    std::chrono::steady_clock::time_point lastActive;
+};
+
+static int openTcpSocket(const ServerOptions &options) {
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd == -1) {
+        cout << "Error creating TCP socket (" << strerror(errno) << ")" << endl;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in servaddr{};
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr = options.listenAddress;
+    servaddr.sin_port = htons(options.listenPort);
+    if (::bind(sockfd, (struct sockaddr *) &servaddr, sizeof(servaddr)) == -1 || listen(sockfd, SOMAXCONN) == -1) {
+        cout << "Error listening on TCP, addr: " << inet_ntoa(servaddr.sin_addr) << ":" << options.listenPort
+             << " (" << strerror(errno) << ")" << endl;
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static void runTcpWorker(TcpServer &server, const ServerOptions &options, WorkerStats &stats) {
+    WorkerContext ctx(options);
+    for (;;) {
+        TcpJob job;
+        {
+            std::unique_lock<std::mutex> lock(server.jobsMutex);
+            server.jobsQueued.wait(lock, [&server]() { return !server.jobs.empty(); });
+            job = std::move(server.jobs.front());
+            server.jobs.pop_front();
+        }
+        // the event loop is told about every query, also the ones without response, to count the pending queries
+        if (!processQuery(ctx, job.query.data(), job.query.size(), job.response, options, stats, true)) {
+            job.response.clear();
+        }
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(server.doneMutex);
+            wake = server.done.empty();
+            server.done.push_back(std::move(job));
+        }
+        if (wake) {
+            uint64_t one = 1;
+            if (write(server.wakeFd, &one, sizeof(one)) < 0) {
+                stats.errors.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+static void runTcpLoop(TcpServer &server, const ServerOptions &options, WorkerStats &stats) {
+    const uint64_t kListenTag = 0, kWakeTag = 1; // epoll data, connections have ids from 2
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        cout << "Error creating epoll (" << strerror(errno) << ")" << endl;
+        return;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = kListenTag;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, server.listenFd, &ev);
+    ev.data.u64 = kWakeTag;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, server.wakeFd, &ev);
+
+    std::unordered_map<uint64_t, TcpConnection> connections;
+    uint64_t nextId = 2;
+    std::vector<uint8_t> input(MAX_MSG + 2);
+    std::vector<epoll_event> events(256);
+    std::vector<TcpJob> jobs, done;
+    std::vector<uint64_t> touched; // connections to flush and update after a round of events
+    auto idleTimeout = std::chrono::seconds(options.tcpIdleTimeout);
+    auto lastSweep = std::chrono::steady_clock::now();
+
+    auto closeConnection = [&](std::unordered_map<uint64_t, TcpConnection>::iterator it) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        close(it->second.fd);
+        connections.erase(it);
+    };
+    // send what the socket takes, then wait for input unless the connection has too much work queued,
+    // and for output while some is left. The connection is closed on errors and after the client's EOF
+    auto flush = [&](uint64_t id) {
+        auto it = connections.find(id);
+        if (it == connections.end()) {
+            return;
+        }
+        auto &c = it->second;
+        while (c.outputPos < c.output.size()) {
+            auto n = send(c.fd, c.output.data() + c.outputPos, c.output.size() - c.outputPos, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                closeConnection(it);
+                return;
+            }
+            c.outputPos += n;
+            c.lastActive = std::chrono::steady_clock::now();
+        }
+        if (c.outputPos == c.output.size()) {
+            c.output.clear();
+            c.outputPos = 0;
+        }
+        auto backlog = c.output.size() - c.outputPos;
+        if (c.eof && !c.pending && !backlog) {
+            closeConnection(it);
+            return;
+        }
+        uint32_t wanted = (c.eof || c.pending >= TCP_MAX_PENDING || backlog >= TCP_MAX_OUTPUT ? 0 : (uint32_t) EPOLLIN) |
+                          (backlog ? (uint32_t) EPOLLOUT : 0);
+        if (wanted != c.events) {
+            epoll_event cev{};
+            cev.events = wanted;
+            cev.data.u64 = id;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &cev);
+            c.events = wanted;
+        }
+    };
+    auto accept = [&]() {
+        for (;;) {
+            int fd = accept4(server.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd == -1) {
+                return;
+            }
+            if (connections.size() >= options.tcpMaxConnections) {
+                close(fd);
+                continue;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            auto id = nextId++;
+            auto &c = connections[id];
+            c.fd = fd;
+            c.events = EPOLLIN;
+            c.lastActive = std::chrono::steady_clock::now();
+            epoll_event cev{};
+            cev.events = c.events;
+            cev.data.u64 = id;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &cev);
+        }
+    };
+    // read what is there and queue the complete queries
+    auto receive = [&](uint64_t id, TcpConnection &c) {
+        auto n = read(c.fd, input.data(), input.size());
+        if (n < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                c.eof = true;
+            }
+            return;
+        }
+        if (n == 0) {
+            c.eof = true;
+            return;
+        }
+        c.lastActive = std::chrono::steady_clock::now();
+        c.framer.feed(input.data(), n);
+        const uint8_t *query;
+        size_t querySize;
+        while (c.framer.next(query, querySize)) {
+            TcpJob job;
+            job.connection = id;
+            job.query.assign(query, query + querySize);
+            jobs.emplace_back(std::move(job));
+            c.pending++;
+        }
+    };
+
+    for (;;) {
+        int n = epoll_wait(epfd, events.data(), events.size(), 1000);
+        if (n < 0 && errno != EINTR) {
+            cout << "Error waiting for epoll (" << strerror(errno) << ")" << endl;
+            break;
+        }
+        for (int k = 0; k < n; k++) {
+            auto tag = events[k].data.u64;
+            if (tag == kListenTag) {
+                accept();
+                continue;
+            }
+            if (tag == kWakeTag) {
+                uint64_t count;
+                auto r = read(server.wakeFd, &count, sizeof(count)); // EAGAIN if nothing was signalled
+                (void) r;
+                {
+                    std::lock_guard<std::mutex> lock(server.doneMutex);
+                    done.swap(server.done);
+                }
+                for (auto &job : done) {
+                    auto it = connections.find(job.connection);
+                    if (it == connections.end()) {
+                        continue; // the connection has been closed meanwhile
+                    }
+                    auto &c = it->second;
+                    c.pending--;
+                    if (!job.response.empty() &&
+                        dns::StreamFramer::append(job.response.data(), job.response.size(), c.output) == dns::BufferResult::NoError) {
+                        stats.sent.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    touched.push_back(job.connection);
+                }
+                done.clear();
+                continue;
+            }
+            auto it = connections.find(tag);
+            if (it == connections.end()) {
+                continue;
+            }
+            auto &c = it->second;
+            if (events[k].events & (EPOLLERR | EPOLLHUP)) {
+                closeConnection(it);
+                continue;
+            }
+            if (events[k].events & EPOLLIN) {
+                receive(tag, c);
+            }
+            touched.push_back(tag);
+        }
+
+        if (!jobs.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(server.jobsMutex);
+                for (auto &job : jobs) {
+                    server.jobs.emplace_back(std::move(job));
+                }
+            }
+            if (jobs.size() == 1) {
+                server.jobsQueued.notify_one();
+            } else {
+                server.jobsQueued.notify_all();
+            }
+            jobs.clear();
+        }
+        for (auto id : touched) {
+            flush(id);
+        }
+        touched.clear();
+
+        auto now = std::chrono::steady_clock::now();
+        if (options.tcpIdleTimeout && now - lastSweep >= std::chrono::seconds(1)) {
+            lastSweep = now;
+            for (auto it = connections.begin(); it != connections.end();) {
+                auto next = std::next(it);
+                if (!it->second.pending && now - it->second.lastActive >= idleTimeout) {
+                    closeConnection(it);
+                }
+                it = next;
+            }
+        }
+    }
+    close(epfd);
+}
+#endif
+
+static void startWorker(int sockfd, const ServerOptions &options, WorkerStats &stats) {
+#ifdef DNSLIB_WITH_URING
+    if (options.useUring) {
+        runWorkerUring(sockfd, options, stats);
+        return;
+    }
+#endif
+#ifdef __linux__
+    if (options.batchSize > 1) {
+        runWorkerBatched(sockfd, options, stats);
+        return;
+    }
+#endif
+    runWorker(sockfd, options, stats);
+}
+
 int main(int argc, char **argv) {
-    enum eVerbosityLevel {
-        verbosityNone = 0, verbosityBasic, verbosityAll
-    } verbosityLevel = verbosityAll;
+    ServerOptions options;
 
     // ip address for listening
     std::string listenIp = "127.0.0.1";
-
-    // port for listening
-    unsigned int listenPort = 53;
-
-    // message buffer
-    char mesg[MAX_MSG];
+    std::string compileFile;
 
     // parse cli arguments
-    static const char *optString = "l:p:e:hv";
+    static const char *optString = "l:p:e:w:b:t:umz:c:i:k:TC:I:hv";
     int opt = getopt(argc, argv, optString);
     while (opt != -1) {
         switch (opt) {
@@ -62,17 +985,66 @@ int main(int argc, char **argv) {
                 break;
             case 'e':
                 if (strcmp(optarg, VERBOSITY_NONE) == 0) {
-                    verbosityLevel = verbosityNone;
+                    options.verbosityLevel = verbosityNone;
                 } else if (strcmp(optarg, VERBOSITY_BASIC) == 0) {
-                    verbosityLevel = verbosityBasic;
+                    options.verbosityLevel = verbosityBasic;
                 } else
-                    verbosityLevel = verbosityAll;
+                    options.verbosityLevel = verbosityAll;
                 break;
             case 'p': {
                 // convert string value to int
-                std::istringstream(optarg) >> listenPort;
+                std::istringstream(optarg) >> options.listenPort;
                 break;
             }
+            case 'w':
+                std::istringstream(optarg) >> options.workers;
+                if (options.workers == 0) {
+                    options.workers = std::thread::hardware_concurrency();
+                }
+                break;
+            case 'b':
+                std::istringstream(optarg) >> options.batchSize;
+                break;
+            case 't':
+                std::istringstream(optarg) >> options.batchTimeoutUs;
+                break;
+            case 'u':
+#ifdef DNSLIB_WITH_URING
+                options.useUring = true;
+                break;
+#else
+                cout << "fakesrv is built without io_uring support (cmake -DDNSLIB_WITH_URING=ON)" << endl;
+                return 1;
+#endif
+            case 'm':
+                options.useMessage = true;
+                break;
+            case 'z':
+                options.zoneFiles.emplace_back(optarg);
+                break;
+            case 'c':
+                compileFile = optarg;
+                break;
+            case 'i':
+                options.imageFile = optarg;
+                break;
+            case 'k':
+                std::istringstream(optarg) >> options.cacheBytes;
+                break;
+            case 'T':
+#ifdef __linux__
+                options.tcp = true;
+                break;
+#else
+                cout << "fakesrv supports TCP only on Linux" << endl;
+                return 1;
+#endif
+            case 'C':
+                std::istringstream(optarg) >> options.tcpMaxConnections;
+                break;
+            case 'I':
+                std::istringstream(optarg) >> options.tcpIdleTimeout;
+                break;
             case 'v':
                 cout << "fakesrv version " << VERSION_MAJOR << "." << VERSION_MINOR << endl;
                 return 0;
@@ -83,107 +1055,133 @@ int main(int argc, char **argv) {
         }
         opt = getopt(argc, argv, optString);
     }
+    if (options.workers == 0) {
+        options.workers = 1;
+    }
+    if (options.batchSize == 0) {
+        options.batchSize = 1;
+    }
 
-    in_addr listenAddress = {0};
-    if (inet_aton(listenIp.c_str(), &listenAddress) == 0) {
+    if (inet_aton(listenIp.c_str(), &options.listenAddress) == 0) {
         cout << "Warning: Can't parse '" << listenIp << "' as an IP, will listen on '0.0.0.0' instead" << endl;
-        listenAddress.s_addr = htonl(INADDR_ANY);
+        options.listenAddress.s_addr = htonl(INADDR_ANY);
     }
 
-    // create socket descriptor
-    int sockfd;
-    struct sockaddr_in servaddr{}, cliaddr{};
-    socklen_t len;
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd == -1) {
-        cout << "Error creating file descriptor" << endl;
-        return 1;
+    if (!compileFile.empty()) {
+        if (options.zoneFiles.size() != 1) {
+            cout << "-c needs exactly one zone file (-z)" << endl;
+            return 1;
+        }
+        auto zone = loadZone(options.zoneFiles[0]);
+        if (!zone) {
+            return 1;
+        }
+        auto result = dns::ZoneImage::compileFile(*zone, compileFile);
+        if (result == dns::BufferResult::FileError) {
+            cout << "Error writing zone image " << compileFile << " (" << strerror(errno) << ")" << endl;
+            return 1;
+        }
+        if (result != dns::BufferResult::NoError) {
+            cout << "Error compiling zone image " << compileFile << ", the zone is too large" << endl;
+            return 1;
+        }
+        cout << "zone image " << compileFile << " written" << endl;
+        return 0;
     }
-    if (verbosityLevel >= verbosityBasic)
-        cout << "socket created (" << sockfd << ")" << endl;
 
-    // bind socket to local address and port
-    bzero(&servaddr, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr = listenAddress;
-    servaddr.sin_port = htons(listenPort);
-    if (::bind(sockfd, (struct sockaddr *) &servaddr, sizeof(servaddr)) == -1) {
-        cout << "Error binding socket, addr: " << inet_ntoa(servaddr.sin_addr) << ":" << listenPort << ", fd:" << sockfd
-             << " (" << strerror(errno) << ")" << endl;
-        return 1;
+    dns::ZoneStore zones;
+    for (auto &path : options.zoneFiles) {
+        auto zone = loadZone(path);
+        if (!zone) {
+            return 1;
+        }
+        zones.update(zone);
+    }
+    if (!options.zoneFiles.empty()) {
+        options.zones = &zones;
+    }
+    dns::ZoneImage image;
+    if (!options.imageFile.empty()) {
+        if (image.open(options.imageFile) != dns::BufferResult::NoError) {
+            cout << "Error mapping zone image " << options.imageFile << endl;
+            return 1;
+        }
+        cout << "zone " << (image.origin().empty() ? "." : image.origin()) << " mapped from " << options.imageFile
+             << ", " << image.recordCount() << " records" << endl;
+        options.image = &image;
+    }
+    std::unique_ptr<dns::ResponseCache> cache;
+    if (options.cacheBytes) {
+        cache.reset(new dns::ResponseCache(options.cacheBytes));
+        options.cache = cache.get();
     }
-    if (verbosityLevel >= verbosityBasic)
-        cout << "socket listens on port " << listenPort << endl;
 
-    unsigned int i = 0;
-    for (;;) {
-        len = sizeof(cliaddr);
-        auto n = recvfrom(sockfd, mesg, MAX_MSG, 0, (struct sockaddr *) &cliaddr, &len);
-        if (n < 0) {
-            break;
+    // create all sockets and fds before starting any thread, so an error stops the server at once
+    std::vector<int> sockets;
+    for (unsigned int w = 0; w < options.workers; w++) {
+        int sockfd = openSocket(options);
+        if (sockfd == -1) {
+            return 1;
         }
-        if (verbosityLevel >= verbosityBasic) {
-            cout << "Received DNS packet (" << i << ") of size " << n << " bytes" << endl;
+        if (options.verbosityLevel >= verbosityBasic)
+            cout << "socket created (" << sockfd << ")" << endl;
+        sockets.push_back(sockfd);
+    }
+    if (options.verbosityLevel >= verbosityBasic)
+        cout << "socket listens on port " << options.listenPort << " with " << options.workers << " worker(s)" << endl;
+#ifdef __linux__
+    std::unique_ptr<TcpServer> tcpServer;
+    if (options.tcp) {
+        tcpServer.reset(new TcpServer());
+        tcpServer->listenFd = openTcpSocket(options);
+        if (tcpServer->listenFd == -1) {
+            return 1;
         }
-        dns::Message m;
-        if (m.decode(mesg, n) != dns::BufferResult::NoError) {
-            cout << "DNS exception occurred when parsing incoming data" << endl;
-            continue;
+        tcpServer->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (tcpServer->wakeFd == -1) {
+            cout << "Error creating eventfd (" << strerror(errno) << ")" << endl;
+            return 1;
         }
+    }
+#endif
 
-        if (verbosityLevel >= verbosityAll) {
-            cout << "-------------------------------------------------------" << endl;
-            cout << m.toDebugString() << endl;
-            cout << "-------------------------------------------------------" << endl;
+    // the UDP workers, then the TCP workers and the TCP event loop
+    unsigned int statsCount = options.tcp ? options.workers * 2 + 1 : options.workers;
+    std::unique_ptr<WorkerStats[]> stats(new WorkerStats[statsCount]);
+    std::vector<std::thread> threads;
+    auto cpuCount = std::thread::hardware_concurrency();
+    for (unsigned int w = 0; w < options.workers; w++) {
+        threads.emplace_back(startWorker, sockets[w], std::cref(options), std::ref(stats[w]));
+        if (options.workers > 1 && cpuCount) {
+            pinToCpu(threads.back(), w % cpuCount);
         }
-
-        // change type of message to response
-        m.mQr = 1;
-
-        // add NAPTR answer
-        auto rr = dns::ResourceRecord();
-        rr.mClass = dns::RecordClass::kIN;
-        rr.mTtl = 1;
-        auto rdata = std::make_shared<dns::RDataNAPTR>();
-        rdata->mOrder = 1;
-        rdata->mPreference = 1;
-        rdata->mFlags = "u";
-        rdata->mServices = "SIP+E2U";
-        rdata->mRegExp = "!.*!domena.cz!";
-        rdata->mReplacement = "";
-        rr.setRData(rdata);
-        m.answers.emplace_back(std::move(rr));
-
-        // add A answer
-        auto rrA = dns::ResourceRecord();
-        rrA.mClass = dns::RecordClass::kIN;
-        rrA.mTtl = 60;
-        auto rdataA = std::make_shared<dns::RDataA>();
-        uint8_t ip4[4] = {'\x01', '\x02', '\x03', '\x04' };
-        rdataA->setAddress(ip4);
-        rrA.setRData(rdataA);
-        m.answers.emplace_back(std::move(rrA));
-
-
-        size_t mesgSize;
-        m.encode(mesg, MAX_MSG, mesgSize);
-
-        if (verbosityLevel >= verbosityBasic)
-            cout << "Sending DNS packet (" << i << ") of size " << mesgSize << " bytes" << endl;
-
-        if (verbosityLevel >= verbosityAll) {
-            cout << "-------------------------------------------------------" << endl;
-            cout << m.toDebugString() << endl;
-            cout << "-------------------------------------------------------" << endl;
+    }
+#ifdef __linux__
+    if (options.tcp) {
+        for (unsigned int w = 0; w < options.workers; w++) {
+            threads.emplace_back(runTcpWorker, std::ref(*tcpServer), std::cref(options), std::ref(stats[options.workers + w]));
         }
+        threads.emplace_back(runTcpLoop, std::ref(*tcpServer), std::cref(options), std::ref(stats[options.workers * 2]));
+        if (options.verbosityLevel >= verbosityBasic)
+            cout << "TCP listens on port " << options.listenPort << ", at most " << options.tcpMaxConnections
+                 << " connections" << endl;
+    }
+#endif
 
-        sendto(sockfd, mesg, mesgSize, 0, (struct sockaddr *) &cliaddr, sizeof(cliaddr));
-
-        if (verbosityLevel >= verbosityNone) {
-            if (i % 10000 == 0)
-                cout << "iterations: " << i << endl;
+    // aggregate the counters of all workers once per second
+    uint64_t lastReceived = 0;
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t received = 0, sent = 0, errors = 0;
+        for (unsigned int w = 0; w < statsCount; w++) {
+            received += stats[w].received.load(std::memory_order_relaxed);
+            sent += stats[w].sent.load(std::memory_order_relaxed);
+            errors += stats[w].errors.load(std::memory_order_relaxed);
+        }
+        if (received != lastReceived) {
+            cout << "received: " << received << ", sent: " << sent << ", errors: " << errors
+                 << ", qps: " << received - lastReceived << endl;
+            lastReceived = received;
         }
-        i++;
     }
-    return 0;
 }
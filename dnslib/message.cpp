@@ -6,6 +6,8 @@
 
 #include <iostream>
 #include <sstream>
+#include <cctype>
+#include <typeinfo>
 
 #ifdef _WIN32
 #include <Winsock2.h>
@@ -19,14 +21,35 @@
 
 using namespace dns;
 
-static void decodeResourceRecords(Buffer &buffer, size_t count, std::vector<ResourceRecord> &list) {
+static void decodeResourceRecords(Buffer &buffer, size_t count, std::vector<ResourceRecord> &list, std::vector<ResourceRecord> &spare, Arena *arena) {
+    // existing records are kept and decoded in place, so their strings and RData are reused,
+    // records which are not needed now are moved to the spare list for later decoding
+    while (list.size() > count) {
+        spare.emplace_back(std::move(list.back()));
+        list.pop_back();
+    }
+    while (list.size() < count && !spare.empty()) {
+        list.emplace_back(std::move(spare.back()));
+        spare.pop_back();
+    }
     list.resize(count);
     for (auto &rr : list) {
-        rr.decode(buffer);
+        if (buffer.isBroken()) {
+            break;
+        }
+        rr.decode(buffer, arena);
     }
 }
 
 BufferResult Message::decode(const uint8_t *buf, size_t size) {
+    return decode(buf, size, nullptr);
+}
+
+BufferResult Message::decode(const uint8_t *buf, size_t size, Arena &arena) {
+    return decode(buf, size, &arena);
+}
+
+BufferResult Message::decode(const uint8_t *buf, size_t size, Arena *arena) {
     // we do not check (size > MAX_MSG_LEN) at the moment
 
     Buffer buff((uint8_t *) buf, size);
@@ -47,23 +70,35 @@ BufferResult Message::decode(const uint8_t *buf, size_t size) {
     size_t anCount = buff.readUint16();
     size_t nsCount = buff.readUint16();
     size_t arCount = buff.readUint16();
+    if (buff.isBroken()) {
+        return buff.result();
+    }
 
-    // 3. read Question Sections
-    for (size_t i = 0; i < qdCount; i++) {
-        std::string qName = buff.readDomainName();
-        auto qType = (RecordType) buff.readUint16();
-        auto qClass = (RecordClass) buff.readUint16();
+    // 3. check the counts before allocating anything
+    size_t rrCount = anCount + nsCount + arCount;
+    if (qdCount > decodeLimits.mMaxQuestions || rrCount > decodeLimits.mMaxRecords ||
+        anCount > decodeLimits.mMaxRecordsPerSection || nsCount > decodeLimits.mMaxRecordsPerSection ||
+        arCount > decodeLimits.mMaxRecordsPerSection) {
+        return BufferResult::LimitExceeded;
+    }
+    if (qdCount * 5 + rrCount * 11 > buff.size() - buff.pos()) {
+        return BufferResult::BufferOverflow;
+    }
 
-        auto qs = QuestionSection(qName, qType, qClass);
-        questions.emplace_back(std::move(qs));
+    // 4. read Question Sections
+    questions.resize(qdCount);
+    for (auto &qs : questions) {
+        buff.readDomainName(qs.mName);
+        qs.mType = (RecordType) buff.readUint16();
+        qs.mClass = (RecordClass) buff.readUint16();
     }
 
-    // 4. read response records
-    decodeResourceRecords(buff, anCount, answers);
-    decodeResourceRecords(buff, nsCount, authorities);
-    decodeResourceRecords(buff, arCount, additions);
+    // 5. read response records
+    decodeResourceRecords(buff, anCount, answers, spareRecords[0], arena);
+    decodeResourceRecords(buff, nsCount, authorities, spareRecords[1], arena);
+    decodeResourceRecords(buff, arCount, additions, spareRecords[2], arena);
 
-    // 5. check that buffer is consumed
+    // 6. check that buffer is consumed
     auto result = buff.result();
     if (result != BufferResult::NoError) {
         return result;
@@ -74,11 +109,7 @@ BufferResult Message::decode(const uint8_t *buf, size_t size) {
     return BufferResult::NoError;
 }
 
-BufferResult Message::encode(uint8_t *buf, size_t bufSize, size_t &encodedSize) {
-    encodedSize = 0;
-    Buffer buff(buf, bufSize);
-
-    // encode header
+void Message::encodeHeader(Buffer &buff, size_t anCount, size_t nsCount, size_t arCount) {
     buff.writeUint16(mId);
 
     uint16_t fields = ((mQr & 1) << 15);
@@ -91,9 +122,13 @@ BufferResult Message::encode(uint8_t *buf, size_t bufSize, size_t &encodedSize)
     buff.writeUint16(fields);
 
     buff.writeUint16(questions.size());
-    buff.writeUint16(answers.size());
-    buff.writeUint16(authorities.size());
-    buff.writeUint16(additions.size());
+    buff.writeUint16(anCount);
+    buff.writeUint16(nsCount);
+    buff.writeUint16(arCount);
+}
+
+void Message::encode(Buffer &buff) {
+    encodeHeader(buff, answers.size(), authorities.size(), additions.size());
 
     for (auto &rr : questions) {
         rr.encode(buff);
@@ -107,10 +142,178 @@ BufferResult Message::encode(uint8_t *buf, size_t bufSize, size_t &encodedSize)
     for (auto &rr : additions) {
         rr.encode(buff);
     }
+}
+
+static bool isSameRRset(ResourceRecord &a, ResourceRecord &b) {
+    if (a.getType() != b.getType() || a.mClass != b.mClass || a.mName.length() != b.mName.length()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.mName.length(); i++) {
+        if (tolower((unsigned char) a.mName[i]) != tolower((unsigned char) b.mName[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+enum class RRsetFilter {
+    kAll,
+    kOnlyOpt,
+    kExceptOpt,
+};
+
+// write whole RRsets (consecutive records with the same name, type and class) while they fit,
+// returns the number of records written. If skipOverflow is set, RRsets which don't fit are skipped
+// instead of stopping at them.
+static size_t encodeRRsets(Buffer &buff, std::vector<ResourceRecord> &list, RRsetFilter filter, bool skipOverflow, bool &overflow) {
+    size_t count = 0;
+    for (size_t begin = 0, end; begin < list.size(); begin = end) {
+        end = begin + 1;
+        while (end < list.size() && isSameRRset(list[begin], list[end])) {
+            end++;
+        }
+        bool isOpt = list[begin].getType() == RecordType::kOPT;
+        if ((filter == RRsetFilter::kOnlyOpt && !isOpt) || (filter == RRsetFilter::kExceptOpt && isOpt)) {
+            continue;
+        }
+        auto cp = buff.checkpoint();
+        for (size_t i = begin; i < end; i++) {
+            list[i].encode(buff);
+        }
+        if (buff.result() == BufferResult::BufferOverflow) {
+            buff.rollback(cp);
+            overflow = true;
+            if (!skipOverflow) {
+                break;
+            }
+            continue;
+        }
+        if (buff.isBroken()) {
+            break;
+        }
+        count += end - begin;
+    }
+    return count;
+}
+
+void Message::encodeTruncated(Buffer &buff) {
+    mTC = 0;
+    encodeHeader(buff, 0, 0, 0); // rewritten below with the final counts and flags
+    for (auto &rr : questions) {
+        rr.encode(buff);
+    }
+    if (buff.isBroken()) {
+        return;
+    }
+
+    bool overflow = false;
+    size_t anCount = encodeRRsets(buff, answers, RRsetFilter::kAll, false, overflow);
+    size_t nsCount = 0, arCount = 0;
+    if (!overflow) {
+        nsCount = encodeRRsets(buff, authorities, RRsetFilter::kAll, false, overflow);
+    }
+    if (overflow) {
+        mTC = 1;
+    }
+
+    // the additional section never causes truncation. The OPT record has the priority, it is kept
+    // even in a truncated response, then the other additional RRsets are written if they fit
+    auto cp = buff.checkpoint();
+    if (!mTC) {
+        arCount = encodeRRsets(buff, additions, RRsetFilter::kAll, true, overflow);
+    }
+    if (overflow) {
+        buff.rollback(cp);
+        arCount = encodeRRsets(buff, additions, RRsetFilter::kOnlyOpt, true, overflow);
+        if (!mTC) {
+            arCount += encodeRRsets(buff, additions, RRsetFilter::kExceptOpt, true, overflow);
+        }
+    }
+    if (buff.isBroken()) {
+        return;
+    }
+
+    auto endPos = buff.pos();
+    buff.seek(0);
+    encodeHeader(buff, anCount, nsCount, arCount);
+    buff.seek(endPos);
+}
+
+BufferResult Message::encode(uint8_t *buf, size_t bufSize, size_t &encodedSize) {
+    encodedSize = 0;
+    Buffer buff(buf, bufSize);
+    encode(buff);
     encodedSize = buff.pos();
     return buff.result();
 }
 
+BufferResult Message::encode(std::vector<uint8_t> &out) {
+    Buffer buff(out);
+    encode(buff);
+    out.resize(buff.isBroken() ? 0 : buff.pos());
+    return buff.result();
+}
+
+BufferResult Message::encode(std::vector<uint8_t> &out, size_t offset) {
+    Buffer buff(out, offset);
+    encode(buff);
+    out.resize(offset + (buff.isBroken() ? 0 : buff.pos()));
+    return buff.result();
+}
+
+BufferResult Message::encodeTruncated(uint8_t *buf, size_t bufSize, size_t maxPayloadSize, size_t &encodedSize) {
+    encodedSize = 0;
+    Buffer buff(buf, bufSize < maxPayloadSize ? bufSize : maxPayloadSize);
+    encodeTruncated(buff);
+    encodedSize = buff.pos();
+    return buff.result();
+}
+
+BufferResult Message::encodeTruncated(std::vector<uint8_t> &out, size_t maxPayloadSize) {
+    out.resize(maxPayloadSize);
+    Buffer buff(out.data(), out.size());
+    encodeTruncated(buff);
+    out.resize(buff.isBroken() ? 0 : buff.pos());
+    return buff.result();
+}
+
+size_t Message::encodedSize() {
+    Buffer buff(nullptr, SIZE_MAX);
+    encode(buff);
+    return buff.isBroken() ? 0 : buff.pos();
+}
+
+std::shared_ptr<RDataOPT> Message::getEdns() {
+    for (auto &rr : additions) {
+        auto rData = rr.getRData<RData>();
+        if (!rData) {
+            continue;
+        }
+        auto &current = *rData;
+        if (typeid(current) == typeid(RDataOPT)) {
+            return std::static_pointer_cast<RDataOPT>(rData);
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<RDataOPT> Message::setEdns(uint16_t payloadSize) {
+    auto opt = getEdns();
+    if (!opt) {
+        opt = std::make_shared<RDataOPT>();
+        additions.emplace_back();
+        additions.back().mType = RecordType::kOPT;
+        additions.back().setRData(opt);
+    }
+    opt->mPayloadSize = payloadSize;
+    return opt;
+}
+
+size_t Message::udpPayloadSize() {
+    auto opt = getEdns();
+    return opt ? opt->udpPayloadSize() : kMaxMsgLen;
+}
+
 std::string Message::toDebugString() {
     std::ostringstream text;
     text << "DNS Message " << (mQr ? "response" : "request") << ": id=" << mId << ", op=" << mOpCode << ", QD#=" << questions.size() << ", AN#=" << answers.size() << ",  NS#=" << authorities.size() << ", AR#=" << additions.size() << std::endl;
@@ -116,6 +116,17 @@ namespace dns {
  * ARCOUNT         an unsigned 16 bit integer specifying the number of resource records in the additional records section.
  */
 
+/**
+ * Limits checked by Message::decode right after the header, before anything is allocated.
+ * Independent of the limits, the counts must fit into the rest of the message (a question takes
+ * at least 5 bytes, a resource record at least 11 bytes), so junk packets are rejected cheaply.
+ */
+struct DecodeLimits {
+    size_t mMaxQuestions = 0xFFFF;
+    size_t mMaxRecordsPerSection = 0xFFFF;
+    size_t mMaxRecords = 3 * 0xFFFF; // answers + authorities + additions
+};
+
 class Message {
 public:
     uint16_t mId = 0;
@@ -134,14 +145,52 @@ public:
     std::vector<ResourceRecord> authorities;
     std::vector<ResourceRecord> additions;
 
+    DecodeLimits decodeLimits;
+
+    // decoding overwrites the message, existing questions and records are reused to avoid allocations
     BufferResult decode(const uint8_t* buf, size_t size);
     BufferResult encode(uint8_t* buf, size_t bufSize, size_t &encodedSize);
 
+    // encode into a growable buffer: out is resized to the encoded size, its capacity is kept for the next encoding
+    BufferResult encode(std::vector<uint8_t> &out);
+    // same, but the message is written after the first offset bytes of out, which are kept (eg: a length prefix),
+    // out is resized to offset + the encoded size
+    BufferResult encode(std::vector<uint8_t> &out, size_t offset);
+
+    // encode at most maxPayloadSize bytes (eg: 512, or the EDNS payload size of the query) for UDP:
+    // whole RRsets are written as long as they fit. Additional records which don't fit are dropped silently
+    // (OPT records are kept if possible), if answer or authority records don't fit they are dropped and mTC is set.
+    // Only fails if the header and the questions don't fit.
+    BufferResult encodeTruncated(uint8_t* buf, size_t bufSize, size_t maxPayloadSize, size_t &encodedSize);
+    BufferResult encodeTruncated(std::vector<uint8_t> &out, size_t maxPayloadSize);
+
+    // exact size of the encoded message (with name compression) without writing it, returns 0 if it can't be encoded
+    size_t encodedSize();
+
+    // decode with RData allocated from arena: after warm-up, decoding similar packets into the same message
+    // does not allocate any memory. The arena must outlive the message and the RData taken from it.
+    BufferResult decode(const uint8_t* buf, size_t size, Arena &arena);
+
     // char *buf is for debug purpose only
     BufferResult decode(const char* buf, size_t size) { return decode((uint8_t *)buf, size); }
     BufferResult encode(char* buf, size_t bufSize, size_t &encodedSize)  { return encode((uint8_t *)buf, bufSize, encodedSize); }
 
+    // EDNS(0): the OPT record of the additional section, nullptr if there is none
+    std::shared_ptr<RDataOPT> getEdns();
+    // add an OPT record to the additional section (or reuse the existing one) and return it
+    std::shared_ptr<RDataOPT> setEdns(uint16_t payloadSize);
+    // largest response the sender of this message accepts over UDP: its EDNS payload size, or 512 without EDNS
+    size_t udpPayloadSize();
+
     std::string toDebugString();
+
+private:
+    std::vector<ResourceRecord> spareRecords[3]; // records of each section kept from previous decoding for reuse
+
+    BufferResult decode(const uint8_t* buf, size_t size, Arena *arena);
+    void encode(Buffer &buff);
+    void encodeHeader(Buffer &buff, size_t anCount, size_t nsCount, size_t arCount);
+    void encodeTruncated(Buffer &buff);
 };
 } // namespace
 #endif	/* _DNS_MESSAGE_H */
@@ -6,6 +6,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <typeinfo>
 
 #include "buffer.h"
 #include "rr.h"
@@ -26,7 +27,7 @@ std::ostringstream RData::ossDebugString() {
 /////////// RDataWithName ///////////
 
 void RDataWithName::decode(Buffer &buffer, size_t /*dataLen*/) {
-    mName = buffer.readDomainName();
+    buffer.readDomainName(mName);
 }
 
 void RDataWithName::encode(Buffer &buffer) {
@@ -43,8 +44,8 @@ std::string RDataWithName::toDebugString() {
 /////////// RDataHINFO /////////////////
 
 void RDataHINFO::decode(Buffer &buffer, size_t /*dataLen*/) {
-    mCpu = buffer.readCharString();
-    mOs = buffer.readCharString();
+    buffer.readCharString(mCpu);
+    buffer.readCharString(mOs);
 }
 
 void RDataHINFO::encode(Buffer &buffer) {
@@ -62,8 +63,8 @@ std::string RDataHINFO::toDebugString() {
 /////////// RDataMINFO /////////////////
 
 void RDataMINFO::decode(Buffer &buffer, size_t /*dataLen*/) {
-    mRMailBx = buffer.readDomainName();
-    mMailBx = buffer.readDomainName();
+    buffer.readDomainName(mRMailBx);
+    buffer.readDomainName(mMailBx);
 }
 
 void RDataMINFO::encode(Buffer &buffer) {
@@ -81,7 +82,7 @@ std::string RDataMINFO::toDebugString() {
 /////////// RDataMX /////////////////
 void RDataMX::decode(Buffer &buffer, size_t /*dataLen*/) {
     mPreference = buffer.readUint16();
-    mExchange = buffer.readDomainName();
+    buffer.readDomainName(mExchange);
 }
 
 void RDataMX::encode(Buffer &buffer) {
@@ -97,6 +98,9 @@ std::string RDataMX::toDebugString() {
 
 /////////// RDataUnknown /////////////////
 RecordType RDataUnknown::getType() {
+    if (mType != RecordType::kNone || !record) {
+        return mType;
+    }
     return record->mType;
 }
 
@@ -117,8 +121,8 @@ std::string RDataUnknown::toDebugString() {
 /////////// RDataSOA /////////////////
 
 void RDataSOA::decode(Buffer &buffer, size_t /*dataLen*/) {
-    mMName = buffer.readDomainName();
-    mRName = buffer.readDomainName();
+    buffer.readDomainName(mMName);
+    buffer.readDomainName(mRName);
     mSerial = buffer.readUint32();
     mRefresh = buffer.readUint32();
     mRetry = buffer.readUint32();
@@ -152,11 +156,16 @@ std::string RDataSOA::toDebugString() {
 /////////// RDataTXT /////////////////
 
 void RDataTXT::decode(Buffer &buffer, size_t dataLen) {
-    mTexts.clear();
+    // reuse existing strings, so decoding into a reused record does not allocate
+    size_t count = 0;
     size_t posStart = buffer.pos();
     while (!buffer.isBroken() && buffer.pos() - posStart < dataLen) {
-        mTexts.push_back(buffer.readCharString());
+        if (count == mTexts.size()) {
+            mTexts.emplace_back();
+        }
+        buffer.readCharString(mTexts[count++]);
     }
+    mTexts.resize(count);
 }
 
 void RDataTXT::encode(Buffer &buffer) {
@@ -269,10 +278,10 @@ std::string RDataAAAA::toDebugString() {
 void RDataNAPTR::decode(Buffer &buffer, size_t /*dataLen*/) {
     mOrder = buffer.readUint16();
     mPreference = buffer.readUint16();
-    mFlags = buffer.readCharString();
-    mServices = buffer.readCharString();
-    mRegExp = buffer.readCharString();
-    mReplacement = buffer.readDomainName(false);
+    buffer.readCharString(mFlags);
+    buffer.readCharString(mServices);
+    buffer.readCharString(mRegExp);
+    buffer.readDomainName(mReplacement, false);
 }
 
 void RDataNAPTR::encode(Buffer &buffer) {
@@ -295,7 +304,7 @@ void RDataSRV::decode(Buffer &buffer, size_t /*dataLen*/) {
     mPriority = buffer.readUint16();
     mWeight = buffer.readUint16();
     mPort = buffer.readUint16();
-    mTarget = buffer.readDomainName();
+    buffer.readDomainName(mTarget);
 }
 
 void RDataSRV::encode(Buffer &buffer) {
@@ -330,6 +339,46 @@ OPT TTL
 2: | DO|                           Z                               |
    +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
  */
+const uint16_t RDataOPT::kFlagDO;
+const uint16_t RDataOPT::kDefaultPayloadSize;
+const uint16_t RDataOPT::kOptionClientSubnet;
+const uint16_t RDataOPT::kOptionCookie;
+const uint16_t RDataOPT::kOptionTcpKeepalive;
+const uint16_t RDataOPT::kOptionPadding;
+
+void RDataOPT::OptionIterator::load() {
+    if (mEnd - mPos < 4 || mEnd - mPos - 4 < ((mPos[2] << 8) | mPos[3])) {
+        mPos = mEnd;
+        return;
+    }
+    mOption.mCode = (mPos[0] << 8) | mPos[1];
+    mOption.mSize = (mPos[2] << 8) | mPos[3];
+    mOption.mData = mPos + 4;
+}
+
+bool RDataOPT::findOption(uint16_t code, Option &option) const {
+    for (auto &o : options()) {
+        if (o.mCode == code) {
+            option = o;
+            return true;
+        }
+    }
+    return false;
+}
+
+void RDataOPT::addOption(uint16_t code, const uint8_t *data, uint16_t size) {
+    uint8_t header[4] = {(uint8_t) (code >> 8), (uint8_t) (code & 0xFF), (uint8_t) (size >> 8), (uint8_t) (size & 0xFF)};
+    mData.insert(mData.end(), header, header + 4);
+    mData.insert(mData.end(), data, data + size);
+}
+
+void RDataOPT::unpack(uint16_t cls, uint32_t ttl) {
+    mPayloadSize = cls;
+    mExtendedRCode = ttl >> 24;
+    mVersion = (ttl >> 16) & 0xFF;
+    mFlags = ttl & 0xFFFF;
+}
+
 void RDataOPT::decode(Buffer &buffer, size_t dataLen) {
     buffer.readBytes(dataLen, mData);
 }
@@ -340,84 +389,135 @@ void RDataOPT::encode(Buffer &buffer) {
 
 std::string RDataOPT::toDebugString() {
     auto oss = std::ostringstream();
-    oss << "OPT payload_size=" << (uint16_t)record->mClass << " ext=" << (uint32_t) record->mTtl << " len=" << mData.size();
+    oss << "OPT payload_size=" << mPayloadSize << " ext_rcode=" << (unsigned) mExtendedRCode << " version=" << (unsigned) mVersion
+        << " do=" << (dnssecOk() ? 1 : 0) << " options=";
+    size_t count = 0;
+    for (auto &option : options()) {
+        oss << (count++ ? "," : "") << option.mCode;
+    }
+    oss << " len=" << mData.size();
     return oss.str();
 }
 
 /////////// ResourceRecord ////////////
 
-void ResourceRecord::decode(Buffer &buffer) {
-    mName = buffer.readDomainName();
+// reuse the current RData if nobody else refers to it and it has the right class,
+// otherwise create a new one (from the arena if there is one)
+template<typename T>
+static void prepareRData(std::shared_ptr<RData> &rData, Arena *arena) {
+    if (rData && rData.unique()) {
+        auto &current = *rData;
+        if (typeid(current) == typeid(T)) {
+            return;
+        }
+    }
+    if (arena) {
+        rData = std::allocate_shared<T>(ArenaAllocator<T>(*arena));
+    } else {
+        rData = std::make_shared<T>();
+    }
+}
+
+ResourceRecord::ResourceRecord(ResourceRecord &&other) noexcept :
+        mName(std::move(other.mName)), mType(other.mType), mClass(other.mClass), mTtl(other.mTtl), mRData(std::move(other.mRData)) {
+    if (mRData) {
+        mRData->record = this;
+    }
+}
+
+ResourceRecord &ResourceRecord::operator=(ResourceRecord &&other) noexcept {
+    if (this != &other) {
+        mName = std::move(other.mName);
+        mType = other.mType;
+        mClass = other.mClass;
+        mTtl = other.mTtl;
+        mRData = std::move(other.mRData);
+        if (mRData) {
+            mRData->record = this;
+        }
+    }
+    return *this;
+}
+
+void ResourceRecord::decode(Buffer &buffer, Arena *arena) {
+    buffer.readDomainName(mName);
     mType = (RecordType)buffer.readUint16();
 
-    // some pseudo-record type (like OPT) will use Class/Ttl as other meanings
+    // OPT uses Class/Ttl as other meanings, they are unpacked into RDataOPT below
     mClass = (RecordClass) buffer.readUint16();
     mTtl = buffer.readUint32();
 
     auto dataLen = buffer.readUint16();
+    if (!dataLen) {
+        mRData.reset(); // a reused RData would keep its old content, because nothing is decoded
+    }
     switch (mType) {
         case RecordType::kCNAME:
-            mRData = std::make_shared<RDataCNAME>();
+            prepareRData<RDataCNAME>(mRData, arena);
             break;
         case RecordType::kHINFO:
-            mRData = std::make_shared<RDataHINFO>();
+            prepareRData<RDataHINFO>(mRData, arena);
             break;
         case RecordType::kMB:
-            mRData = std::make_shared<RDataMB>();
+            prepareRData<RDataMB>(mRData, arena);
             break;
         case RecordType::kMD:
-            mRData = std::make_shared<RDataMD>();
+            prepareRData<RDataMD>(mRData, arena);
             break;
         case RecordType::kMF:
-            mRData = std::make_shared<RDataMF>();
+            prepareRData<RDataMF>(mRData, arena);
             break;
         case RecordType::kMG:
-            mRData = std::make_shared<RDataMG>();
+            prepareRData<RDataMG>(mRData, arena);
             break;
         case RecordType::kMINFO:
-            mRData = std::make_shared<RDataMINFO>();
+            prepareRData<RDataMINFO>(mRData, arena);
             break;
         case RecordType::kMR:
-            mRData = std::make_shared<RDataMR>();
+            prepareRData<RDataMR>(mRData, arena);
             break;
         case RecordType::kMX:
-            mRData = std::make_shared<RDataMX>();
+            prepareRData<RDataMX>(mRData, arena);
             break;
         case RecordType::kNS:
-            mRData = std::make_shared<RDataNS>();
+            prepareRData<RDataNS>(mRData, arena);
             break;
         case RecordType::kPTR:
-            mRData = std::make_shared<RDataPTR>();
+            prepareRData<RDataPTR>(mRData, arena);
             break;
         case RecordType::SOA:
-            mRData = std::make_shared<RDataSOA>();
+            prepareRData<RDataSOA>(mRData, arena);
             break;
         case RecordType::kTXT:
-            mRData = std::make_shared<RDataTXT>();
+            prepareRData<RDataTXT>(mRData, arena);
             break;
         case RecordType::kA:
-            mRData = std::make_shared<RDataA>();
+            prepareRData<RDataA>(mRData, arena);
             break;
         case RecordType::kWKS:
-            mRData = std::make_shared<RDataWKS>();
+            prepareRData<RDataWKS>(mRData, arena);
             break;
         case RecordType::kAAAA:
-            mRData = std::make_shared<RDataAAAA>();
+            prepareRData<RDataAAAA>(mRData, arena);
             break;
         case RecordType::kNAPTR:
-            mRData = std::make_shared<RDataNAPTR>();
+            prepareRData<RDataNAPTR>(mRData, arena);
             break;
         case RecordType::kSRV:
-            mRData = std::make_shared<RDataSRV>();
+            prepareRData<RDataSRV>(mRData, arena);
             break;
         case RecordType::kOPT:
-            mRData = std::make_shared<RDataOPT>();
+            prepareRData<RDataOPT>(mRData, arena);
             break;
         default:
-            mRData = std::make_shared<RDataUnknown>();
+            prepareRData<RDataUnknown>(mRData, arena);
+            static_cast<RDataUnknown *>(mRData.get())->mType = mType;
     }
 
     mRData->record = this;
+    if (mType == RecordType::kOPT) {
+        static_cast<RDataOPT *>(mRData.get())->unpack((uint16_t) mClass, mTtl);
+    }
 
     // RData can refer up to the offset after the dataLen in buffer
     if (dataLen) {
@@ -431,8 +531,15 @@ void ResourceRecord::decode(Buffer &buffer) {
 
 void ResourceRecord::encode(Buffer &buffer) {
     buffer.writeDomainName(mName);
-    buffer.writeUint16((uint16_t)mRData->getType());
-    // TODO: some pseudo-record type (like OPT) will use Class/Ttl as other meanings
+    auto type = mRData->getType();
+    buffer.writeUint16((uint16_t)type);
+    auto &rData = *mRData;
+    if (typeid(rData) == typeid(RDataOPT)) {
+        // the payload size, extended RCODE, version and flags of OPT are in CLASS and TTL, they come from RDataOPT
+        auto opt = static_cast<RDataOPT *>(mRData.get());
+        mClass = (RecordClass) opt->mPayloadSize;
+        mTtl = opt->packTtl();
+    }
     buffer.writeUint16((uint16_t)mClass);
     buffer.writeUint32(mTtl);
     // save position of buffer for later use (write length of RData part)
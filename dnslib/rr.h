@@ -21,6 +21,7 @@
 
 #include "dns.h"
 #include "buffer.h"
+#include "arena.h"
 
 namespace dns {
 
@@ -172,6 +173,9 @@ public:
 * class for appropriate type is not implemented. */
 class RDataUnknown : public RData {
 public:
+    // set by decoding, RData shared by copies of a record must not depend on the record for its type.
+    // kNone: the type of the record it belongs to
+    RecordType mType = RecordType::kNone;
     std::vector<uint8_t> mData;
 
     RecordType getType() override;
@@ -342,9 +346,74 @@ public:
     std::string toDebugString() override;
 };
 
+/**
+* OPT pseudo-record of EDNS(0) (RFC 6891)
+*
+* The CLASS and TTL fields of the OPT record are the UDP payload size, the extended RCODE, the version and the
+* flags. ResourceRecord::decode sets the fields below from them and ResourceRecord::encode writes them back
+* (mClass and mTtl of the record are set to the same values). The options stay in wire form in mData,
+* options() walks them without copying.
+*/
 class RDataOPT : public RData {
 public:
-    std::vector<uint8_t> mData;
+    static const uint16_t kFlagDO = 0x8000; // DNSSEC OK
+    static const uint16_t kDefaultPayloadSize = 1232;
+
+    // option codes
+    static const uint16_t kOptionClientSubnet = 8;
+    static const uint16_t kOptionCookie = 10;
+    static const uint16_t kOptionTcpKeepalive = 11;
+    static const uint16_t kOptionPadding = 12;
+
+    uint16_t mPayloadSize = kDefaultPayloadSize; // largest UDP payload the sender can receive
+    uint8_t mExtendedRCode = 0; // upper 8 bits of the 12-bit RCODE
+    uint8_t mVersion = 0;
+    uint16_t mFlags = 0;
+    std::vector<uint8_t> mData; // options: {code, length, data} in wire form
+
+    struct Option {
+        uint16_t mCode;
+        uint16_t mSize;
+        const uint8_t *mData; // points into mData of the RDataOPT
+    };
+
+    // forward iterator over the options, it stops at an option which is cut off
+    class OptionIterator {
+    public:
+        OptionIterator(const uint8_t *pos, const uint8_t *end) : mPos(pos), mEnd(end) { load(); }
+        const Option &operator*() const { return mOption; }
+        const Option *operator->() const { return &mOption; }
+        OptionIterator &operator++() {
+            mPos = mOption.mData + mOption.mSize;
+            load();
+            return *this;
+        }
+        bool operator==(const OptionIterator &other) const { return mPos == other.mPos; }
+        bool operator!=(const OptionIterator &other) const { return mPos != other.mPos; }
+    private:
+        const uint8_t *mPos;
+        const uint8_t *mEnd;
+        Option mOption{};
+        void load();
+    };
+    struct Options {
+        const uint8_t *mBegin;
+        const uint8_t *mEnd;
+        OptionIterator begin() const { return OptionIterator(mBegin, mEnd); }
+        OptionIterator end() const { return OptionIterator(mEnd, mEnd); }
+    };
+
+    Options options() const { return Options{mData.data(), mData.data() + mData.size()}; }
+    bool findOption(uint16_t code, Option &option) const;
+    void addOption(uint16_t code, const uint8_t *data, uint16_t size);
+
+    inline bool dnssecOk() const { return mFlags & kFlagDO; }
+    // payload sizes below 512 are treated as 512 (RFC 6891 section 6.2.5)
+    inline uint16_t udpPayloadSize() const { return mPayloadSize < kMaxMsgLen ? kMaxMsgLen : mPayloadSize; }
+
+    // CLASS and TTL of the OPT record
+    inline uint32_t packTtl() const { return ((uint32_t) mExtendedRCode << 24) | ((uint32_t) mVersion << 16) | mFlags; }
+    void unpack(uint16_t cls, uint32_t ttl);
 
     RecordType getType() override { return RecordType::kOPT; };
     void decode(Buffer &buffer, size_t dataLen) override;
@@ -410,6 +479,13 @@ public:
     RecordClass mClass = RecordClass::kNone;
     uint32_t mTtl = 0;
 
+    ResourceRecord() = default;
+    ResourceRecord(const ResourceRecord &other) = default;
+    ResourceRecord &operator=(const ResourceRecord &other) = default;
+    // moving keeps the back-pointer of RData valid (eg: records moved out of a vector or a callback)
+    ResourceRecord(ResourceRecord &&other) noexcept;
+    ResourceRecord &operator=(ResourceRecord &&other) noexcept;
+
     template<typename T>
     void setRData(std::shared_ptr<T> rData) {
         rData->record = this;
@@ -421,7 +497,11 @@ public:
         return std::static_pointer_cast<T>(mRData);
     }
 
-    void decode(Buffer &buffer);
+    // type of RData if it is set, otherwise mType
+    RecordType getType() { return mRData ? mRData->getType() : mType; }
+
+    // decoding reuses the current RData when possible, new RData is allocated from arena if it is given
+    void decode(Buffer &buffer, Arena *arena = nullptr);
     void encode(Buffer &buffer);
     std::string toDebugString();
 private:
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include <algorithm>
+
+#include "stream.h"
+
+using namespace dns;
+
+static inline size_t readLength(const uint8_t *p) {
+    return (((size_t) p[0]) << 8) + p[1];
+}
+
+void StreamFramer::keepRest() {
+    if (mPartialPos) {
+        mPartial.erase(mPartial.begin(), mPartial.begin() + mPartialPos);
+        mPartialPos = 0;
+    }
+    if (mPos < mSize) {
+        mPartial.insert(mPartial.end(), mData + mPos, mData + mSize);
+    }
+    mData = nullptr;
+    mSize = mPos = 0;
+}
+
+void StreamFramer::fillPartial(size_t size) {
+    auto take = std::min(size - mPartial.size(), mSize - mPos);
+    mPartial.insert(mPartial.end(), mData + mPos, mData + mPos + take);
+    mPos += take;
+}
+
+void StreamFramer::feed(const uint8_t *data, size_t size) {
+    keepRest(); // the previous chunk has not been read to its end
+    mData = data;
+    mSize = size;
+}
+
+bool StreamFramer::next(const uint8_t *&message, size_t &size) {
+    message = nullptr;
+    size = 0;
+    if (mPartialPos) {
+        mPartial.erase(mPartial.begin(), mPartial.begin() + mPartialPos);
+        mPartialPos = 0;
+    }
+    if (!mPartial.empty()) {
+        // complete the kept message with as many bytes of the chunk as it needs, the rest of the chunk isn't copied
+        if (mPartial.size() < 2) {
+            fillPartial(2);
+        }
+        if (mPartial.size() < 2) {
+            return false;
+        }
+        size_t need = 2 + readLength(mPartial.data());
+        if (mPartial.size() < need) {
+            fillPartial(need);
+        }
+        if (mPartial.size() < need) {
+            return false;
+        }
+        message = mPartial.data() + 2;
+        size = need - 2;
+        mPartialPos = need;
+        return true;
+    }
+
+    if (mSize - mPos >= 2) {
+        auto len = readLength(mData + mPos);
+        if (mSize - mPos - 2 >= len) {
+            message = mData + mPos + 2;
+            size = len;
+            mPos += 2 + len;
+            return true;
+        }
+    }
+    keepRest();
+    return false;
+}
+
+void StreamFramer::reset() {
+    mPartial.clear();
+    mPartialPos = 0;
+    mData = nullptr;
+    mSize = mPos = 0;
+}
+
+BufferResult StreamFramer::encode(Message &message, std::vector<uint8_t> &out) {
+    auto start = out.size();
+    auto result = message.encode(out, start + 2);
+    auto len = out.size() - start - 2;
+    if (result == BufferResult::NoError && len > 0xFFFF) {
+        result = BufferResult::BufferOverflow;
+    }
+    if (result != BufferResult::NoError) {
+        out.resize(start);
+        return result;
+    }
+    out[start] = (uint8_t) (len >> 8);
+    out[start + 1] = (uint8_t) (len & 0xFF);
+    return BufferResult::NoError;
+}
+
+BufferResult StreamFramer::append(const uint8_t *message, size_t size, std::vector<uint8_t> &out) {
+    if (size > 0xFFFF) {
+        return BufferResult::BufferOverflow;
+    }
+    out.push_back((uint8_t) (size >> 8));
+    out.push_back((uint8_t) (size & 0xFF));
+    out.insert(out.end(), message, message + size);
+    return BufferResult::NoError;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_STREAM_H
+#define _DNS_STREAM_H
+
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "message.h"
+
+namespace dns {
+
+/**
+ * Messages over TCP (RFC 1035 section 4.2.2, RFC 7766): every message is preceded by its length, a 2-byte integer.
+ *
+ * feed() takes the bytes as they are received, in chunks of any size, and next() returns the complete messages one by
+ * one. Messages which are whole inside a chunk are returned as slices of the chunk without copying, only a message
+ * which is cut off at the end of a chunk is copied and kept until the rest of it is fed.
+ *
+ * The output side appends length-prefixed messages to a buffer: encode() writes a Message right after 2 reserved
+ * bytes and fills in the length afterwards.
+ */
+class StreamFramer {
+public:
+    // the chunk must stay valid until next() returns false (or the next feed)
+    void feed(const uint8_t *data, size_t size);
+
+    // the next complete message, valid until the next call of next() or feed(),
+    // false if there is none: the rest of the chunk is kept and the chunk is not used anymore
+    bool next(const uint8_t *&message, size_t &size);
+
+    // bytes fed but not returned yet
+    inline size_t pendingSize() const { return mPartial.size() - mPartialPos + mSize - mPos; }
+    void reset();
+
+    // append message to out with its length prefix, BufferOverflow if it is larger than 65535 bytes (out is kept)
+    static BufferResult encode(Message &message, std::vector<uint8_t> &out);
+    static BufferResult append(const uint8_t *message, size_t size, std::vector<uint8_t> &out);
+
+private:
+    std::vector<uint8_t> mPartial; // the cut off message, from mPartialPos (the part before has been returned)
+    size_t mPartialPos = 0;
+    const uint8_t *mData = nullptr; // the chunk, from mPos
+    size_t mSize = 0;
+    size_t mPos = 0;
+
+    void keepRest();
+    void fillPartial(size_t size); // from the chunk, up to size bytes
+};
+
+} // namespace
+#endif /* _DNS_STREAM_H */
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include <cstring>
+
+#include "template.h"
+#include "view.h"
+
+using namespace dns;
+
+const char ResponseTemplate::kQName[] = "@";
+
+// while building, the question name is replaced by a placeholder question at offset 12, so the records start at
+// kRecordsBase and owner names of kQName become links to offset 12, which stay valid for every query
+static const size_t kQuestionPos = 12;
+static const size_t kRecordsBase = kQuestionPos + 3 + 4; // placeholder name |0x1|0x0|0x0| + type + class
+
+static inline uint16_t readUint16(const uint8_t *p) {
+    return (((uint16_t) p[0]) << 8) + p[1];
+}
+
+static inline void writeUint16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+BufferResult ResponseTemplate::build(Message &response) {
+    mRecords.clear();
+    mLinks.clear();
+    mMaxLinkTarget = 0;
+    mFlags = ((response.mAA & 1) << 10) | ((response.mRA & 1) << 7) | (response.mRCode & 15);
+
+    std::vector<ResourceRecord> *sections[3] = {&response.answers, &response.authorities, &response.additions};
+    for (size_t i = 0; i < 3; i++) {
+        if (sections[i]->size() > 0xFFFF) {
+            return BufferResult::InvalidData;
+        }
+        mCounts[i] = sections[i]->size();
+    }
+
+    // swap the owner names of kQName with the placeholder (restored below), "\0" is a single label of a zero byte
+    std::string placeholder(1, '\0');
+    std::vector<ResourceRecord *> swapped;
+    for (auto section : sections) {
+        for (auto &rr : *section) {
+            if (rr.mName == kQName) {
+                rr.mName = placeholder;
+                swapped.push_back(&rr);
+            }
+        }
+    }
+
+    std::vector<uint8_t> scratch;
+    std::vector<uint32_t> links;
+    Buffer buff(scratch);
+    buff.setLinkLog(&links);
+    buff.writeBytes((const uint8_t *) "\0\0\0\0\0\0\0\0\0\0\0\0", kQuestionPos);
+    buff.writeDomainName(placeholder);
+    buff.writeUint16(0);
+    buff.writeUint16(0);
+    for (auto section : sections) {
+        for (auto &rr : *section) {
+            rr.encode(buff);
+        }
+    }
+
+    for (auto rr : swapped) {
+        rr->mName = kQName;
+    }
+    if (buff.isBroken()) {
+        return buff.result();
+    }
+
+    mRecords.assign(scratch.begin() + kRecordsBase, scratch.begin() + buff.pos());
+    for (auto pos : links) {
+        if (pos < kRecordsBase) {
+            continue;
+        }
+        auto p = mRecords.data() + pos - kRecordsBase;
+        size_t target = readUint16(p) & 0x3FFF;
+        if (target == kQuestionPos) {
+            continue;
+        }
+        if (target < kRecordsBase) {
+            return BufferResult::InvalidData; // only the whole placeholder name can be a link target
+        }
+        target -= kRecordsBase;
+        writeUint16(p, 0xC000 + target);
+        mLinks.push_back(pos - kRecordsBase);
+        if (target > mMaxLinkTarget) {
+            mMaxLinkTarget = target;
+        }
+    }
+    return BufferResult::NoError;
+}
+
+BufferResult ResponseTemplate::apply(const uint8_t *query, size_t querySize, uint8_t *out, size_t outSize, size_t &responseSize) const {
+    responseSize = 0;
+    if (querySize < kQuestionPos) {
+        return BufferResult::BufferOverflow;
+    }
+    if ((readUint16(query + 2) & 0x8000) || readUint16(query + 4) != 1) {
+        return BufferResult::InvalidData; // a response (QR) or not one question
+    }
+    QuestionView question;
+    size_t base;
+    auto result = question.parse(query, querySize, kQuestionPos, base);
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+    if (base + mMaxLinkTarget > 0x3FFF) {
+        return BufferResult::InvalidData; // relocated links would not fit into 14 bits
+    }
+    if (base + mRecords.size() > outSize) {
+        return BufferResult::BufferOverflow;
+    }
+
+    memcpy(out, query, base);
+    // keep opcode and RD of the query, set QR, clear TC and Z
+    writeUint16(out + 2, 0x8000 | (readUint16(query + 2) & 0x7900) | mFlags);
+    for (size_t i = 0; i < 3; i++) {
+        writeUint16(out + 6 + i * 2, mCounts[i]);
+    }
+
+    auto records = out + base;
+    if (!mRecords.empty()) {
+        memcpy(records, mRecords.data(), mRecords.size());
+    }
+    for (auto pos : mLinks) {
+        writeUint16(records + pos, 0xC000 + base + (readUint16(records + pos) & 0x3FFF));
+    }
+    responseSize = base + mRecords.size();
+    return BufferResult::NoError;
+}
+
+BufferResult ResponseTemplate::apply(const uint8_t *query, size_t querySize, std::vector<uint8_t> &out) const {
+    out.resize(querySize + mRecords.size());
+    size_t responseSize;
+    auto result = apply(query, querySize, out.data(), out.size(), responseSize);
+    out.resize(responseSize);
+    return result;
+}
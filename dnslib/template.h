@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_TEMPLATE_H
+#define _DNS_TEMPLATE_H
+
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "buffer.h"
+#include "message.h"
+
+namespace dns {
+
+/**
+ * Pre-encoded response for queries which always get the same records (eg: a fixed answer for any name).
+ *
+ * The records are encoded once by build(), apply() then makes the response of a query by copying the header
+ * and the question of the query, patching the header fields and appending the encoded records, so no encoding
+ * and no name compression is done per query. Owner names equal to kQName stand for the question name of the
+ * query, they are written as a link to the question:
+ *
+ *     dns::Message m;
+ *     m.mAA = 1;
+ *     m.answers.emplace_back(...); // with mName = dns::ResponseTemplate::kQName
+ *     dns::ResponseTemplate tpl;
+ *     tpl.build(m);
+ *     ...
+ *     tpl.apply(query, querySize, response);
+ *
+ * The response keeps the id, opcode, RD flag and question of the query, the other header fields come from the
+ * message given to build(). Only queries (QR not set) with exactly one question are accepted.
+ */
+class ResponseTemplate {
+public:
+    static const char kQName[]; // "@"
+
+    // encode the records of the message (questions are ignored), mAA, mRA and mRCode are used for the header
+    BufferResult build(Message &response);
+
+    // write the response of query to out (out is resized to the response size)
+    BufferResult apply(const uint8_t *query, size_t querySize, std::vector<uint8_t> &out) const;
+    BufferResult apply(const uint8_t *query, size_t querySize, uint8_t *out, size_t outSize, size_t &responseSize) const;
+
+    // size of the encoded records, a response is this plus the size of the header and question of the query
+    inline size_t recordsSize() const { return mRecords.size(); }
+
+private:
+    uint16_t mFlags = 0; // AA, RA and RCODE bits of the header
+    uint16_t mCounts[3] = {0, 0, 0}; // ANCOUNT, NSCOUNT, ARCOUNT
+    std::vector<uint8_t> mRecords; // encoded records, links between them are relative to the start of mRecords
+    std::vector<uint32_t> mLinks; // positions in mRecords of the links which must be relocated
+    size_t mMaxLinkTarget = 0;
+};
+
+} // namespace
+#endif /* _DNS_TEMPLATE_H */
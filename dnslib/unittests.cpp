@@ -6,9 +6,19 @@
 
 #include <iostream>
 
+#include "alloccount.h"
 #include "message.h"
 #include "rr.h"
 #include "buffer.h"
+#include "cache.h"
+#include "stream.h"
+#include "template.h"
+#include "value.h"
+#include "view.h"
+#include "writer.h"
+#include "zone.h"
+#include "zonefile.h"
+#include "zoneimage.h"
 
 #ifdef _WIN32
 #pragma comment(lib, "ws2_32.lib")
@@ -101,6 +111,89 @@ static void testBufferDotEndedDomainName() {
     TEST_ASSERT(buffer[9] == 'x');
 }
 
+// check that suffixes of earlier names are replaced by links
+static void testBufferDomainNameCompression() {
+    uint8_t buffer[64] = {};
+    dns::Buffer dnsBuffer(buffer, sizeof(buffer));
+    dnsBuffer.writeDomainName("abc.com");
+    dnsBuffer.writeDomainName("x.abc.com");
+    dnsBuffer.writeDomainName("com");
+    dnsBuffer.writeDomainName("y.com");
+    dnsBuffer.writeDomainName("x.abc.com");
+    TEST_ASSERT(!dnsBuffer.isBroken());
+    auto expected = hex2bin("03 61 62 63 03 63 6f 6d 00  01 78 c0 00  c0 04  01 79 c0 04  c0 09");
+    TEST_ASSERT_EQUAL(expected.size(), dnsBuffer.pos());
+    TEST_ASSERT(memcmp(expected.data(), buffer, expected.size()) == 0);
+
+    dnsBuffer.seek(0);
+    TEST_ASSERT_EQUAL("abc.com", dnsBuffer.readDomainName());
+    TEST_ASSERT_EQUAL("x.abc.com", dnsBuffer.readDomainName());
+    TEST_ASSERT_EQUAL("com", dnsBuffer.readDomainName());
+    TEST_ASSERT_EQUAL("y.com", dnsBuffer.readDomainName());
+    TEST_ASSERT_EQUAL("x.abc.com", dnsBuffer.readDomainName());
+
+    // empty labels can not be encoded
+    dns::Buffer dnsBuffer2(buffer, sizeof(buffer));
+    dnsBuffer2.writeDomainName("abc..com");
+    TEST_ASSERT(dnsBuffer2.result() == dns::BufferResult::InvalidData);
+
+    // links can only point to the first 16K of the message
+    std::vector<uint8_t> big(0x5000);
+    dns::Buffer dnsBuffer3(big.data(), big.size());
+    dnsBuffer3.seek(0x4000);
+    dnsBuffer3.writeDomainName("abc.com");
+    dnsBuffer3.writeDomainName("abc.com");
+    TEST_ASSERT(!dnsBuffer3.isBroken());
+    TEST_ASSERT_EQUAL(0x4000 + 9 + 9, dnsBuffer3.pos());
+}
+
+// decoded suffixes are cached by offset, the cache must never return stale or wrong text
+static void testBufferDomainNameCache() {
+    // abc.com, x.abc.com, y.com, a link to the link of x.abc.com, a name which links to itself
+    auto wire = hex2bin("03 61 62 63 03 63 6f 6d 00  01 78 c0 00  01 79 c0 04  c0 09  01 7a c0 15");
+    dns::Buffer buff(wire.data(), wire.size());
+    for (size_t round = 0; round < 2; round++) {
+        buff.seek(0);
+        TEST_ASSERT_EQUAL("abc.com", buff.readDomainName());
+        TEST_ASSERT_EQUAL("x.abc.com", buff.readDomainName());
+        TEST_ASSERT_EQUAL("y.com", buff.readDomainName());
+        TEST_ASSERT_EQUAL("x.abc.com", buff.readDomainName());
+        TEST_ASSERT_EQUAL(19u, buff.pos());
+        buff.readDomainName();
+        TEST_ASSERT(buff.isBroken());
+        buff.clearBroken();
+    }
+
+    // names in the middle of other names
+    buff.seek(4);
+    TEST_ASSERT_EQUAL("com", buff.readDomainName());
+    buff.seek(17);
+    TEST_ASSERT_EQUAL("x.abc.com", buff.readDomainName());
+
+    // writing invalidates the cache
+    buff.seek(1);
+    buff.writeBytes((const uint8_t *) "xyz", 3);
+    buff.seek(17);
+    TEST_ASSERT_EQUAL("x.xyz.com", buff.readDomainName());
+
+    // many names linking to the same suffix, more suffixes than the cache can keep
+    std::vector<uint8_t> big;
+    dns::Buffer writer(big);
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 200; i++) {
+        names.push_back("h" + std::to_string(i % 7) + ".z" + std::to_string(i % 13) + ".example.com");
+        writer.writeDomainName(names.back());
+    }
+    TEST_ASSERT(!writer.isBroken());
+    dns::Buffer reader(big.data(), writer.pos());
+    std::string name;
+    for (size_t i = 0; i < names.size(); i++) {
+        reader.readDomainName(name);
+        TEST_ASSERT_EQUAL(names[i], name);
+    }
+    TEST_ASSERT_EQUAL(writer.pos(), reader.pos());
+}
+
 static void testBufferCharacterString() {
     // check encoding of domain name
     char b1[] = "xxxxxxxxxxxxxxxxxxxxxxxxxxxxx";
@@ -199,6 +292,17 @@ static void testUnknown() {
     rr.mType = dns::RecordType(0x1234);
     rr.setRData(std::make_shared<dns::RDataUnknown>());
     TEST_ASSERT(rr.getRData<dns::RDataUnknown>()->getType() == dns::RecordType(0x1234));
+
+    // a decoded record keeps its type in the RData, copies sharing it don't need the original record
+    uint8_t wire[] = {0x01, 'a', 0x00, 0xff, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x02, 0xab, 0xcd};
+    std::unique_ptr<dns::ResourceRecord> decoded(new dns::ResourceRecord());
+    dns::Buffer buff(wire, sizeof(wire));
+    decoded->decode(buff);
+    TEST_ASSERT(!buff.isBroken());
+    dns::ResourceRecord copy = *decoded;
+    decoded.reset();
+    TEST_ASSERT(copy.getType() == dns::RecordType(0xff00));
+    TEST_ASSERT_EQUAL(2u, copy.getRData<dns::RDataUnknown>()->mData.size());
 }
 
 static void testSOA() {
@@ -388,6 +492,34 @@ static void testPacketInvalid() {
     TEST_ASSERT(m2.decode(packet2, sizeof(packet2) - 1) != dns::BufferResult::NoError);
 }
 
+static void testDecodeLimits() {
+    // a header claiming 65535 entries in every section is rejected before anything is allocated
+    char packet1[] = "\x00\x01\x81\x80\xff\xff\xff\xff\xff\xff\xff\xff\x00\x00\x01\x00\x01";
+    dns::Message m;
+    auto allocCountStart = allocCount;
+    TEST_ASSERT(m.decode(packet1, sizeof(packet1) - 1) == dns::BufferResult::BufferOverflow);
+    TEST_ASSERT_EQUAL(0u, allocCount - allocCountStart);
+    TEST_ASSERT(m.questions.empty());
+    dns::MessageView view;
+    TEST_ASSERT(view.parse((const uint8_t *) packet1, sizeof(packet1) - 1) == dns::BufferResult::BufferOverflow);
+
+    // the same response as testPacket: 1 question, 5 answers
+    char packet2[] = "\xd5\xad\x81\x80\x00\x01\x00\x05\x00\x00\x00\x00\x03\x77\x77\x77\x06\x67\x6f\x6f\x67\x6c\x65\x03\x63\x6f\x6d\x00\x00\x01\x00\x01\xc0\x0c\x00\x05\x00\x01\x00\x00\x00\x05\x00\x08\x03\x77\x77\x77\x01\x6c\xc0\x10\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x68\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x63\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x67\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x93";
+    TEST_ASSERT(m.decode(packet2, sizeof(packet2) - 1) == dns::BufferResult::NoError);
+    m.decodeLimits.mMaxRecordsPerSection = 4;
+    TEST_ASSERT(m.decode(packet2, sizeof(packet2) - 1) == dns::BufferResult::LimitExceeded);
+    m.decodeLimits.mMaxRecordsPerSection = 5;
+    m.decodeLimits.mMaxQuestions = 0;
+    TEST_ASSERT(m.decode(packet2, sizeof(packet2) - 1) == dns::BufferResult::LimitExceeded);
+    m.decodeLimits = dns::DecodeLimits();
+    m.decodeLimits.mMaxRecords = 5;
+    TEST_ASSERT(m.decode(packet2, sizeof(packet2) - 1) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(5u, m.answers.size());
+
+    // truncated header
+    TEST_ASSERT(m.decode(packet2, 11) == dns::BufferResult::BufferOverflow);
+}
+
 static void testCreatePacket() {
     dns::Message answer;
     answer.mId = 45;
@@ -447,6 +579,1349 @@ static void testNameCompression() {
     if (buf.size() == mesgSize) {
         TEST_ASSERT(memcmp(buf.data(), mesg, mesgSize) == 0);
     }
+
+    TEST_ASSERT_EQUAL(buf.size(), m.encodedSize());
+    std::vector<uint8_t> out;
+    TEST_ASSERT(m.encode(out) == dns::BufferResult::NoError);
+    TEST_ASSERT(out == buf);
+}
+
+static void testEncodeGrowable() {
+    // a large response, links can not point beyond 16K
+    dns::Message m;
+    m.mQr = 1;
+    m.questions.emplace_back("example.com", dns::RecordType::kMX);
+    for (size_t i = 0; i < 2000; i++) {
+        auto rr = dns::ResourceRecord();
+        rr.mName = "example.com";
+        rr.mClass = dns::RecordClass::kIN;
+        auto rdata = std::make_shared<dns::RDataMX>();
+        rdata->mExchange = "mx" + std::to_string(i % 1000) + ".example.com";
+        rr.setRData(rdata);
+        m.answers.emplace_back(std::move(rr));
+    }
+
+    std::vector<uint8_t> out;
+    TEST_ASSERT(m.encode(out) == dns::BufferResult::NoError);
+    TEST_ASSERT(out.size() > 0x4000);
+    TEST_ASSERT_EQUAL(out.size(), m.encodedSize());
+
+    std::vector<uint8_t> fixed(out.size());
+    size_t encodedSize;
+    TEST_ASSERT(m.encode(fixed.data(), fixed.size(), encodedSize) == dns::BufferResult::NoError);
+    TEST_ASSERT(fixed == out);
+    TEST_ASSERT(m.encode(fixed.data(), fixed.size() - 1, encodedSize) == dns::BufferResult::BufferOverflow);
+
+    dns::Message m2;
+    TEST_ASSERT(m2.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(2000u, m2.answers.size());
+    TEST_ASSERT_EQUAL("mx999.example.com", m2.answers[1999].getRData<dns::RDataMX>()->mExchange);
+
+    // the capacity is reused
+    auto capacity = out.capacity();
+    m.answers.resize(10);
+    TEST_ASSERT(m.encode(out) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(out.size(), m.encodedSize());
+    TEST_ASSERT_EQUAL(capacity, out.capacity());
+
+    // invalid names can't be encoded
+    m.questions[0].mName = "a..b";
+    TEST_ASSERT_EQUAL(0u, m.encodedSize());
+}
+
+static void testEncodeTruncated() {
+    dns::Message m;
+    m.mQr = 1;
+    m.questions.emplace_back("example.com", dns::RecordType::kA);
+    auto addRecord = [](std::vector<dns::ResourceRecord> &list, const std::string &name, const std::string &addr) {
+        auto rr = dns::ResourceRecord();
+        rr.mName = name;
+        rr.mClass = dns::RecordClass::kIN;
+        auto rdata = std::make_shared<dns::RDataA>();
+        rdata->setAddress(addr);
+        rr.setRData(rdata);
+        list.emplace_back(std::move(rr));
+    };
+    // 2 RRsets in answer section: 20 + 20 records, each record takes 16 bytes, names are compared case-insensitively
+    for (size_t i = 0; i < 20; i++) {
+        addRecord(m.answers, i % 2 ? "example.com" : "EXAMPLE.com", "10.0.0." + std::to_string(i));
+    }
+    for (size_t i = 0; i < 20; i++) {
+        addRecord(m.answers, "www.example.com", "10.0.1." + std::to_string(i));
+    }
+    addRecord(m.additions, "ns.example.com", "10.0.2.1");
+    auto opt = dns::ResourceRecord();
+    opt.mClass = (dns::RecordClass) 1232;
+    opt.setRData(std::make_shared<dns::RDataOPT>());
+    m.additions.emplace_back(std::move(opt));
+
+    // everything fits, the result is the same as encode
+    std::vector<uint8_t> full, out;
+    TEST_ASSERT(m.encode(full) == dns::BufferResult::NoError);
+    TEST_ASSERT(m.encodeTruncated(out, full.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT(out == full);
+    TEST_ASSERT_EQUAL(0, m.mTC);
+
+    // additional records are dropped first, without TC, the OPT record is kept
+    TEST_ASSERT(m.encodeTruncated(out, full.size() - 1) == dns::BufferResult::NoError);
+    dns::Message m2;
+    TEST_ASSERT(m2.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(0, m2.mTC);
+    TEST_ASSERT_EQUAL(40u, m2.answers.size());
+    TEST_ASSERT_EQUAL(1u, m2.additions.size());
+    TEST_ASSERT(m2.additions[0].mType == dns::RecordType::kOPT);
+    TEST_ASSERT(m.encodeTruncated(out, full.size() - 11) == dns::BufferResult::NoError);
+    TEST_ASSERT(m2.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1u, m2.additions.size());
+
+    // only whole RRsets are written, TC is set, the OPT record is still there
+    size_t encodedSize;
+    uint8_t buf[512];
+    TEST_ASSERT(m.encodeTruncated(buf, sizeof(buf), 512, encodedSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1, m.mTC);
+    TEST_ASSERT(m2.decode(buf, encodedSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1, m2.mTC);
+    TEST_ASSERT_EQUAL(20u, m2.answers.size());
+    TEST_ASSERT_EQUAL(0, m2.answers[19].getRData<dns::RDataA>()->getAddress()[2]);
+    TEST_ASSERT_EQUAL(19, m2.answers[19].getRData<dns::RDataA>()->getAddress()[3]);
+    TEST_ASSERT_EQUAL(1u, m2.additions.size());
+    TEST_ASSERT(m2.additions[0].mType == dns::RecordType::kOPT);
+
+    // the compression dictionary doesn't keep names of dropped records
+    TEST_ASSERT(m.encodeTruncated(buf, sizeof(buf), 40, encodedSize) == dns::BufferResult::NoError);
+    TEST_ASSERT(m2.decode(buf, encodedSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1, m2.mTC);
+    TEST_ASSERT(m2.answers.empty());
+    TEST_ASSERT_EQUAL(1u, m2.additions.size());
+
+    // the question must fit
+    TEST_ASSERT(m.encodeTruncated(buf, sizeof(buf), 20, encodedSize) == dns::BufferResult::BufferOverflow);
+}
+
+static void testEdns() {
+    // query for example.com A with OPT: payload 4096, version 0, DO, a COOKIE option and a cut off option
+    char packet[] = "\x12\x34\x01\x00\x00\x01\x00\x00\x00\x00\x00\x01\x07\x65\x78\x61\x6d\x70\x6c\x65\x03\x63\x6f\x6d\x00\x00\x01\x00\x01\x00\x00\x29\x10\x00\x00\x00\x80\x00\x00\x10\x00\x0a\x00\x08\x01\x02\x03\x04\x05\x06\x07\x08\x00\x0c\x00\x04";
+    dns::Message m;
+    TEST_ASSERT(m.decode(packet, sizeof(packet) - 1) == dns::BufferResult::NoError);
+    auto edns = m.getEdns();
+    TEST_ASSERT(edns != nullptr);
+    TEST_ASSERT_EQUAL(4096, edns->mPayloadSize);
+    TEST_ASSERT_EQUAL(0, edns->mExtendedRCode);
+    TEST_ASSERT_EQUAL(0, edns->mVersion);
+    TEST_ASSERT(edns->dnssecOk());
+    TEST_ASSERT_EQUAL(4096u, m.udpPayloadSize());
+
+    size_t count = 0;
+    for (auto &option : edns->options()) {
+        TEST_ASSERT_EQUAL(dns::RDataOPT::kOptionCookie, option.mCode);
+        TEST_ASSERT_EQUAL(8, option.mSize);
+        TEST_ASSERT_EQUAL(8, option.mData[7]);
+        count++;
+    }
+    TEST_ASSERT_EQUAL(1u, count); // the padding option is cut off
+    dns::RDataOPT::Option option;
+    TEST_ASSERT(edns->findOption(dns::RDataOPT::kOptionCookie, option));
+    TEST_ASSERT(!edns->findOption(dns::RDataOPT::kOptionPadding, option));
+
+    // the fields are packed into CLASS and TTL again
+    edns->mData.clear();
+    uint8_t padding[3] = {};
+    edns->addOption(dns::RDataOPT::kOptionPadding, padding, sizeof(padding));
+    edns->mPayloadSize = 1400;
+    edns->mExtendedRCode = 1;
+    edns->mVersion = 2;
+    edns->mFlags = 0;
+    std::vector<uint8_t> out;
+    TEST_ASSERT(m.encode(out) == dns::BufferResult::NoError);
+    dns::Message m2;
+    TEST_ASSERT(m2.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    auto edns2 = m2.getEdns();
+    TEST_ASSERT(edns2 != nullptr);
+    TEST_ASSERT_EQUAL(1400, (int) m2.additions[0].mClass);
+    TEST_ASSERT_EQUAL(0x01020000u, m2.additions[0].mTtl);
+    TEST_ASSERT_EQUAL(1, edns2->mExtendedRCode);
+    TEST_ASSERT_EQUAL(2, edns2->mVersion);
+    TEST_ASSERT(!edns2->dnssecOk());
+    TEST_ASSERT(edns2->findOption(dns::RDataOPT::kOptionPadding, option));
+    TEST_ASSERT_EQUAL(3, option.mSize);
+
+    // without EDNS the limit is 512, setEdns adds one OPT record, small payload sizes count as 512
+    dns::Message m3;
+    TEST_ASSERT(m3.getEdns() == nullptr);
+    TEST_ASSERT_EQUAL(512u, m3.udpPayloadSize());
+    m3.setEdns(100);
+    m3.setEdns(1232);
+    TEST_ASSERT_EQUAL(1u, m3.additions.size());
+    TEST_ASSERT_EQUAL(1232u, m3.udpPayloadSize());
+    m3.getEdns()->mPayloadSize = 100;
+    TEST_ASSERT_EQUAL(512u, m3.udpPayloadSize());
+
+    // a decoded OPT record is encoded from RDataOPT, not from the CLASS and TTL it was decoded with
+    TEST_ASSERT(m3.setEdns(4096) != nullptr);
+    TEST_ASSERT(m3.encode(out) == dns::BufferResult::NoError);
+    dns::Message m4;
+    TEST_ASSERT(m4.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(4096, (int) m4.additions[0].mClass);
+    m4.setEdns(1232);
+    TEST_ASSERT(m4.encode(out) == dns::BufferResult::NoError);
+    TEST_ASSERT(m2.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1232, m2.getEdns()->mPayloadSize);
+    TEST_ASSERT_EQUAL(1232, (int) m2.additions[0].mClass);
+}
+
+static void testMessageWriter() {
+    // the same response built as a Message and with the writer
+    dns::Message m;
+    m.mId = 0x1234;
+    m.mQr = 1;
+    m.mAA = 1;
+    m.mRD = 1;
+    m.questions.emplace_back("www.example.com", dns::RecordType::kA);
+    auto add = [](std::vector<dns::ResourceRecord> &list, const std::string &name, uint32_t ttl, const std::shared_ptr<dns::RData> &rdata) {
+        dns::ResourceRecord rr;
+        rr.mName = name;
+        rr.mClass = dns::RecordClass::kIN;
+        rr.mTtl = ttl;
+        rr.setRData(rdata);
+        list.emplace_back(std::move(rr));
+    };
+    uint8_t addr4[4] = {192, 0, 2, 1};
+    uint8_t addr6[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    auto cname = std::make_shared<dns::RDataCNAME>();
+    cname->mName = "web.example.com";
+    add(m.answers, "www.example.com", 300, cname);
+    auto a = std::make_shared<dns::RDataA>();
+    a->setAddress(addr4);
+    add(m.answers, "web.example.com", 300, a);
+    auto aaaa = std::make_shared<dns::RDataAAAA>();
+    aaaa->setAddress(addr6);
+    add(m.answers, "web.example.com", 300, aaaa);
+    auto mx = std::make_shared<dns::RDataMX>();
+    mx->mPreference = 10;
+    mx->mExchange = "mail.example.com";
+    add(m.answers, "example.com", 3600, mx);
+    auto txt = std::make_shared<dns::RDataTXT>();
+    txt->mTexts = {std::string(255, 'a'), "bc"};
+    add(m.answers, "example.com", 60, txt);
+    auto srv = std::make_shared<dns::RDataSRV>();
+    srv->mPriority = 1;
+    srv->mWeight = 2;
+    srv->mPort = 5060;
+    srv->mTarget = "sip.example.com";
+    add(m.answers, "_sip._udp.example.com", 60, srv);
+    auto soa = std::make_shared<dns::RDataSOA>();
+    soa->mMName = "ns1.example.com";
+    soa->mRName = "admin.example.com";
+    soa->mSerial = 1;
+    soa->mRefresh = 7200;
+    soa->mRetry = 1800;
+    soa->mExpire = 604800;
+    soa->mMinimum = 60;
+    add(m.authorities, "example.com", 3600, soa);
+    auto ns = std::make_shared<dns::RDataNS>();
+    ns->mName = "ns1.example.com";
+    add(m.authorities, "example.com", 3600, ns);
+    add(m.additions, "ns1.example.com", 3600, a);
+    m.setEdns(1232)->mFlags = dns::RDataOPT::kFlagDO;
+    std::vector<uint8_t> expected;
+    TEST_ASSERT(m.encode(expected) == dns::BufferResult::NoError);
+
+    std::vector<uint8_t> out;
+    dns::MessageWriter w(out);
+    w.mId = 0x1234;
+    w.mQr = 1;
+    w.mAA = 1;
+    w.mRD = 1;
+    TEST_ASSERT(w.addQuestion("www.example.com", dns::RecordType::kA) == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addCNAME("www.example.com", 300, "web.example.com") == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addA("web.example.com", 300, addr4) == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addAAAA("web.example.com", 300, addr6) == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addMX("example.com", 3600, 10, "mail.example.com") == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addTXT("example.com", 60, std::string(255, 'a') + "bc") == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addSRV("_sip._udp.example.com", 60, 1, 2, 5060, "sip.example.com") == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addQuestion("example.com", dns::RecordType::kA) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(w.startSection(dns::MessageWriter::kAuthority) == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addSOA("example.com", 3600, "ns1.example.com", "admin.example.com", 1, 7200, 1800, 604800, 60) == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addNS("example.com", 3600, "ns1.example.com") == dns::BufferResult::NoError);
+    TEST_ASSERT(w.startSection(dns::MessageWriter::kAdditional) == dns::BufferResult::NoError);
+    TEST_ASSERT(w.startSection(dns::MessageWriter::kAnswer) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(w.addA("ns1.example.com", 3600, addr4) == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addOPT(1232, dns::RDataOPT::kFlagDO) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(6u, w.count(dns::MessageWriter::kAnswer));
+    TEST_ASSERT(w.finish() == dns::BufferResult::NoError);
+    TEST_ASSERT(out == expected);
+
+    // reset starts over in the same buffer, the compression dictionary of the last message is gone
+    w.reset();
+    w.mRD = 0;
+    TEST_ASSERT(w.addQuestion("example.com", dns::RecordType::kPTR) == dns::BufferResult::NoError);
+    TEST_ASSERT(w.addPTR("example.com", 60, "web.example.com") == dns::BufferResult::NoError);
+    TEST_ASSERT(w.finish() == dns::BufferResult::NoError);
+    dns::Message m2;
+    TEST_ASSERT(m2.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(0, m2.mRD);
+    TEST_ASSERT_EQUAL(1u, m2.answers.size());
+    TEST_ASSERT_EQUAL("web.example.com", m2.answers[0].getRData<dns::RDataPTR>()->mName);
+
+    // the vector was resized to the small message, a larger one grows it again
+    w.reset();
+    w.mRD = 1;
+    TEST_ASSERT(w.addQuestion("www.example.com", dns::RecordType::kTXT) == dns::BufferResult::NoError);
+    for (size_t i = 0; i < 10; i++) {
+        TEST_ASSERT(w.addTXT("www.example.com", 60, std::string(100, (char) ('a' + i))) == dns::BufferResult::NoError);
+    }
+    TEST_ASSERT(w.finish() == dns::BufferResult::NoError);
+    TEST_ASSERT(out.size() > 1000u);
+    TEST_ASSERT(m2.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(10u, m2.answers.size());
+    TEST_ASSERT_EQUAL(std::string(100, 'j'), m2.answers[9].getRData<dns::RDataTXT>()->mTexts[0]);
+
+    // a record which doesn't fit is dropped, the message written so far can be finished
+    uint8_t buf[64];
+    dns::MessageWriter fixed(buf, sizeof(buf));
+    TEST_ASSERT(fixed.addQuestion("example.com", dns::RecordType::kA) == dns::BufferResult::NoError);
+    TEST_ASSERT(fixed.addA("example.com", 60, addr4) == dns::BufferResult::NoError);
+    TEST_ASSERT(fixed.addMX("example.com", 60, 10, "a-very-long-mail-server-name.example.com") == dns::BufferResult::BufferOverflow);
+    TEST_ASSERT(fixed.addA("example.com", 60, addr4) == dns::BufferResult::NoError);
+    fixed.mTC = 1;
+    size_t size;
+    TEST_ASSERT(fixed.finish(size) == dns::BufferResult::NoError);
+    TEST_ASSERT(m2.decode(buf, size) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1, m2.mTC);
+    TEST_ASSERT_EQUAL(2u, m2.answers.size());
+
+    // the header must fit
+    dns::MessageWriter tiny(buf, 8);
+    TEST_ASSERT(tiny.addQuestion("example.com", dns::RecordType::kA) == dns::BufferResult::BufferOverflow);
+    TEST_ASSERT(tiny.finish(size) == dns::BufferResult::BufferOverflow);
+}
+
+static void testMessageView() {
+    // the same response as testPacket: www.google.com CNAME www.l.google.com, 4 A records
+    char packet[] = "\xd5\xad\x81\x80\x00\x01\x00\x05\x00\x00\x00\x00\x03\x77\x77\x77\x06\x67\x6f\x6f\x67\x6c\x65\x03\x63\x6f\x6d\x00\x00\x01\x00\x01\xc0\x0c\x00\x05\x00\x01\x00\x00\x00\x05\x00\x08\x03\x77\x77\x77\x01\x6c\xc0\x10\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x68\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x63\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x67\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x93";
+    auto buf = (const uint8_t *) packet;
+    size_t size = sizeof(packet) - 1;
+
+    dns::MessageView view;
+    TEST_ASSERT(view.parse(buf, size) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(0xd5ad, view.mId);
+    TEST_ASSERT_EQUAL(1, view.mQr);
+    TEST_ASSERT_EQUAL(1, view.mRD);
+    TEST_ASSERT_EQUAL(1u, view.questions().size());
+    TEST_ASSERT_EQUAL(5u, view.answers().size());
+    TEST_ASSERT(view.authorities().empty());
+    TEST_ASSERT(view.additions().empty());
+
+    auto qs = *view.questions().begin();
+    TEST_ASSERT(qs.mType == dns::RecordType::kA);
+    TEST_ASSERT(qs.mName.equals("WWW.Google.com."));
+    TEST_ASSERT(!qs.mName.equals("www.google.co"));
+    TEST_ASSERT(!qs.mName.equals("ww.google.com"));
+    TEST_ASSERT_EQUAL("www.google.com", qs.mName.toString());
+
+    size_t count = 0;
+    for (auto &rr : view.answers()) {
+        TEST_ASSERT_EQUAL(5u, rr.mTtl);
+        if (count == 0) {
+            TEST_ASSERT(rr.mType == dns::RecordType::kCNAME);
+            TEST_ASSERT(rr.mName.equals(qs.mName));
+            TEST_ASSERT_EQUAL("www.l.google.com", rr.rdataName().toString());
+        } else {
+            TEST_ASSERT(rr.mType == dns::RecordType::kA);
+            TEST_ASSERT(rr.mName.equals("www.l.google.com"));
+            TEST_ASSERT_EQUAL(4, rr.mRDataSize);
+            TEST_ASSERT_EQUAL(0x42, rr.mRData[0]);
+        }
+        count++;
+    }
+    TEST_ASSERT_EQUAL(5u, count);
+
+    // wire form of a compressed name is expanded
+    uint8_t wire[256];
+    auto wireSize = (view.answers().begin())->rdataName().toWire(wire, sizeof(wire), true);
+    TEST_ASSERT_EQUAL(18u, wireSize);
+    TEST_ASSERT(memcmp(wire, "\x03www\x01l\x06google\x03""com\x00", 18) == 0);
+
+    // lazy decoding of a single record
+    dns::ResourceRecord rr;
+    auto it = view.answers().begin();
+    ++it;
+    TEST_ASSERT(it->decode(rr) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL("A www.l.google.com IN 5 addr=66.249.91.104", rr.toDebugString());
+
+    // truncated packet and trailing garbage
+    TEST_ASSERT(view.parse(buf, size - 1) != dns::BufferResult::NoError);
+    char packet2[] = "\xd5\xad\x81\x80\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+    TEST_ASSERT(view.parse((const uint8_t *) packet2, sizeof(packet2) - 1) == dns::BufferResult::InvalidData);
+
+    // endless link loop
+    char packet3[] = "\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\xc0\x0c\x00\x01\x00\x01";
+    TEST_ASSERT(view.parse((const uint8_t *) packet3, sizeof(packet3) - 1) == dns::BufferResult::NoError);
+    std::string name;
+    TEST_ASSERT(view.questions().begin()->mName.toString(name) == dns::BufferResult::LabelCompressionLoop);
+}
+
+static void testMessageReader() {
+    // the same response as testMessageView, with an OPT record added
+    char packet[] = "\xd5\xad\x81\x80\x00\x01\x00\x05\x00\x00\x00\x01\x03\x77\x77\x77\x06\x67\x6f\x6f\x67\x6c\x65\x03\x63\x6f\x6d\x00\x00\x01\x00\x01\xc0\x0c\x00\x05\x00\x01\x00\x00\x00\x05\x00\x08\x03\x77\x77\x77\x01\x6c\xc0\x10\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x68\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x63\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x67\xc0\x2c\x00\x01\x00\x01\x00\x00\x00\x05\x00\x04\x42\xf9\x5b\x93\x00\x00\x29\x04\xd0\x00\x00\x80\x00\x00\x00";
+    auto buf = (const uint8_t *) packet;
+    size_t size = sizeof(packet) - 1;
+
+    // walking the message and looking at the A records doesn't allocate
+    size_t counts[4] = {}, lastOctets = 0;
+    auto allocCountStart = allocCount;
+    dns::MessageReader reader(buf, size);
+    TEST_ASSERT_EQUAL(0xd5ad, reader.header().mId);
+    while (reader.next()) {
+        counts[reader.section()]++;
+        if (reader.section() == dns::MessageReader::kAnswer && reader.record().mType == dns::RecordType::kA) {
+            TEST_ASSERT_EQUAL(4, reader.record().mRDataSize);
+            lastOctets += reader.record().mRData[3];
+        }
+    }
+    TEST_ASSERT_EQUAL(0u, allocCount - allocCountStart);
+    TEST_ASSERT(reader.result() == dns::BufferResult::NoError);
+    TEST_ASSERT(reader.section() == dns::MessageReader::kEnd);
+    TEST_ASSERT_EQUAL(1u, counts[0]);
+    TEST_ASSERT_EQUAL(5u, counts[1]);
+    TEST_ASSERT_EQUAL(0u, counts[2]);
+    TEST_ASSERT_EQUAL(1u, counts[3]);
+    TEST_ASSERT_EQUAL(0x68u + 0x63 + 0x67 + 0x93, lastOctets);
+
+    // RDATA is decoded on request, into RData of the same type
+    dns::MessageReader reader2(buf, size);
+    dns::RDataCNAME cname;
+    dns::RDataA a;
+    dns::RDataUnknown unknown;
+    TEST_ASSERT(reader2.next());
+    TEST_ASSERT(reader2.section() == dns::MessageReader::kQuestion);
+    TEST_ASSERT_EQUAL("www.google.com", reader2.question().mName.toString());
+    TEST_ASSERT(reader2.decodeRData(a) == dns::BufferResult::InvalidData); // questions have no RDATA
+    TEST_ASSERT(reader2.next());
+    TEST_ASSERT_EQUAL(32u, reader2.offset());
+    TEST_ASSERT(reader2.record().decodeRData(a) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(reader2.record().decodeRData(cname) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL("www.l.google.com", cname.mName);
+    TEST_ASSERT(reader2.record().decodeRData(unknown) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(8u, unknown.mData.size());
+    TEST_ASSERT(reader2.next());
+    allocCountStart = allocCount;
+    TEST_ASSERT(reader2.decodeRData(a) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(0u, allocCount - allocCountStart);
+    TEST_ASSERT_EQUAL(0x68, a.getAddress()[3]);
+    while (reader2.next() && reader2.section() != dns::MessageReader::kAdditional) {
+    }
+    dns::RDataOPT opt;
+    TEST_ASSERT(reader2.record().decodeRData(opt) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1232, opt.mPayloadSize);
+    TEST_ASSERT(opt.dnssecOk());
+    // an OPT record can be decoded as unknown data too, CLASS and TTL are not unpacked then
+    TEST_ASSERT(reader2.record().decodeRData(unknown) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(0u, unknown.mData.size());
+
+    // a cut off message stops at the broken entry, trailing bytes are reported at the end
+    dns::MessageReader cut(buf, size - 20);
+    size_t entries = 0;
+    while (cut.next()) {
+        entries++;
+    }
+    TEST_ASSERT_EQUAL(5u, entries);
+    TEST_ASSERT(cut.result() == dns::BufferResult::BufferOverflow);
+    std::vector<uint8_t> trailing(buf, buf + size);
+    trailing.push_back(0);
+    dns::MessageReader extra(trailing.data(), trailing.size());
+    entries = 0;
+    while (extra.next()) {
+        entries++;
+    }
+    TEST_ASSERT_EQUAL(7u, entries);
+    TEST_ASSERT(extra.result() == dns::BufferResult::InvalidData);
+}
+
+static void testQuestionKey() {
+    // query: WWW.Example.COM A IN, followed by an OPT record which isn't looked at
+    char packet[] = "\x12\x34\x01\x00\x00\x01\x00\x00\x00\x00\x00\x01\x03WWW\x07""Example\x03""COM\x00\x00\x01\x00\x01\x00\x00\x29\x10\x00\x00\x00\x00\x00\x00\x00";
+    auto buf = (const uint8_t *) packet;
+    size_t size = sizeof(packet) - 1;
+
+    dns::MessageView view;
+    TEST_ASSERT(view.parseHeader(buf, 12) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(0x1234, view.mId);
+    TEST_ASSERT_EQUAL(1, view.mRD);
+    TEST_ASSERT_EQUAL(1, view.mQdCount);
+    TEST_ASSERT_EQUAL(1, view.mArCount);
+    TEST_ASSERT(view.questions().empty());
+    TEST_ASSERT(view.parseHeader(buf, 11) == dns::BufferResult::BufferOverflow);
+
+    dns::QuestionKey key;
+    TEST_ASSERT(view.parseQuestion(buf, size, key) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(21u, key.size());
+    TEST_ASSERT_EQUAL(17u, key.nameWireSize());
+    TEST_ASSERT(memcmp(key.nameWire(), "\x03www\x07""example\x03""com\x00", 17) == 0);
+    TEST_ASSERT(key.type() == dns::RecordType::kA);
+    TEST_ASSERT(key.cls() == dns::RecordClass::kIN);
+
+    dns::QuestionKey key2("www.EXAMPLE.com.", dns::RecordType::kA);
+    TEST_ASSERT(key == key2);
+    TEST_ASSERT_EQUAL(key.hash(), key2.hash());
+    key2.assign("www.example.com", dns::RecordType::kAAAA);
+    TEST_ASSERT(key != key2);
+    TEST_ASSERT(key2.assign("a..b", dns::RecordType::kA) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(key2.empty());
+
+    // the question must be complete, the first name can't have links
+    TEST_ASSERT(view.parseQuestion(buf, 32, key) == dns::BufferResult::BufferOverflow);
+    packet[28] = '\xc0';
+    TEST_ASSERT(view.parseQuestion(buf, size, key) == dns::BufferResult::InvalidData);
+    packet[5] = 0;
+    TEST_ASSERT(view.parseQuestion(buf, size, key) == dns::BufferResult::InvalidData);
+}
+
+static void testResponseTemplate() {
+    dns::Message m;
+    m.mAA = 1;
+    for (int i = 0; i < 2; i++) {
+        auto rr = dns::ResourceRecord();
+        rr.mName = dns::ResponseTemplate::kQName;
+        rr.mClass = dns::RecordClass::kIN;
+        rr.mTtl = 60;
+        auto rdata = std::make_shared<dns::RDataMX>();
+        rdata->mPreference = 10 * (i + 1);
+        rdata->mExchange = i ? "mx2.example.com" : "mx1.example.com";
+        rr.setRData(rdata);
+        m.answers.emplace_back(std::move(rr));
+    }
+    auto rrA = dns::ResourceRecord();
+    rrA.mName = "mx1.example.com";
+    rrA.mClass = dns::RecordClass::kIN;
+    auto rdataA = std::make_shared<dns::RDataA>();
+    uint8_t ip4[4] = {1, 2, 3, 4};
+    rdataA->setAddress(ip4);
+    rrA.setRData(rdataA);
+    m.additions.emplace_back(std::move(rrA));
+
+    dns::ResponseTemplate tpl;
+    TEST_ASSERT(tpl.build(m) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(dns::ResponseTemplate::kQName, m.answers[0].mName); // the message is unchanged
+
+    // queries with different question names, the links between the records are relocated
+    const char *queries[2] = {
+        "\xab\xcd\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00\x03WWW\x07""Example\x03""COM\x00\x00\x0f\x00\x01",
+        "\x00\x07\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00\x01""a\x00\x00\x0f\x00\x01",
+    };
+    size_t querySizes[2] = {33, 19};
+    const char *qnames[2] = {"WWW.Example.COM", "a"};
+    std::vector<uint8_t> out;
+    for (int i = 0; i < 2; i++) {
+        auto query = (const uint8_t *) queries[i];
+        TEST_ASSERT(tpl.apply(query, querySizes[i], out) == dns::BufferResult::NoError);
+        TEST_ASSERT_EQUAL(querySizes[i] + tpl.recordsSize(), out.size());
+
+        dns::Message r;
+        TEST_ASSERT(r.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+        TEST_ASSERT_EQUAL((query[0] << 8) + query[1], r.mId);
+        TEST_ASSERT_EQUAL(1, r.mQr);
+        TEST_ASSERT_EQUAL(1, r.mAA);
+        TEST_ASSERT_EQUAL(1, r.mRD);
+        TEST_ASSERT_EQUAL(0, r.mTC);
+        TEST_ASSERT_EQUAL(1u, r.questions.size());
+        TEST_ASSERT_EQUAL(2u, r.answers.size());
+        TEST_ASSERT_EQUAL(0u, r.authorities.size());
+        TEST_ASSERT_EQUAL(1u, r.additions.size());
+        if (r.answers.size() != 2 || r.additions.size() != 1) {
+            continue;
+        }
+        TEST_ASSERT_EQUAL(qnames[i], r.questions[0].mName);
+        TEST_ASSERT_EQUAL(qnames[i], r.answers[0].mName);
+        TEST_ASSERT_EQUAL(qnames[i], r.answers[1].mName);
+        TEST_ASSERT_EQUAL("mx1.example.com", r.answers[0].getRData<dns::RDataMX>()->mExchange);
+        TEST_ASSERT_EQUAL("mx2.example.com", r.answers[1].getRData<dns::RDataMX>()->mExchange);
+        TEST_ASSERT_EQUAL(20, r.answers[1].getRData<dns::RDataMX>()->mPreference);
+        TEST_ASSERT_EQUAL("mx1.example.com", r.additions[0].mName);
+        TEST_ASSERT_EQUAL(4, r.additions[0].getRData<dns::RDataA>()->getAddress()[3]);
+    }
+
+    // fixed buffer must be large enough, only queries (not responses) with one question are accepted
+    auto query = (const uint8_t *) queries[1];
+    uint8_t fixed[512];
+    size_t responseSize;
+    TEST_ASSERT(tpl.apply(query, querySizes[1], fixed, sizeof(fixed), responseSize) == dns::BufferResult::NoError);
+    TEST_ASSERT(memcmp(fixed, out.data(), out.size()) == 0);
+    TEST_ASSERT(tpl.apply(query, querySizes[1], fixed, responseSize - 1, responseSize) == dns::BufferResult::BufferOverflow);
+    TEST_ASSERT(tpl.apply(query, querySizes[1] - 1, out) == dns::BufferResult::BufferOverflow);
+    std::string twoQuestions(queries[1], querySizes[1]);
+    twoQuestions[5] = 2;
+    TEST_ASSERT(tpl.apply((const uint8_t *) twoQuestions.data(), twoQuestions.size(), out) == dns::BufferResult::InvalidData);
+    std::string response(queries[1], querySizes[1]);
+    response[2] |= 0x80;
+    TEST_ASSERT(tpl.apply((const uint8_t *) response.data(), response.size(), out) == dns::BufferResult::InvalidData);
+}
+
+template<typename T>
+static dns::ResourceRecord makeRecord(const std::string &name, uint32_t ttl, std::shared_ptr<T> rdata) {
+    dns::ResourceRecord rr;
+    rr.mName = name;
+    rr.mClass = dns::RecordClass::kIN;
+    rr.mTtl = ttl;
+    rr.setRData(rdata);
+    return rr;
+}
+
+static dns::ResourceRecord makeA(const std::string &name, const std::string &addr) {
+    auto rdata = std::make_shared<dns::RDataA>();
+    rdata->setAddress(addr);
+    return makeRecord(name, 300, rdata);
+}
+
+template<typename T>
+static dns::ResourceRecord makeNameRecord(const std::string &name, const std::string &target) {
+    auto rdata = std::make_shared<T>();
+    rdata->mName = target;
+    return makeRecord(name, 300, rdata);
+}
+
+static void testZoneStore() {
+    auto zone = std::make_shared<dns::Zone>("Example.COM.");
+    auto soa = std::make_shared<dns::RDataSOA>();
+    soa->mMName = "ns1.example.com";
+    soa->mRName = "admin.example.com";
+    soa->mMinimum = 60;
+    TEST_ASSERT(zone->add(makeRecord("example.com", 3600, soa)) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeNameRecord<dns::RDataNS>("example.com", "ns1.example.com")) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeA("ns1.example.com", "192.0.2.1")) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeA("WWW.example.com", "192.0.2.2")) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeA("www.example.com", "192.0.2.3")) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeNameRecord<dns::RDataCNAME>("alias.example.com", "www.example.com")) == dns::BufferResult::NoError);
+    auto mx = std::make_shared<dns::RDataMX>();
+    mx->mPreference = 10;
+    mx->mExchange = "ns1.example.com";
+    TEST_ASSERT(zone->add(makeRecord("example.com", 300, mx)) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeA("*.wild.example.com", "192.0.2.4")) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeA("a.b.example.com", "192.0.2.5")) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeNameRecord<dns::RDataNS>("sub.example.com", "ns.sub.example.com")) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeA("ns.sub.example.com", "192.0.2.6")) == dns::BufferResult::NoError);
+    TEST_ASSERT(zone->add(makeA("example.org", "192.0.2.7")) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(zone->add(makeA("badexample.com", "192.0.2.7")) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(zone->add(dns::ResourceRecord()) == dns::BufferResult::InvalidData);
+    TEST_ASSERT_EQUAL(11u, zone->recordCount());
+    TEST_ASSERT(zone->hasSoa());
+
+    dns::ZoneStore store;
+    store.update(zone);
+    TEST_ASSERT_EQUAL(1u, store.zoneCount());
+    dns::ZoneStore::Reader reader(store);
+    dns::Message query, response;
+    query.mId = 7;
+    query.mRD = 1;
+    query.questions.emplace_back("www.EXAMPLE.com", dns::RecordType::kA);
+    auto ask = [&](const std::string &name, dns::RecordType type) {
+        query.questions[0] = dns::QuestionSection(name, type);
+        reader.answer(query, response);
+    };
+
+    ask("www.EXAMPLE.com", dns::RecordType::kA);
+    TEST_ASSERT_EQUAL(7, response.mId);
+    TEST_ASSERT_EQUAL(1, response.mQr);
+    TEST_ASSERT_EQUAL(1, response.mAA);
+    TEST_ASSERT_EQUAL(1, response.mRD);
+    TEST_ASSERT_EQUAL(0, response.mRCode);
+    TEST_ASSERT_EQUAL(1u, response.questions.size());
+    TEST_ASSERT_EQUAL(2u, response.answers.size());
+    TEST_ASSERT_EQUAL(0u, response.authorities.size());
+
+    // the CNAME is followed inside the zone
+    ask("alias.example.com", dns::RecordType::kA);
+    TEST_ASSERT_EQUAL(3u, response.answers.size());
+    TEST_ASSERT(response.answers[0].getType() == dns::RecordType::kCNAME);
+    TEST_ASSERT_EQUAL("WWW.example.com", response.answers[1].mName);
+    ask("alias.example.com", dns::RecordType::kCNAME);
+    TEST_ASSERT_EQUAL(1u, response.answers.size());
+
+    // additional records for MX
+    ask("example.com", dns::RecordType::kMX);
+    TEST_ASSERT_EQUAL(1u, response.answers.size());
+    TEST_ASSERT_EQUAL(1u, response.additions.size());
+    TEST_ASSERT_EQUAL("ns1.example.com", response.additions[0].mName);
+
+    // NXDOMAIN and NODATA (also for empty non-terminals) with SOA, its TTL is limited by MINIMUM
+    ask("nx.example.com", dns::RecordType::kA);
+    TEST_ASSERT_EQUAL(3, response.mRCode);
+    TEST_ASSERT_EQUAL(1, response.mAA);
+    TEST_ASSERT_EQUAL(0u, response.answers.size());
+    TEST_ASSERT_EQUAL(1u, response.authorities.size());
+    TEST_ASSERT(response.authorities[0].getType() == dns::RecordType::SOA);
+    TEST_ASSERT_EQUAL(60u, response.authorities[0].mTtl);
+    for (auto name : {"www.example.com", "b.example.com"}) {
+        ask(name, dns::RecordType::kMX);
+        TEST_ASSERT_EQUAL(0, response.mRCode);
+        TEST_ASSERT_EQUAL(0u, response.answers.size());
+        TEST_ASSERT_EQUAL(1u, response.authorities.size());
+    }
+
+    // wildcard
+    ask("x.y.Wild.example.com", dns::RecordType::kA);
+    TEST_ASSERT_EQUAL(0, response.mRCode);
+    TEST_ASSERT_EQUAL(1u, response.answers.size());
+    TEST_ASSERT_EQUAL("x.y.Wild.example.com", response.answers[0].mName);
+
+    // referral with glue
+    ask("host.sub.example.com", dns::RecordType::kA);
+    TEST_ASSERT_EQUAL(0, response.mRCode);
+    TEST_ASSERT_EQUAL(0, response.mAA);
+    TEST_ASSERT_EQUAL(0u, response.answers.size());
+    TEST_ASSERT_EQUAL(1u, response.authorities.size());
+    TEST_ASSERT_EQUAL(1u, response.additions.size());
+
+    // the response can be encoded and decoded
+    std::vector<uint8_t> out;
+    TEST_ASSERT(response.encode(out) == dns::BufferResult::NoError);
+    dns::Message decoded;
+    TEST_ASSERT(decoded.decode(out.data(), out.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL("ns.sub.example.com", decoded.additions[0].mName);
+
+    // not our zone, unsupported queries
+    ask("example.org", dns::RecordType::kA);
+    TEST_ASSERT_EQUAL(5, response.mRCode);
+    query.questions.emplace_back("example.com", dns::RecordType::kA);
+    reader.answer(query, response);
+    TEST_ASSERT_EQUAL(1, response.mRCode);
+    query.questions.resize(1);
+
+    // replacing the zone while a reader has pinned the old one
+    auto zone2 = std::make_shared<dns::Zone>("example.com");
+    TEST_ASSERT(zone2->add(makeA("www.example.com", "192.0.2.9")) == dns::BufferResult::NoError);
+    ask("www.example.com", dns::RecordType::kA);
+    std::weak_ptr<dns::Zone> oldZone = zone;
+    zone.reset();
+    store.update(zone2);
+    TEST_ASSERT(!oldZone.expired());
+    TEST_ASSERT_EQUAL(2u, response.answers.size());
+    ask("www.example.com", dns::RecordType::kA);
+    TEST_ASSERT_EQUAL(1u, response.answers.size());
+    store.remove("EXAMPLE.com.");
+    TEST_ASSERT(oldZone.expired());
+    TEST_ASSERT_EQUAL(0u, store.zoneCount());
+    ask("www.example.com", dns::RecordType::kA);
+    TEST_ASSERT_EQUAL(5, response.mRCode);
+}
+
+static void testZoneFileParser() {
+    const char *text =
+            "$ORIGIN example.com.\n"
+            "$TTL 1h\n"
+            "@   IN  SOA ns1 admin.example.com. (\n"
+            "            2022010101 ; serial\n"
+            "            2h 30M 1w 60 )\n"
+            "    NS  ns1\n"
+            "    MX  10 mail.example.com.\n"
+            "ns1 300 A   192.0.2.1\n"
+            "www IN 60 AAAA 2001:db8::1\n"
+            "    TXT \"hello world\" \"a\\\"b\" c\\059d\n"
+            "alias CNAME www\n"
+            "_sip._udp SRV 1 2 5060 sip\n"
+            "e164 NAPTR 100 10 \"u\" \"E2U+sip\" \"!^.*$!sip:info@example.com!\" .\n"
+            "host HINFO \"PC\" \"Linux\"\n"
+            "box MINFO admin errors\n"
+            "w WKS 192.0.2.2 TCP 25 80\n"
+            "g TYPE65280 \\# 3 01 02 03\n"
+            "g2 A \\# 4 C0000203\n"
+            "$ORIGIN sub\n"
+            "x PTR @\n"
+            "y CH A 192.0.2.4\n";
+
+    std::vector<dns::ResourceRecord> records;
+    dns::ZoneFileParser parser;
+    auto collect = [&](dns::ResourceRecord &rr) {
+        records.push_back(std::move(rr));
+        return true;
+    };
+    TEST_ASSERT(parser.parse(text, strlen(text), collect) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL("", parser.errorMessage());
+    TEST_ASSERT_EQUAL(16u, records.size());
+    if (records.size() != 16) {
+        return;
+    }
+
+    TEST_ASSERT_EQUAL("example.com", records[0].mName);
+    TEST_ASSERT_EQUAL(3600u, records[0].mTtl);
+    auto soa = records[0].getRData<dns::RDataSOA>();
+    TEST_ASSERT_EQUAL("ns1.example.com", soa->mMName);
+    TEST_ASSERT_EQUAL("admin.example.com", soa->mRName);
+    TEST_ASSERT_EQUAL(2022010101u, soa->mSerial);
+    TEST_ASSERT_EQUAL(7200u, soa->mRefresh);
+    TEST_ASSERT_EQUAL(1800u, soa->mRetry);
+    TEST_ASSERT_EQUAL(604800u, soa->mExpire);
+    TEST_ASSERT_EQUAL(60u, soa->mMinimum);
+
+    TEST_ASSERT_EQUAL("example.com", records[1].mName);
+    TEST_ASSERT_EQUAL("ns1.example.com", records[1].getRData<dns::RDataNS>()->mName);
+    TEST_ASSERT_EQUAL("mail.example.com", records[2].getRData<dns::RDataMX>()->mExchange);
+    TEST_ASSERT_EQUAL(300u, records[3].mTtl);
+    TEST_ASSERT_EQUAL(1, records[3].getRData<dns::RDataA>()->getAddress()[3]);
+    TEST_ASSERT(records[4].mClass == dns::RecordClass::kIN);
+    TEST_ASSERT_EQUAL(60u, records[4].mTtl);
+    TEST_ASSERT_EQUAL(0x20, records[4].getRData<dns::RDataAAAA>()->getAddress()[0]);
+    TEST_ASSERT_EQUAL("www.example.com", records[5].mName);
+    TEST_ASSERT_EQUAL(3600u, records[5].mTtl);
+    auto txt = records[5].getRData<dns::RDataTXT>();
+    TEST_ASSERT_EQUAL(3u, txt->mTexts.size());
+    TEST_ASSERT_EQUAL("hello world", txt->mTexts[0]);
+    TEST_ASSERT_EQUAL("a\"b", txt->mTexts[1]);
+    TEST_ASSERT_EQUAL("c;d", txt->mTexts[2]);
+    TEST_ASSERT_EQUAL("www.example.com", records[6].getRData<dns::RDataCNAME>()->mName);
+    auto srv = records[7].getRData<dns::RDataSRV>();
+    TEST_ASSERT_EQUAL("_sip._udp.example.com", records[7].mName);
+    TEST_ASSERT_EQUAL(5060, srv->mPort);
+    TEST_ASSERT_EQUAL("sip.example.com", srv->mTarget);
+    auto naptr = records[8].getRData<dns::RDataNAPTR>();
+    TEST_ASSERT_EQUAL("E2U+sip", naptr->mServices);
+    TEST_ASSERT_EQUAL("!^.*$!sip:info@example.com!", naptr->mRegExp);
+    TEST_ASSERT_EQUAL("", naptr->mReplacement);
+    TEST_ASSERT_EQUAL("Linux", records[9].getRData<dns::RDataHINFO>()->mOs);
+    TEST_ASSERT_EQUAL("errors.example.com", records[10].getRData<dns::RDataMINFO>()->mMailBx);
+    auto wks = records[11].getRData<dns::RDataWKS>();
+    TEST_ASSERT_EQUAL(6, wks->mProtocol);
+    TEST_ASSERT_EQUAL(11u, wks->mBitmap.size());
+    TEST_ASSERT_EQUAL(0x40, wks->mBitmap[3]);
+    TEST_ASSERT_EQUAL(0x80, wks->mBitmap[10]);
+    TEST_ASSERT(records[12].getType() == (dns::RecordType) 65280);
+    TEST_ASSERT_EQUAL(3u, records[12].getRData<dns::RDataUnknown>()->mData.size());
+    TEST_ASSERT_EQUAL("g2.example.com", records[13].mName);
+    TEST_ASSERT_EQUAL(3, records[13].getRData<dns::RDataA>()->getAddress()[3]);
+    TEST_ASSERT_EQUAL("x.sub.example.com", records[14].mName);
+    TEST_ASSERT_EQUAL("sub.example.com", records[14].getRData<dns::RDataPTR>()->mName);
+    TEST_ASSERT(records[15].mClass == dns::RecordClass::kCH);
+
+    // errors are reported with the line of the entry
+    const char *invalid[] = {
+            "a A 192.0.2.1\nb A 1.2.3\n",
+            "a A 192.0.2.1\n  (\nb A 1.2.3.4\n",
+            "a TXT \"abc\n",
+            "a FOO 1\n",
+            "  A 192.0.2.1\n",
+            "a MX 70000 b\n",
+            "a A 192.0.2.1 extra\n",
+            "a..b A 192.0.2.1\n",
+            "a NUL 1\n",
+            "a A \\# 4 0102\n",
+            "$INCLUDE other.zone\n",
+    };
+    size_t lines[] = {2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        TEST_ASSERT(parser.parse(invalid[i], strlen(invalid[i]), collect) == dns::BufferResult::InvalidData);
+        TEST_ASSERT_EQUAL(lines[i], parser.errorLine());
+    }
+
+    // from a file, the callback can stop the parser
+    const char *path = "unittests_zonefile.tmp";
+    FILE *f = fopen(path, "wb");
+    TEST_ASSERT(f != nullptr);
+    if (f) {
+        fwrite(text, 1, strlen(text), f);
+        fclose(f);
+    }
+    size_t count = 0;
+    TEST_ASSERT(parser.parseFile(path, [&](dns::ResourceRecord &) { return ++count < 5; }) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(5u, count);
+    remove(path);
+    TEST_ASSERT(parser.parseFile(path, collect) == dns::BufferResult::InvalidData);
+}
+
+static void testZoneImage() {
+    const char *text =
+            "$ORIGIN example.com.\n"
+            "$TTL 300\n"
+            "@ IN SOA ns1 admin 1 7200 900 1209600 60\n"
+            "  NS ns1\n"
+            "  MX 10 mail\n"
+            "ns1 A 192.0.2.1\n"
+            "mail A 192.0.2.2\n"
+            "mail AAAA 2001:db8::2\n"
+            "WWW A 192.0.2.3\n"
+            "www A 192.0.2.4\n"
+            "alias CNAME www\n"
+            "out CNAME www.example.org.\n"
+            "*.wild A 192.0.2.5\n"
+            "a.b A 192.0.2.6\n"
+            "sub NS ns.sub\n"
+            "ns.sub A 192.0.2.7\n"
+            "srv SRV 1 2 53 ns1\n"
+            "big A 192.0.2.8\n";
+    std::string zoneText = text;
+    for (size_t i = 0; i < 20; i++) {
+        zoneText += "big TXT \"" + std::string(20, (char) ('a' + i)) + "\"\n";
+    }
+    text = zoneText.c_str();
+    auto zone = std::make_shared<dns::Zone>("example.com");
+    dns::ZoneFileParser parser;
+    TEST_ASSERT(parser.parse(text, strlen(text), [&](dns::ResourceRecord &rr) {
+        return zone->add(std::move(rr)) == dns::BufferResult::NoError;
+    }) == dns::BufferResult::NoError);
+
+    std::vector<uint8_t> bytes;
+    TEST_ASSERT(dns::ZoneImage::compile(*zone, bytes) == dns::BufferResult::NoError);
+    dns::ZoneImage image;
+    TEST_ASSERT(image.attach(bytes.data(), bytes.size()) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL("example.com", image.origin());
+    TEST_ASSERT_EQUAL(zone->recordCount(), image.recordCount());
+    TEST_ASSERT(image.recordClass() == dns::RecordClass::kIN);
+
+    // the image answers like the zone
+    dns::ZoneStore store;
+    store.update(zone);
+    dns::ZoneStore::Reader reader(store);
+    dns::Message query, expected, decoded;
+    query.mId = 0x1234;
+    query.mRD = 1;
+    query.questions.emplace_back("", dns::RecordType::kA);
+    std::vector<uint8_t> queryWire, expectedWire;
+    uint8_t out[dns::kMaxMsgLen];
+    size_t outSize;
+    const std::pair<const char *, dns::RecordType> questions[] = {
+            {"www.EXAMPLE.com", dns::RecordType::kA}, {"alias.example.com", dns::RecordType::kA},
+            {"alias.example.com", dns::RecordType::kCNAME}, {"out.example.com", dns::RecordType::kA},
+            {"example.com", dns::RecordType::kMX}, {"example.com", dns::RecordType::kNS},
+            {"example.com", dns::RecordType::kANY}, {"srv.example.com", dns::RecordType::kSRV},
+            {"nx.example.com", dns::RecordType::kA}, {"www.example.com", dns::RecordType::kMX},
+            {"b.example.com", dns::RecordType::kA}, {"x.y.wild.example.com", dns::RecordType::kA},
+            {"wild.example.com", dns::RecordType::kA}, {"host.sub.example.com", dns::RecordType::kA},
+            {"sub.example.com", dns::RecordType::kNS}, {"example.org", dns::RecordType::kA},
+    };
+    auto compare = [&](const char *name, dns::RecordType type, size_t size) {
+        query.questions[0] = dns::QuestionSection(name, type);
+        TEST_ASSERT(query.encode(queryWire) == dns::BufferResult::NoError);
+        reader.answer(query, expected);
+        TEST_ASSERT(expected.encodeTruncated(expectedWire, size) == dns::BufferResult::NoError);
+        TEST_ASSERT(image.answer(queryWire.data(), queryWire.size(), out, size, outSize) == dns::BufferResult::NoError);
+        TEST_ASSERT(decoded.decode(out, outSize) == dns::BufferResult::NoError);
+        TEST_ASSERT(expected.decode(expectedWire.data(), expectedWire.size()) == dns::BufferResult::NoError);
+        TEST_ASSERT_EQUAL(expected.mId, decoded.mId);
+        TEST_ASSERT_EQUAL(expected.mQr, decoded.mQr);
+        TEST_ASSERT_EQUAL(expected.mAA, decoded.mAA);
+        TEST_ASSERT_EQUAL(expected.mTC, decoded.mTC);
+        TEST_ASSERT_EQUAL(expected.mRD, decoded.mRD);
+        TEST_ASSERT_EQUAL(expected.mRCode, decoded.mRCode);
+        TEST_ASSERT_EQUAL(name, decoded.questions[0].mName);
+        std::vector<dns::ResourceRecord> *sections[3][2] = {{&expected.answers, &decoded.answers},
+                                                            {&expected.authorities, &decoded.authorities},
+                                                            {&expected.additions, &decoded.additions}};
+        for (auto &section : sections) {
+            TEST_ASSERT_EQUAL(section[0]->size(), section[1]->size());
+            for (size_t i = 0; i < section[0]->size() && i < section[1]->size(); i++) {
+                auto &a = (*section[0])[i];
+                auto &b = (*section[1])[i];
+                TEST_ASSERT(a.getType() == b.getType());
+                TEST_ASSERT_EQUAL(a.mTtl, b.mTtl);
+                TEST_ASSERT(dns::QuestionKey(a.mName, a.mType) == dns::QuestionKey(b.mName, b.mType));
+                dns::RecordValue va, vb;
+                TEST_ASSERT(va.fromResourceRecord(a) == dns::BufferResult::NoError);
+                TEST_ASSERT(vb.fromResourceRecord(b) == dns::BufferResult::NoError);
+                TEST_ASSERT(va.mRData == vb.mRData);
+            }
+        }
+    };
+    for (auto &q : questions) {
+        compare(q.first, q.second, sizeof(out));
+    }
+    // truncated responses keep the same whole RRsets (for names which both compress alike)
+    for (size_t size = 34; size <= sizeof(out); size++) {
+        compare("mail.example.com", dns::RecordType::kANY, size);
+        compare("example.com", dns::RecordType::kMX, size);
+        compare("big.example.com", dns::RecordType::kANY, size);
+    }
+
+    // the owner of the answers links to the question, the truncated response keeps the question
+    query.questions[0] = dns::QuestionSection("www.example.com", dns::RecordType::kA);
+    TEST_ASSERT(query.encode(queryWire) == dns::BufferResult::NoError);
+    TEST_ASSERT(image.answer(queryWire.data(), queryWire.size(), out, sizeof(out), outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(0xC0, out[queryWire.size()]);
+    TEST_ASSERT_EQUAL(12, out[queryWire.size() + 1]);
+    TEST_ASSERT(image.answer(queryWire.data(), queryWire.size(), out, queryWire.size() + 20, outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(queryWire.size(), outSize);
+    TEST_ASSERT(decoded.decode(out, outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1, decoded.mTC);
+    TEST_ASSERT_EQUAL(0u, decoded.answers.size());
+    TEST_ASSERT(image.answer(queryWire.data(), queryWire.size(), out, 20, outSize) == dns::BufferResult::BufferOverflow);
+
+    // the image file is mapped
+    const char *path = "unittests_zoneimage.tmp";
+    TEST_ASSERT(dns::ZoneImage::compileFile(*zone, path) == dns::BufferResult::NoError);
+    dns::ZoneImage mapped;
+    TEST_ASSERT(mapped.open(path) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(image.nameCount(), mapped.nameCount());
+    TEST_ASSERT(mapped.answer(queryWire.data(), queryWire.size(), out, sizeof(out), outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT(decoded.decode(out, outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(2u, decoded.answers.size());
+    mapped.close();
+    remove(path);
+    TEST_ASSERT(dns::ZoneImage::compileFile(*zone, "unittests_zoneimage.missing/image") == dns::BufferResult::FileError);
+
+    // damaged images are rejected
+    bytes[8]++;
+    TEST_ASSERT(image.attach(bytes.data(), bytes.size()) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(!image.isOpen());
+    bytes[8]--;
+    TEST_ASSERT(image.attach(bytes.data(), bytes.size() - 1) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(mapped.open("unittests_zoneimage.missing") == dns::BufferResult::InvalidData);
+}
+
+static void testResponseCache() {
+    dns::Message m;
+    m.mId = 1;
+    m.mQr = 1;
+    m.mRD = 1;
+    m.questions.emplace_back("www.example.com", dns::RecordType::kA);
+    m.answers.push_back(makeA("www.example.com", "192.0.2.1"));
+    m.answers.push_back(makeA("www.example.com", "192.0.2.2"));
+    m.answers[1].mTtl = 60;
+    std::vector<uint8_t> response;
+    TEST_ASSERT(m.encode(response) == dns::BufferResult::NoError);
+
+    dns::Message q;
+    q.mId = 0x4321;
+    q.questions.emplace_back("WWW.Example.com", dns::RecordType::kA);
+    std::vector<uint8_t> query;
+    TEST_ASSERT(q.encode(query) == dns::BufferResult::NoError);
+
+    dns::ResponseCache cache(1 << 20, 4);
+    auto t0 = dns::ResponseCache::Clock::now();
+    uint8_t out[512];
+    size_t outSize;
+    TEST_ASSERT(!cache.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0));
+    TEST_ASSERT(cache.insert(response.data(), response.size(), t0) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(1u, cache.entryCount());
+    TEST_ASSERT(cache.memoryUsage() > response.size());
+
+    // the ID, RD and the case of the question come from the query, TTLs are decreased by the elapsed time
+    TEST_ASSERT(cache.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0 + std::chrono::seconds(10)));
+    TEST_ASSERT_EQUAL(response.size(), outSize);
+    dns::Message decoded;
+    TEST_ASSERT(decoded.decode(out, outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(0x4321, decoded.mId);
+    TEST_ASSERT_EQUAL(0, decoded.mRD);
+    TEST_ASSERT_EQUAL(1, decoded.mQr);
+    TEST_ASSERT_EQUAL("WWW.Example.com", decoded.questions[0].mName);
+    TEST_ASSERT_EQUAL(2u, decoded.answers.size());
+    TEST_ASSERT_EQUAL(290u, decoded.answers[0].mTtl);
+    TEST_ASSERT_EQUAL(50u, decoded.answers[1].mTtl);
+
+    // other type, too small buffer, expired with the smallest TTL
+    q.questions[0].mType = dns::RecordType::kAAAA;
+    std::vector<uint8_t> query2;
+    TEST_ASSERT(q.encode(query2) == dns::BufferResult::NoError);
+    TEST_ASSERT(!cache.lookup(query2.data(), query2.size(), out, sizeof(out), outSize, t0));
+    TEST_ASSERT(!cache.lookup(query.data(), query.size(), out, 20, outSize, t0));
+    TEST_ASSERT(!cache.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0 + std::chrono::seconds(60)));
+    TEST_ASSERT_EQUAL(0u, cache.entryCount());
+    TEST_ASSERT_EQUAL(0u, cache.memoryUsage());
+
+    // responses which can't be cached
+    m.mTC = 1;
+    TEST_ASSERT(m.encode(response) == dns::BufferResult::NoError);
+    TEST_ASSERT(cache.insert(response.data(), response.size(), t0) == dns::BufferResult::InvalidData);
+    m.mTC = 0;
+    m.answers[1].mTtl = 0;
+    TEST_ASSERT(m.encode(response) == dns::BufferResult::NoError);
+    TEST_ASSERT(cache.insert(response.data(), response.size(), t0) == dns::BufferResult::InvalidData);
+    TEST_ASSERT(cache.insert(query.data(), query.size(), t0) == dns::BufferResult::InvalidData);
+
+    // the memory bound evicts entries which have not been hit, a hit entry gets a second chance
+    m.answers[1].mTtl = 60;
+    dns::ResponseCache small(4096, 1);
+    std::vector<uint8_t> hot;
+    for (size_t i = 0; i < 20; i++) {
+        auto name = "host" + std::to_string(i) + ".example.com";
+        m.questions[0].mName = name;
+        m.answers[0].mName = m.answers[1].mName = name;
+        TEST_ASSERT(m.encode(response) == dns::BufferResult::NoError);
+        TEST_ASSERT(small.insert(response.data(), response.size(), t0) == dns::BufferResult::NoError);
+        TEST_ASSERT(small.memoryUsage() <= 4096);
+        if (i == 0) {
+            q.questions[0] = dns::QuestionSection(name, dns::RecordType::kA);
+            TEST_ASSERT(q.encode(hot) == dns::BufferResult::NoError);
+        }
+        TEST_ASSERT(small.lookup(hot.data(), hot.size(), out, sizeof(out), outSize, t0));
+    }
+    TEST_ASSERT(small.entryCount() < 20u);
+    cache.clear();
+    TEST_ASSERT_EQUAL(0u, cache.entryCount());
+
+    // negative responses are cached for the SOA TTL limited by MINIMUM
+    auto soa = std::make_shared<dns::RDataSOA>();
+    soa->mMName = "ns1.example.com";
+    soa->mRName = "admin.example.com";
+    soa->mMinimum = 60;
+    dns::Message nx;
+    nx.mQr = 1;
+    nx.mRCode = (uint16_t) dns::ResponseCode::kNXDOMAIN;
+    nx.questions.emplace_back("nx.example.com", dns::RecordType::kA);
+    TEST_ASSERT(nx.encode(response) == dns::BufferResult::NoError);
+    TEST_ASSERT(cache.insert(response.data(), response.size(), t0) == dns::BufferResult::InvalidData);
+    nx.authorities.push_back(makeRecord("example.com", 3600, soa));
+    TEST_ASSERT(nx.encode(response) == dns::BufferResult::NoError);
+    TEST_ASSERT(cache.insert(response.data(), response.size(), t0) == dns::BufferResult::NoError);
+    q.questions[0] = dns::QuestionSection("nx.example.com", dns::RecordType::kA);
+    TEST_ASSERT(q.encode(query) == dns::BufferResult::NoError);
+    TEST_ASSERT(cache.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0 + std::chrono::seconds(10)));
+    TEST_ASSERT(decoded.decode(out, outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(3, decoded.mRCode);
+    TEST_ASSERT_EQUAL(1u, decoded.authorities.size());
+    TEST_ASSERT_EQUAL(50u, decoded.authorities[0].mTtl);
+    TEST_ASSERT(!cache.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0 + std::chrono::seconds(60)));
+
+    // NODATA, keyed by the type
+    nx.mRCode = 0;
+    nx.questions[0].mType = dns::RecordType::kAAAA;
+    TEST_ASSERT(nx.encode(response) == dns::BufferResult::NoError);
+    TEST_ASSERT(cache.insert(response.data(), response.size(), t0) == dns::BufferResult::NoError);
+    TEST_ASSERT(!cache.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0));
+    q.questions[0].mType = dns::RecordType::kAAAA;
+    TEST_ASSERT(q.encode(query) == dns::BufferResult::NoError);
+    TEST_ASSERT(cache.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0));
+
+    // serve-stale: expired entries are answered with a short TTL and a refresh is asked for once per stale TTL
+    dns::ResponseCache stale(1 << 20);
+    stale.setServeStale(3600, 30);
+    m.questions[0].mName = m.answers[0].mName = m.answers[1].mName = "www.example.com";
+    TEST_ASSERT(m.encode(response) == dns::BufferResult::NoError);
+    TEST_ASSERT(stale.insert(response.data(), response.size(), t0) == dns::BufferResult::NoError);
+    q.questions[0] = dns::QuestionSection("www.example.com", dns::RecordType::kA);
+    TEST_ASSERT(q.encode(query) == dns::BufferResult::NoError);
+    bool refresh = true;
+    TEST_ASSERT(stale.lookup(query.data(), query.size(), out, sizeof(out), outSize, refresh, t0 + std::chrono::seconds(59)));
+    TEST_ASSERT(!refresh);
+    TEST_ASSERT(stale.lookup(query.data(), query.size(), out, sizeof(out), outSize, refresh, t0 + std::chrono::seconds(100)));
+    TEST_ASSERT(refresh);
+    TEST_ASSERT(decoded.decode(out, outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(30u, decoded.answers[0].mTtl);
+    TEST_ASSERT_EQUAL(30u, decoded.answers[1].mTtl);
+    TEST_ASSERT(stale.lookup(query.data(), query.size(), out, sizeof(out), outSize, refresh, t0 + std::chrono::seconds(110)));
+    TEST_ASSERT(!refresh);
+    TEST_ASSERT(stale.lookup(query.data(), query.size(), out, sizeof(out), outSize, refresh, t0 + std::chrono::seconds(130)));
+    TEST_ASSERT(refresh);
+    TEST_ASSERT(!stale.lookup(query.data(), query.size(), out, sizeof(out), outSize, refresh, t0 + std::chrono::seconds(60 + 3600)));
+    TEST_ASSERT_EQUAL(0u, stale.entryCount());
+
+    // one question asked with and without EDNS: the response with OPT only answers EDNS queries with the same DO bit,
+    // an unknown EDNS version is never answered from the cache and BADVERS isn't cached
+    dns::ResponseCache edns(1 << 20);
+    TEST_ASSERT(edns.insert(response.data(), response.size(), t0) == dns::BufferResult::NoError);
+    m.setEdns(1232)->mFlags = dns::RDataOPT::kFlagDO;
+    std::vector<uint8_t> ednsResponse;
+    TEST_ASSERT(m.encode(ednsResponse) == dns::BufferResult::NoError);
+    TEST_ASSERT(edns.insert(ednsResponse.data(), ednsResponse.size(), t0) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(2u, edns.entryCount());
+    TEST_ASSERT(edns.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0));
+    TEST_ASSERT(decoded.decode(out, outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT(decoded.getEdns() == nullptr);
+    q.setEdns(4096)->mFlags = dns::RDataOPT::kFlagDO;
+    TEST_ASSERT(q.encode(query) == dns::BufferResult::NoError);
+    TEST_ASSERT(edns.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0));
+    TEST_ASSERT(decoded.decode(out, outSize) == dns::BufferResult::NoError);
+    TEST_ASSERT(decoded.getEdns() != nullptr);
+    TEST_ASSERT(decoded.getEdns()->dnssecOk());
+    q.getEdns()->mFlags = 0;
+    TEST_ASSERT(q.encode(query) == dns::BufferResult::NoError);
+    TEST_ASSERT(!edns.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0));
+    q.getEdns()->mFlags = dns::RDataOPT::kFlagDO;
+    q.getEdns()->mVersion = 1;
+    TEST_ASSERT(q.encode(query) == dns::BufferResult::NoError);
+    TEST_ASSERT(!edns.lookup(query.data(), query.size(), out, sizeof(out), outSize, t0));
+    m.getEdns()->mExtendedRCode = 1;
+    TEST_ASSERT(m.encode(ednsResponse) == dns::BufferResult::NoError);
+    TEST_ASSERT(edns.insert(ednsResponse.data(), ednsResponse.size(), t0) == dns::BufferResult::InvalidData);
+}
+
+static void testStreamFramer() {
+    // 3 messages, with a prefix which must be kept, names are compressed relative to the start of each message
+    std::vector<uint8_t> stream = {0xAA};
+    for (uint16_t i = 0; i < 3; i++) {
+        dns::Message m;
+        m.mId = i;
+        m.questions.emplace_back("www" + std::to_string(i) + ".example.com", dns::RecordType::kA);
+        m.questions.emplace_back("example.com", dns::RecordType::kMX);
+        TEST_ASSERT(dns::StreamFramer::encode(m, stream) == dns::BufferResult::NoError);
+    }
+    TEST_ASSERT_EQUAL(0xAA, stream[0]);
+    uint8_t zero[1] = {};
+    TEST_ASSERT(dns::StreamFramer::append(zero, 0, stream) == dns::BufferResult::NoError); // empty message
+    std::vector<uint8_t> big(0x10000);
+    auto size = stream.size();
+    TEST_ASSERT(dns::StreamFramer::append(big.data(), big.size(), stream) == dns::BufferResult::BufferOverflow);
+    TEST_ASSERT_EQUAL(size, stream.size());
+
+    // the same messages for any chunk size
+    for (size_t chunk : {1, 2, 3, 7, 30, 1000}) {
+        dns::StreamFramer framer;
+        std::vector<std::pair<const uint8_t *, size_t>> found;
+        std::vector<uint16_t> ids;
+        for (size_t pos = 1; pos < stream.size(); pos += chunk) {
+            auto end = std::min(pos + chunk, stream.size());
+            framer.feed(stream.data() + pos, end - pos);
+            const uint8_t *message;
+            size_t messageSize;
+            while (framer.next(message, messageSize)) {
+                if (!messageSize) {
+                    ids.push_back(0xFFFF);
+                    continue;
+                }
+                dns::Message m;
+                TEST_ASSERT(m.decode(message, messageSize) == dns::BufferResult::NoError);
+                TEST_ASSERT_EQUAL(2u, m.questions.size());
+                TEST_ASSERT_EQUAL("www" + std::to_string(m.mId) + ".example.com", m.questions[0].mName);
+                ids.push_back(m.mId);
+                if (message >= stream.data() && message < stream.data() + stream.size()) {
+                    found.emplace_back(message, messageSize);
+                }
+            }
+        }
+        TEST_ASSERT_EQUAL(0u, framer.pendingSize());
+        TEST_ASSERT((ids == std::vector<uint16_t>{0, 1, 2, 0xFFFF}));
+        if (chunk == 1000) {
+            TEST_ASSERT_EQUAL(3u, found.size()); // all slices of the chunk, nothing copied
+        }
+    }
+
+    // the rest of a chunk is kept by the next feed, an incomplete message stays pending
+    dns::StreamFramer framer;
+    const uint8_t *message;
+    size_t messageSize;
+    framer.feed(stream.data() + 1, 10);
+    framer.feed(stream.data() + 11, stream.size() - 12);
+    TEST_ASSERT(framer.next(message, messageSize));
+    TEST_ASSERT(framer.next(message, messageSize));
+    TEST_ASSERT(framer.next(message, messageSize));
+    TEST_ASSERT(!framer.next(message, messageSize));
+    TEST_ASSERT_EQUAL(1u, framer.pendingSize());
+    framer.reset();
+    TEST_ASSERT_EQUAL(0u, framer.pendingSize());
+}
+
+static void testDecodeArena() {
+    // NAPTR response with long strings, and a query with an OPT record
+    char packet1[] = "\x14\x38\x85\x80\x00\x01\x00\x03\x00\x00\x00\x00\x05\x62\x72\x6e\x35\x36\x03\x69\x69\x74\x03\x69\x6d\x73\x00\x00\x23\x00\x01\xc0\x0c\x00\x23\x00\x01\x00\x00\x00\x3c\x00\x2e\x00\x32\x00\x33\x01\x73\x07\x53\x49\x50\x2b\x44\x32\x54\x00\x04\x5f\x73\x69\x70\x04\x5f\x74\x63\x70\x05\x69\x63\x73\x63\x66\x05\x62\x72\x6e\x35\x36\x03\x69\x69\x74\x03\x69\x6d\x73\x00\xc0\x4a\x00\x23\x00\x01\x00\x00\x00\x3c\x00\x2f\x00\x0a\x00\x0a\x01\x73\x07\x53\x49\x50\x2b\x44\x32\x53\x00\x04\x5f\x73\x69\x70\x05\x5f\x73\x63\x74\x70\x05\x69\x63\x73\x63\x66\x05\x62\x72\x6e\x35\x36\x03\x69\x69\x74\x03\x69\x6d\x73\x00\xc0\x85\x00\x23\x00\x01\x00\x00\x00\x3c\x00\x2e\x00\x32\x00\x32\x01\x73\x07\x53\x49\x50\x2b\x44\x32\x55\x00\x04\x5f\x73\x69\x70\x04\x5f\x75\x64\x70\x05\x69\x63\x73\x63\x66\x05\x62\x72\x6e\x35\x36\x03\x69\x69\x74\x03\x69\x6d\x73\x00";
+    auto packet2 = hex2bin("00 01 01 00 00 01 00 00 00 00 00 01 07 65 78 61 6d 70 6c 65 03 63 6f 6d 00 00 01 00 01"
+                           "00 00 29 10 00 00 00 80 00 00 0c 00 0a 00 08 01 02 03 04 05 06 07 08");
+
+    dns::Arena arena;
+    dns::Message m;
+    for (int round = 0; round < 3; round++) {
+        auto allocCountStart = allocCount;
+        TEST_ASSERT(m.decode((const uint8_t *) packet1, sizeof(packet1) - 1, arena) == dns::BufferResult::NoError);
+        TEST_ASSERT(m.decode(packet2.data(), packet2.size(), arena) == dns::BufferResult::NoError);
+        if (round == 2) {
+            TEST_ASSERT_EQUAL(0u, allocCount - allocCountStart);
+        }
+    }
+    TEST_ASSERT_EQUAL(1u, m.questions.size());
+    TEST_ASSERT(m.answers.empty());
+    TEST_ASSERT_EQUAL(1u, m.additions.size());
+    TEST_ASSERT_EQUAL("example.com", m.questions[0].mName);
+
+    TEST_ASSERT(m.decode((const uint8_t *) packet1, sizeof(packet1) - 1, arena) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(3u, m.answers.size());
+    TEST_ASSERT(m.additions.empty());
+    auto naptr = m.answers[2].getRData<dns::RDataNAPTR>();
+    TEST_ASSERT_EQUAL("_sip._udp.icscf.brn56.iit.ims", naptr->mReplacement);
+    TEST_ASSERT_EQUAL("SIP+D2U", naptr->mServices);
+
+    // RData which is still referenced is not reused
+    auto naptr2 = m.answers[0].getRData<dns::RDataNAPTR>();
+    TEST_ASSERT(m.decode(packet2.data(), packet2.size(), arena) == dns::BufferResult::NoError);
+    TEST_ASSERT(m.decode((const uint8_t *) packet1, sizeof(packet1) - 1) == dns::BufferResult::NoError);
+    TEST_ASSERT(naptr2 != m.answers[0].getRData<dns::RDataNAPTR>());
+    TEST_ASSERT_EQUAL("SIP+D2T", naptr2->mServices);
+
+    // arena hands out freed chunks again
+    dns::Arena arena2(1024);
+    auto p1 = arena2.allocate(100);
+    arena2.deallocate(p1, 100);
+    TEST_ASSERT(arena2.allocate(112) == p1);
+    auto p2 = arena2.allocate(2000);
+    TEST_ASSERT_EQUAL(1u, arena2.blockCount());
+    arena2.deallocate(p2, 2000);
+}
+
+static void testRecordValue() {
+    TEST_ASSERT_EQUAL(32u, sizeof(dns::RDataValue));
+
+    uint8_t ip4[4] = {1, 2, 3, 4};
+    auto a = dns::RecordValue("a.example.com", dns::RecordType::kA, 60, dns::RDataValue::fromA(ip4));
+    auto mx = dns::RecordValue("example.com", dns::RecordType::kMX, 60, dns::RDataValue::fromMX(10, "mx.example.com"));
+    auto srv = dns::RecordValue("_sip._udp.example.com", dns::RecordType::kSRV, 60, dns::RDataValue::fromSRV(1, 2, 5060, "sip.example.com"));
+    TEST_ASSERT(a.mRData.isInline());
+    TEST_ASSERT(mx.mRData.isInline());
+    TEST_ASSERT(srv.mRData.isInline());
+    TEST_ASSERT_EQUAL(10, mx.mRData.readUint16(0));
+    TEST_ASSERT_EQUAL("mx.example.com", mx.mRData.readName(2));
+    TEST_ASSERT_EQUAL(5060, srv.mRData.readUint16(4));
+    TEST_ASSERT_EQUAL("sip.example.com", srv.mRData.readName(6));
+
+    // values stay valid when the container grows (there is no back-pointer)
+    std::vector<dns::RecordValue> records;
+    for (int i = 0; i < 100; i++) {
+        records.push_back(i % 2 ? a : mx);
+    }
+    TEST_ASSERT_EQUAL("A a.example.com IN 60 addr=1.2.3.4", records[99].toDebugString());
+    TEST_ASSERT_EQUAL("MX example.com IN 60 preference=10 exchange=mx.example.com", records[0].toDebugString());
+
+    // long RDATA goes to heap, copies and moves keep the content
+    auto soa = std::make_shared<dns::RDataSOA>();
+    soa->mMName = "ns1.long-zone-name.example.com";
+    soa->mRName = "hostmaster.long-zone-name.example.com";
+    soa->mSerial = 2022010101;
+    soa->mMinimum = 300;
+    dns::ResourceRecord rr;
+    rr.mName = "long-zone-name.example.com";
+    rr.mClass = dns::RecordClass::kIN;
+    rr.mTtl = 3600;
+    rr.setRData(soa);
+    dns::RecordValue soaValue;
+    TEST_ASSERT(soaValue.fromResourceRecord(rr) == dns::BufferResult::NoError);
+    TEST_ASSERT(!soaValue.mRData.isInline());
+    auto soaCopy = soaValue;
+    auto soaMoved = std::move(soaValue);
+    TEST_ASSERT(soaCopy.mRData == soaMoved.mRData);
+    TEST_ASSERT_EQUAL(rr.toDebugString(), soaMoved.toDebugString());
+    TEST_ASSERT_EQUAL(300u, soaCopy.mRData.readUint32(soaCopy.mRData.size() - 4));
+
+    // the scratch buffer of the conversion only grows to the size of the record
+    std::vector<uint8_t> scratch;
+    dns::RecordValue soaValue2;
+    TEST_ASSERT(soaValue2.fromResourceRecord(rr, scratch) == dns::BufferResult::NoError);
+    TEST_ASSERT(scratch.size() <= 512u);
+    TEST_ASSERT(soaValue2.mRData == soaCopy.mRData);
+    dns::ResourceRecord rr2;
+    TEST_ASSERT(soaValue2.toResourceRecord(rr2, scratch) == dns::BufferResult::NoError);
+    TEST_ASSERT_EQUAL(rr.toDebugString(), rr2.toDebugString());
+
+    // decoding expands links in RDATA, encoding compresses names again
+    auto s = R"(
+56 d0 81 80 00 01 00 02 00 00 00 00 03 77 77 77
+07 65 78 61 6d 70 6c 65 03 63 6f 6d 00 00 0f 00
+01 c0 0c 00 0f 00 01 00 00 00 3c 00 07 00 0a 02
+6d 78 c0 10 c0 0c 00 05 00 01 00 00 00 3c 00 02
+c0 2f
+)";
+    auto buf = hex2bin(s);
+    dns::Buffer buff(buf.data(), buf.size());
+    buff.seek(33);
+    dns::RecordValue r1, r2;
+    r1.decode(buff);
+    r2.decode(buff);
+    TEST_ASSERT(!buff.isBroken());
+    TEST_ASSERT_EQUAL(buf.size(), buff.pos());
+    TEST_ASSERT_EQUAL("mx.example.com", r1.mRData.readName(2));
+    TEST_ASSERT_EQUAL("mx.example.com", r2.mRData.readName(0));
+
+    std::vector<uint8_t> out(buf.size());
+    dns::Buffer buffOut(out.data(), out.size());
+    buffOut.writeBytes(buf.data(), 12);
+    dns::QuestionSection("www.example.com", dns::RecordType::kMX).encode(buffOut);
+    r1.encode(buffOut);
+    r2.encode(buffOut);
+    TEST_ASSERT(!buffOut.isBroken());
+    TEST_ASSERT(out == buf);
 }
 
 #define TEST(f) do { std::cout << "Run: "  << #f << std::endl; f(); } while(0)
@@ -456,6 +1931,8 @@ int main() {
     TEST(testBufferEmptyDomainName);
     TEST(testBufferDomainName);
     TEST(testBufferDotEndedDomainName);
+    TEST(testBufferDomainNameCompression);
+    TEST(testBufferDomainNameCache);
     TEST(testBufferCharacterString);
     TEST(testCNAME_MB_MD_MF_MG_MR_NS_PTR);
     TEST(testHINFO);
@@ -471,8 +1948,24 @@ int main() {
     TEST(testSRV);
     TEST(testPacket);
     TEST(testPacketInvalid);
+    TEST(testDecodeLimits);
     TEST(testCreatePacket);
     TEST(testNameCompression);
+    TEST(testEncodeGrowable);
+    TEST(testEncodeTruncated);
+    TEST(testEdns);
+    TEST(testMessageWriter);
+    TEST(testMessageView);
+    TEST(testMessageReader);
+    TEST(testQuestionKey);
+    TEST(testResponseTemplate);
+    TEST(testZoneStore);
+    TEST(testZoneFileParser);
+    TEST(testZoneImage);
+    TEST(testResponseCache);
+    TEST(testStreamFramer);
+    TEST(testDecodeArena);
+    TEST(testRecordValue);
 
     std::cout << "====" << std::endl;
     std::cout << "PASS: " << assertPass << ", FAIL: " << assertFail << std::endl;
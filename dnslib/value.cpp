@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "value.h"
+
+using namespace dns;
+
+const size_t RDataValue::kInlineSize;
+
+// RDATA layout of the types which contain names or must have a fixed size:
+//   '2' / '4': 16/32 bit integer, 'S': <character-string>, 'N': compressible <domain-name>, 'n': uncompressed <domain-name>
+// other types are stored as opaque bytes
+static const char *rdataLayout(RecordType type) {
+    switch (type) {
+        case RecordType::kA:
+            return "4";
+        case RecordType::kAAAA:
+            return "4444";
+        case RecordType::kNS:
+        case RecordType::kCNAME:
+        case RecordType::kPTR:
+        case RecordType::kMB:
+        case RecordType::kMD:
+        case RecordType::kMF:
+        case RecordType::kMG:
+        case RecordType::kMR:
+            return "N";
+        case RecordType::kMINFO:
+            return "NN";
+        case RecordType::kMX:
+            return "2N";
+        case RecordType::SOA:
+            return "NN44444";
+        case RecordType::kSRV:
+            return "222N";
+        case RecordType::kNAPTR:
+            return "22SSSn";
+        default:
+            return "";
+    }
+}
+
+/////////// RDataValue ///////////
+
+RDataValue &RDataValue::operator=(const RDataValue &other) {
+    if (this != &other) {
+        assign(other.data(), other.size());
+    }
+    return *this;
+}
+
+RDataValue &RDataValue::operator=(RDataValue &&other) noexcept {
+    if (this != &other) {
+        release();
+        moveFrom(other);
+    }
+    return *this;
+}
+
+void RDataValue::assign(const uint8_t *data, size_t size) {
+    mSize = 0;
+    auto p = reserve(size);
+    if (size) {
+        memmove(p, data, size);
+    }
+    mSize = size;
+}
+
+bool RDataValue::operator==(const RDataValue &other) const {
+    return mSize == other.mSize && (mSize == 0 || memcmp(data(), other.data(), mSize) == 0);
+}
+
+uint8_t *RDataValue::reserve(size_t size) {
+    if (mSize + size > mCapacity) {
+        size_t capacity = mCapacity * 2;
+        if (capacity < mSize + size) {
+            capacity = mSize + size;
+        }
+        auto heapData = new uint8_t[capacity];
+        if (mSize) {
+            memcpy(heapData, data(), mSize);
+        }
+        release();
+        mStorage.heapData = heapData;
+        mCapacity = capacity;
+    }
+    return (isInline() ? mStorage.inlineData : mStorage.heapData) + mSize;
+}
+
+void RDataValue::release() {
+    if (!isInline()) {
+        delete[] mStorage.heapData;
+        mCapacity = kInlineSize;
+    }
+}
+
+void RDataValue::moveFrom(RDataValue &other) {
+    mSize = other.mSize;
+    mCapacity = other.mCapacity;
+    if (other.isInline()) {
+        memcpy(mStorage.inlineData, other.mStorage.inlineData, other.mSize);
+    } else {
+        mStorage.heapData = other.mStorage.heapData;
+        other.mCapacity = kInlineSize;
+    }
+    other.mSize = 0;
+}
+
+void RDataValue::decode(Buffer &buffer, RecordType type, size_t dataLen) {
+    mSize = 0;
+    auto layout = rdataLayout(type);
+    if (!*layout) {
+        auto p = buffer.readBytes(dataLen);
+        if (p) {
+            assign(p, dataLen);
+        }
+        return;
+    }
+
+    auto expectedEndPos = buffer.pos() + dataLen;
+    for (; *layout && !buffer.isBroken(); layout++) {
+        switch (*layout) {
+            case '2':
+            case '4': {
+                size_t len = *layout - '0';
+                auto p = buffer.readBytes(len);
+                if (p) {
+                    memcpy(reserve(len), p, len);
+                    mSize += len;
+                }
+                break;
+            }
+            case 'S': {
+                auto len = buffer.readUint8();
+                auto p = buffer.readBytes(len);
+                if (p) {
+                    auto out = reserve(len + 1);
+                    out[0] = len;
+                    memcpy(out + 1, p, len);
+                    mSize += len + 1;
+                }
+                break;
+            }
+            default: {
+                uint8_t name[kMaxDomainLen + 2];
+                auto len = buffer.readDomainNameWire(name, *layout == 'N');
+                if (len) {
+                    memcpy(reserve(len), name, len);
+                    mSize += len;
+                }
+                break;
+            }
+        }
+    }
+    if (buffer.pos() != expectedEndPos) {
+        buffer.markBroken(BufferResult::InvalidData);
+    }
+}
+
+void RDataValue::encode(Buffer &buffer, RecordType type) const {
+    encode(buffer, type, data(), mSize);
+}
+
+void RDataValue::encode(Buffer &buffer, RecordType type, const uint8_t *p, size_t size) {
+    auto layout = rdataLayout(type);
+    if (!*layout) {
+        buffer.writeBytes(p, size);
+        return;
+    }
+
+    size_t offset = 0;
+    for (; *layout; layout++) {
+        size_t len;
+        if (*layout == '2' || *layout == '4') {
+            len = *layout - '0';
+        } else if (*layout == 'S') {
+            len = offset < size ? p[offset] + 1 : 1;
+        } else {
+            len = 0;
+            while (offset + len < size && p[offset + len]) {
+                len += p[offset + len] + 1;
+            }
+            len++;
+        }
+        if (offset + len > size) {
+            buffer.markBroken(BufferResult::InvalidData);
+            return;
+        }
+        if (*layout == 'N' || *layout == 'n') {
+            buffer.writeDomainNameWire(p + offset, len, *layout == 'N');
+        } else {
+            buffer.writeBytes(p + offset, len);
+        }
+        offset += len;
+    }
+    if (offset != size) {
+        buffer.markBroken(BufferResult::InvalidData);
+    }
+}
+
+RDataValue RDataValue::fromA(const uint8_t *addr) {
+    return RDataValue(addr, 4);
+}
+
+RDataValue RDataValue::fromAAAA(const uint8_t *addr) {
+    return RDataValue(addr, 16);
+}
+
+RDataValue RDataValue::fromName(const std::string &name) {
+    uint8_t wire[kMaxDomainLen + 2];
+    size_t wireLen;
+    Buffer::toWireDomainName(name, wire, wireLen);
+    return RDataValue(wire, wireLen);
+}
+
+RDataValue RDataValue::fromMX(uint16_t preference, const std::string &exchange) {
+    uint8_t wire[2 + kMaxDomainLen + 2];
+    size_t wireLen;
+    wire[0] = preference >> 8;
+    wire[1] = preference & 0xFF;
+    Buffer::toWireDomainName(exchange, wire + 2, wireLen);
+    return RDataValue(wire, wireLen ? 2 + wireLen : 0);
+}
+
+RDataValue RDataValue::fromSRV(uint16_t priority, uint16_t weight, uint16_t port, const std::string &target) {
+    uint8_t wire[6 + kMaxDomainLen + 2];
+    size_t wireLen;
+    uint16_t fields[3] = {priority, weight, port};
+    for (size_t i = 0; i < 3; i++) {
+        wire[i * 2] = fields[i] >> 8;
+        wire[i * 2 + 1] = fields[i] & 0xFF;
+    }
+    Buffer::toWireDomainName(target, wire + 6, wireLen);
+    return RDataValue(wire, wireLen ? 6 + wireLen : 0);
+}
+
+uint16_t RDataValue::readUint16(size_t offset) const {
+    if (offset + 2 > mSize) return 0;
+    auto p = data() + offset;
+    return (((uint16_t) p[0]) << 8) + p[1];
+}
+
+uint32_t RDataValue::readUint32(size_t offset) const {
+    if (offset + 4 > mSize) return 0;
+    auto p = data() + offset;
+    return (((uint32_t) p[0]) << 24) + (((uint32_t) p[1]) << 16) + (((uint32_t) p[2]) << 8) + p[3];
+}
+
+std::string RDataValue::readName(size_t offset) const {
+    std::string name;
+    auto p = data();
+    while (offset < mSize && p[offset] && offset + p[offset] < mSize) {
+        if (!name.empty()) {
+            name.push_back('.');
+        }
+        name.append((const char *) p + offset + 1, p[offset]);
+        offset += p[offset] + 1;
+    }
+    return name;
+}
+
+/////////// RecordValue ///////////
+
+void RecordValue::decode(Buffer &buffer) {
+    buffer.readDomainName(mName);
+    mType = (RecordType) buffer.readUint16();
+    mClass = (RecordClass) buffer.readUint16();
+    mTtl = buffer.readUint32();
+    auto dataLen = buffer.readUint16();
+    mRData.decode(buffer, mType, dataLen);
+}
+
+void RecordValue::encode(Buffer &buffer) const {
+    buffer.writeDomainName(mName);
+    buffer.writeUint16((uint16_t) mType);
+    buffer.writeUint16((uint16_t) mClass);
+    buffer.writeUint32(mTtl);
+    size_t bufferPosRDataLength = buffer.pos();
+    buffer.writeUint16(0); // this value will be overwritten
+    mRData.encode(buffer, mType);
+    auto dataLen = buffer.pos() - bufferPosRDataLength - 2;
+    size_t bufferLastPos = buffer.pos();
+    buffer.seek(bufferPosRDataLength);
+    buffer.writeUint16(dataLen);
+    buffer.seek(bufferLastPos);
+}
+
+// a record encoded alone takes at most this many bytes (the header, the owner and 64 KB of RDATA)
+static const size_t kMaxRecordSize = kMaxDomainLen + 12 + 0xFFFF;
+
+BufferResult RecordValue::fromResourceRecord(ResourceRecord &rr, std::vector<uint8_t> &scratch) {
+    // encode the record alone, links in RDATA (if any) only refer to the RDATA itself and are expanded by decode
+    Buffer buff(scratch);
+    rr.encode(buff);
+    if (buff.isBroken()) {
+        return buff.result();
+    }
+    auto size = buff.pos();
+    if (size > kMaxRecordSize) {
+        return BufferResult::BufferOverflow;
+    }
+    Buffer buff2(scratch.data(), size);
+    decode(buff2);
+    return buff2.result();
+}
+
+BufferResult RecordValue::toResourceRecord(ResourceRecord &rr, std::vector<uint8_t> &scratch) const {
+    Buffer buff(scratch);
+    encode(buff);
+    if (buff.isBroken()) {
+        return buff.result();
+    }
+    auto size = buff.pos();
+    if (size > kMaxRecordSize) {
+        return BufferResult::BufferOverflow;
+    }
+    Buffer buff2(scratch.data(), size);
+    rr.decode(buff2);
+    return buff2.result();
+}
+
+BufferResult RecordValue::fromResourceRecord(ResourceRecord &rr) {
+    static thread_local std::vector<uint8_t> scratch;
+    return fromResourceRecord(rr, scratch);
+}
+
+BufferResult RecordValue::toResourceRecord(ResourceRecord &rr) const {
+    static thread_local std::vector<uint8_t> scratch;
+    return toResourceRecord(rr, scratch);
+}
+
+std::string RecordValue::toDebugString() const {
+    ResourceRecord rr;
+    if (toResourceRecord(rr) != BufferResult::NoError) {
+        return toString(mType) + " " + mName + " (invalid)";
+    }
+    return rr.toDebugString();
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_VALUE_H
+#define _DNS_VALUE_H
+
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "buffer.h"
+#include "rr.h"
+
+namespace dns {
+
+/**
+ * RDATA stored by value in uncompressed wire form.
+ *
+ * Unlike the RData class hierarchy, there is no virtual dispatch, no reference counting and no back-pointer
+ * to the owner record, so values can be copied, moved and stored in containers freely.
+ * Small RDATA (A, AAAA, MX and SRV with short names, etc) is stored inline without heap allocation.
+ *
+ * Names inside RDATA are kept uncompressed, they are compressed again when the record is encoded
+ * (for the types which allow compression, same as the RData classes).
+ */
+class RDataValue {
+public:
+    static const size_t kInlineSize = 24;
+
+    RDataValue() = default;
+    RDataValue(const uint8_t *data, size_t size) { assign(data, size); }
+    RDataValue(const RDataValue &other) { assign(other.data(), other.size()); }
+    RDataValue(RDataValue &&other) noexcept { moveFrom(other); }
+    RDataValue &operator=(const RDataValue &other);
+    RDataValue &operator=(RDataValue &&other) noexcept;
+    ~RDataValue() { release(); }
+
+    inline const uint8_t *data() const { return isInline() ? mStorage.inlineData : mStorage.heapData; }
+    inline size_t size() const { return mSize; }
+    inline bool empty() const { return mSize == 0; }
+    inline bool isInline() const { return mCapacity == kInlineSize; }
+
+    void assign(const uint8_t *data, size_t size);
+    void clear() { mSize = 0; }
+
+    bool operator==(const RDataValue &other) const;
+    bool operator!=(const RDataValue &other) const { return !(*this == other); }
+
+    // decode RDATA of the given type from buffer (names are expanded), or encode it (names are compressed)
+    void decode(Buffer &buffer, RecordType type, size_t dataLen);
+    void encode(Buffer &buffer, RecordType type) const;
+    static void encode(Buffer &buffer, RecordType type, const uint8_t *data, size_t size); // RDATA stored elsewhere
+
+    // build RDATA of the common types
+    static RDataValue fromA(const uint8_t *addr);
+    static RDataValue fromAAAA(const uint8_t *addr);
+    static RDataValue fromName(const std::string &name); // NS, CNAME, PTR, MB, MD, MF, MG, MR
+    static RDataValue fromMX(uint16_t preference, const std::string &exchange);
+    static RDataValue fromSRV(uint16_t priority, uint16_t weight, uint16_t port, const std::string &target);
+
+    // read fields at the given offset, eg: A address is data(), MX preference is readUint16(0) and exchange is readName(2)
+    uint16_t readUint16(size_t offset) const;
+    uint32_t readUint32(size_t offset) const;
+    std::string readName(size_t offset) const;
+
+private:
+    uint8_t *reserve(size_t size); // makes room for size bytes at the end, returns where to write them
+    void release();
+    void moveFrom(RDataValue &other);
+
+    uint32_t mSize = 0;
+    uint32_t mCapacity = kInlineSize;
+    union {
+        uint8_t inlineData[kInlineSize];
+        uint8_t *heapData;
+    } mStorage;
+};
+
+/**
+ * Resource record stored by value, the value-semantic alternative of ResourceRecord.
+ */
+class RecordValue {
+public:
+    std::string mName;
+    RecordType mType = RecordType::kNone;
+    RecordClass mClass = RecordClass::kIN;
+    uint32_t mTtl = 0;
+    RDataValue mRData;
+
+    RecordValue() = default;
+    RecordValue(std::string name, RecordType type, uint32_t ttl, RDataValue rData, RecordClass cls = RecordClass::kIN) :
+            mName(std::move(name)), mType(type), mClass(cls), mTtl(ttl), mRData(std::move(rData)) {}
+
+    void decode(Buffer &buffer);
+    void encode(Buffer &buffer) const;
+
+    // convert from/to the RData class hierarchy, by encoding the record alone and decoding it again
+    BufferResult fromResourceRecord(ResourceRecord &rr);
+    BufferResult toResourceRecord(ResourceRecord &rr) const;
+    // same, scratch is the growable buffer of the encoding, it can be reused for many records
+    BufferResult fromResourceRecord(ResourceRecord &rr, std::vector<uint8_t> &scratch);
+    BufferResult toResourceRecord(ResourceRecord &rr, std::vector<uint8_t> &scratch) const;
+
+    std::string toDebugString() const;
+};
+
+} // namespace
+#endif /* _DNS_VALUE_H */
@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include <cstring>
+#include <typeinfo>
+
+#include "view.h"
+
+using namespace dns;
+
+static inline uint16_t readUint16(const uint8_t *p) {
+    return (((uint16_t) p[0]) << 8) + p[1];
+}
+
+static inline uint32_t readUint32(const uint8_t *p) {
+    return (((uint32_t) p[0]) << 24) + (((uint32_t) p[1]) << 16) + (((uint32_t) p[2]) << 8) + p[3];
+}
+
+static inline uint8_t toLower(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// walk the labels of the name at offset and follow links, onLabel gets every label with its length byte
+// and may return false to stop the walk
+template<typename F>
+static BufferResult walkName(const uint8_t *msg, size_t msgSize, size_t offset, F onLabel) {
+    size_t nameLen = 0; // length of the name in wire form without the terminating zero
+    size_t links = 0;
+    while (true) {
+        if (offset >= msgSize) {
+            return BufferResult::BufferOverflow;
+        }
+        auto ctrlCode = msg[offset];
+        if (ctrlCode == 0) {
+            return BufferResult::NoError;
+        }
+        if (ctrlCode >> 6 == 3) {
+            if (offset + 1 >= msgSize) {
+                return BufferResult::BufferOverflow;
+            }
+            // every link except the last one has to be followed by a label, so a valid name never has more
+            if (++links > kMaxDomainLen / 2 + 1) {
+                return BufferResult::LabelCompressionLoop;
+            }
+            offset = ((ctrlCode & 63) << 8) + msg[offset + 1];
+            continue;
+        }
+        if (ctrlCode > kMaxLabelLen) {
+            return BufferResult::LabelTooLong;
+        }
+        if (offset + 1 + ctrlCode > msgSize) {
+            return BufferResult::BufferOverflow;
+        }
+        nameLen += ctrlCode + 1;
+        if (nameLen > kMaxDomainLen + 1) {
+            return BufferResult::DomainTooLong;
+        }
+        if (!onLabel(msg + offset)) {
+            return BufferResult::NoError;
+        }
+        offset += ctrlCode + 1;
+    }
+}
+
+// skip the name field at offset without following links
+static BufferResult skipName(const uint8_t *msg, size_t msgSize, size_t offset, size_t &end) {
+    while (true) {
+        if (offset >= msgSize) {
+            return BufferResult::BufferOverflow;
+        }
+        auto ctrlCode = msg[offset];
+        if (ctrlCode == 0) {
+            end = offset + 1;
+            return BufferResult::NoError;
+        }
+        if (ctrlCode >> 6 == 3) {
+            end = offset + 2;
+            return end > msgSize ? BufferResult::BufferOverflow : BufferResult::NoError;
+        }
+        if (ctrlCode > kMaxLabelLen) {
+            return BufferResult::LabelTooLong;
+        }
+        offset += ctrlCode + 1;
+    }
+}
+
+/////////// NameView ///////////
+
+BufferResult NameView::toString(std::string &out) const {
+    out.clear();
+    auto result = walkName(mMsg, mMsgSize, mOffset, [&out](const uint8_t *label) {
+        if (!out.empty()) {
+            out.push_back('.');
+        }
+        out.append((const char *) label + 1, label[0]);
+        return true;
+    });
+    return result;
+}
+
+std::string NameView::toString() const {
+    std::string out;
+    toString(out);
+    return out;
+}
+
+size_t NameView::toWire(uint8_t *out, size_t outSize, bool lowercase) const {
+    size_t len = 0;
+    bool overflow = false;
+    auto result = walkName(mMsg, mMsgSize, mOffset, [&](const uint8_t *label) {
+        size_t labelSize = label[0] + 1;
+        if (len + labelSize >= outSize) {
+            overflow = true;
+            return false;
+        }
+        if (lowercase) {
+            out[len] = label[0];
+            for (size_t i = 1; i < labelSize; i++) {
+                out[len + i] = toLower(label[i]);
+            }
+        } else {
+            memcpy(out + len, label, labelSize);
+        }
+        len += labelSize;
+        return true;
+    });
+    if (result != BufferResult::NoError || overflow || len >= outSize) {
+        return 0;
+    }
+    out[len++] = 0;
+    return len;
+}
+
+bool NameView::equals(const std::string &name) const {
+    size_t nameLen = name.length();
+    if (nameLen && name[nameLen - 1] == '.') {
+        nameLen--; // the trailing dot is the root label
+    }
+
+    size_t p = 0;
+    bool matched = true;
+    auto result = walkName(mMsg, mMsgSize, mOffset, [&](const uint8_t *label) {
+        if (p) {
+            if (p >= nameLen || name[p] != '.') {
+                matched = false;
+                return false;
+            }
+            p++;
+        }
+        if (p + label[0] > nameLen) {
+            matched = false;
+            return false;
+        }
+        for (size_t i = 0; i < label[0]; i++) {
+            if (toLower(label[i + 1]) != toLower(name[p + i])) {
+                matched = false;
+                return false;
+            }
+        }
+        p += label[0];
+        return true;
+    });
+    return result == BufferResult::NoError && matched && p == nameLen;
+}
+
+bool NameView::equals(const NameView &other) const {
+    uint8_t wire1[kMaxDomainLen + 2], wire2[kMaxDomainLen + 2];
+    auto len1 = toWire(wire1, sizeof(wire1), true);
+    auto len2 = other.toWire(wire2, sizeof(wire2), true);
+    return len1 && len1 == len2 && memcmp(wire1, wire2, len1) == 0;
+}
+
+/////////// QuestionView ///////////
+
+BufferResult QuestionView::parse(const uint8_t *msg, size_t msgSize, size_t offset, size_t &end) {
+    auto result = skipName(msg, msgSize, offset, end);
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+    if (end + 4 > msgSize) {
+        return BufferResult::BufferOverflow;
+    }
+    mName = NameView(msg, msgSize, offset);
+    mType = (RecordType) readUint16(msg + end);
+    mClass = (RecordClass) readUint16(msg + end + 2);
+    end += 4;
+    return BufferResult::NoError;
+}
+
+/////////// RecordView ///////////
+
+BufferResult RecordView::parse(const uint8_t *msg, size_t msgSize, size_t offset, size_t &end) {
+    auto result = skipName(msg, msgSize, offset, end);
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+    if (end + 10 > msgSize) {
+        return BufferResult::BufferOverflow;
+    }
+    auto p = msg + end;
+    mName = NameView(msg, msgSize, offset);
+    mType = (RecordType) readUint16(p);
+    mClass = (RecordClass) readUint16(p + 2);
+    mTtl = readUint32(p + 4);
+    mRDataSize = readUint16(p + 8);
+    mRData = p + 10;
+    end += 10 + mRDataSize;
+    if (end > msgSize) {
+        return BufferResult::BufferOverflow;
+    }
+    mMsg = msg;
+    mMsgSize = msgSize;
+    mOffset = offset;
+    return BufferResult::NoError;
+}
+
+BufferResult RecordView::decode(ResourceRecord &rr) const {
+    Buffer buff((uint8_t *) mMsg, mMsgSize);
+    buff.seek(mOffset);
+    rr.decode(buff);
+    return buff.result();
+}
+
+// decode the RDATA of rr at start of the message in buff
+static BufferResult decodeRDataAt(Buffer &buff, size_t start, const RecordView &rr, RData &rdata) {
+    if (typeid(rdata) == typeid(RDataUnknown)) {
+        static_cast<RDataUnknown &>(rdata).mType = rr.mType; // it takes any type
+    } else if (rdata.getType() != rr.mType) {
+        return BufferResult::InvalidData;
+    }
+    buff.seek(start);
+    rdata.decode(buff, rr.mRDataSize);
+    if (!buff.isBroken() && buff.pos() != start + rr.mRDataSize) {
+        return BufferResult::InvalidData;
+    }
+    if (typeid(rdata) == typeid(RDataOPT)) {
+        static_cast<RDataOPT &>(rdata).unpack((uint16_t) rr.mClass, rr.mTtl);
+    }
+    return buff.result();
+}
+
+BufferResult RecordView::decodeRData(RData &rdata) const {
+    Buffer buff((uint8_t *) mMsg, mMsgSize);
+    return decodeRDataAt(buff, mRData - mMsg, *this, rdata);
+}
+
+/////////// QuestionKey ///////////
+
+const size_t QuestionKey::kMaxSize;
+
+BufferResult QuestionKey::assign(const std::string &name, RecordType type, RecordClass cls) {
+    size_t len;
+    auto result = Buffer::toWireDomainName(name, mData, len);
+    if (result != BufferResult::NoError) {
+        mSize = 0;
+        return result;
+    }
+    for (size_t i = 0; i < len; i++) {
+        mData[i] = toLower(mData[i]); // length bytes are never in 'A'..'Z' (max label length is 63)
+    }
+    mData[len] = (uint16_t) type >> 8;
+    mData[len + 1] = (uint16_t) type & 0xFF;
+    mData[len + 2] = (uint16_t) cls >> 8;
+    mData[len + 3] = (uint16_t) cls & 0xFF;
+    mSize = len + 4;
+    return BufferResult::NoError;
+}
+
+BufferResult QuestionKey::parse(const uint8_t *msg, size_t msgSize, size_t offset, size_t &end) {
+    mSize = 0;
+    size_t len = 0;
+    while (true) {
+        if (offset >= msgSize) {
+            return BufferResult::BufferOverflow;
+        }
+        auto ctrlCode = msg[offset];
+        if (ctrlCode == 0) {
+            break;
+        }
+        if (ctrlCode > kMaxLabelLen) {
+            return ctrlCode >> 6 == 3 ? BufferResult::InvalidData : BufferResult::LabelTooLong;
+        }
+        if (offset + 1 + ctrlCode > msgSize) {
+            return BufferResult::BufferOverflow;
+        }
+        if (len + ctrlCode + 1 > kMaxDomainLen) {
+            return BufferResult::DomainTooLong;
+        }
+        mData[len++] = ctrlCode;
+        for (size_t i = 1; i <= ctrlCode; i++) {
+            mData[len++] = toLower(msg[offset + i]);
+        }
+        offset += ctrlCode + 1;
+    }
+    if (offset + 5 > msgSize) {
+        return BufferResult::BufferOverflow;
+    }
+    mData[len] = 0;
+    memcpy(mData + len + 1, msg + offset + 1, 4);
+    mSize = len + 5;
+    end = offset + 5;
+    return BufferResult::NoError;
+}
+
+bool QuestionKey::operator==(const QuestionKey &other) const {
+    return mSize == other.mSize && memcmp(mData, other.mData, mSize) == 0;
+}
+
+size_t QuestionKey::hash() const {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < mSize; i++) {
+        h = (h ^ mData[i]) * 16777619u;
+    }
+    return h;
+}
+
+/////////// MessageView ///////////
+
+BufferResult MessageView::parseHeader(const uint8_t *buf, size_t size) {
+    mMsg = buf;
+    mMsgSize = size;
+    for (size_t i = 0; i < 4; i++) {
+        mOffsets[i] = mCounts[i] = 0;
+    }
+
+    if (size < 12) {
+        return BufferResult::BufferOverflow;
+    }
+
+    mId = readUint16(buf);
+    uint16_t fields = readUint16(buf + 2);
+    mQr = (fields >> 15) & 1;
+    mOpCode = (fields >> 11) & 15;
+    mAA = (fields >> 10) & 1;
+    mTC = (fields >> 9) & 1;
+    mRD = (fields >> 8) & 1;
+    mRA = (fields >> 7) & 1;
+    mRCode = fields & 15;
+
+    mQdCount = readUint16(buf + 4);
+    mAnCount = readUint16(buf + 6);
+    mNsCount = readUint16(buf + 8);
+    mArCount = readUint16(buf + 10);
+    return BufferResult::NoError;
+}
+
+BufferResult MessageView::parseQuestion(const uint8_t *buf, size_t size, QuestionKey &key) {
+    auto result = parseHeader(buf, size);
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+    if (mQdCount == 0) {
+        return BufferResult::InvalidData;
+    }
+    size_t end;
+    return key.parse(buf, size, 12, end);
+}
+
+BufferResult MessageView::parse(const uint8_t *buf, size_t size) {
+    auto result = parseHeader(buf, size);
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+
+    size_t counts[4] = {mQdCount, mAnCount, mNsCount, mArCount};
+    if (counts[0] * 5 + (counts[1] + counts[2] + counts[3]) * 11 > size - 12) {
+        return BufferResult::BufferOverflow; // reject junk counts before walking the entries
+    }
+
+    // validate all entries once, so the iterators do not need to check anything
+    size_t offset = 12;
+    for (size_t section = 0; section < 4; section++) {
+        mOffsets[section] = offset;
+        for (size_t i = 0; i < counts[section]; i++) {
+            if (section == 0) {
+                QuestionView qs;
+                result = qs.parse(buf, size, offset, offset);
+            } else {
+                RecordView rr;
+                result = rr.parse(buf, size, offset, offset);
+            }
+            if (result != BufferResult::NoError) {
+                return result;
+            }
+        }
+    }
+
+    if (offset != size) {
+        return BufferResult::InvalidData;
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        mCounts[i] = counts[i];
+    }
+    return BufferResult::NoError;
+}
+
+/////////// MessageReader ///////////
+
+MessageReader::MessageReader(const uint8_t *buf, size_t size) : mMsg(buf), mMsgSize(size), mBuff((uint8_t *) buf, size) {
+    mResult = mHeader.parseHeader(buf, size);
+    mRemain = mHeader.mQdCount;
+}
+
+bool MessageReader::next() {
+    if (mResult != BufferResult::NoError || mSection == kEnd) {
+        return false;
+    }
+    while (!mRemain) {
+        mSection = (Section) (mSection + 1);
+        if (mSection == kEnd) {
+            if (mOffset != mMsgSize) {
+                mResult = BufferResult::InvalidData;
+            }
+            return false;
+        }
+        mRemain = mSection == kAnswer ? mHeader.mAnCount : mSection == kAuthority ? mHeader.mNsCount : mHeader.mArCount;
+    }
+    mEntryOffset = mOffset;
+    if (mSection == kQuestion) {
+        mResult = mQuestion.parse(mMsg, mMsgSize, mOffset, mOffset);
+    } else {
+        mResult = mRecord.parse(mMsg, mMsgSize, mOffset, mOffset);
+    }
+    if (mResult != BufferResult::NoError) {
+        return false;
+    }
+    mRemain--;
+    return true;
+}
+
+BufferResult MessageReader::decodeRData(RData &rdata) {
+    if (mResult != BufferResult::NoError || mSection == kQuestion || mSection == kEnd) {
+        return BufferResult::InvalidData;
+    }
+    mBuff.clearBroken(); // of the last record, the name cache is kept
+    return decodeRDataAt(mBuff, mRecord.mRData - mMsg, mRecord, rdata);
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_VIEW_H
+#define _DNS_VIEW_H
+
+#include <string>
+#include <cstddef>
+#include <iterator>
+
+#include "dns.h"
+#include "buffer.h"
+#include "rr.h"
+
+namespace dns {
+
+/**
+ * Read-only view of a <domain-name> inside a message.
+ *
+ * The view only remembers where the name starts, links (compression pointers) are followed when the name is
+ * compared or converted. The message buffer must stay valid as long as the view is used.
+ */
+class NameView {
+public:
+    NameView() = default;
+    NameView(const uint8_t *msg, size_t msgSize, size_t offset) : mMsg(msg), mMsgSize(msgSize), mOffset(offset) {}
+
+    inline size_t offset() const { return mOffset; }
+
+    // decode the name to dotted form, like Buffer::readDomainName
+    BufferResult toString(std::string &out) const;
+    std::string toString() const;
+
+    // write the uncompressed wire form to out (at most kMaxDomainLen + 1 bytes), returns 0 if the name is invalid
+    size_t toWire(uint8_t *out, size_t outSize, bool lowercase = false) const;
+
+    // case-insensitive comparison (ASCII only, as defined in RFC 4343)
+    bool equals(const std::string &name) const;
+    bool equals(const NameView &other) const;
+
+private:
+    const uint8_t *mMsg = nullptr;
+    size_t mMsgSize = 0;
+    size_t mOffset = 0;
+};
+
+/** Read-only view of a question entry, see QuestionSection */
+class QuestionView {
+public:
+    NameView mName;
+    RecordType mType = RecordType::kNone;
+    RecordClass mClass = RecordClass::kNone;
+
+    // parse the entry at offset, end is set to the offset after the entry
+    BufferResult parse(const uint8_t *msg, size_t msgSize, size_t offset, size_t &end);
+};
+
+/** Read-only view of a resource record, see ResourceRecord */
+class RecordView {
+public:
+    NameView mName;
+    RecordType mType = RecordType::kNone;
+    RecordClass mClass = RecordClass::kNone;
+    uint32_t mTtl = 0;
+    const uint8_t *mRData = nullptr; // RDATA bytes (names inside may contain links into the message)
+    uint16_t mRDataSize = 0;
+
+    // parse the entry at offset, end is set to the offset after the entry
+    BufferResult parse(const uint8_t *msg, size_t msgSize, size_t offset, size_t &end);
+
+    // view of a <domain-name> inside RDATA, eg: rdataName() for CNAME/NS/PTR, rdataName(2) for MX
+    NameView rdataName(size_t rdataOffset = 0) const { return NameView(mMsg, mMsgSize, mRData - mMsg + rdataOffset); }
+
+    // decode the whole record into a ResourceRecord (allocates like Message::decode)
+    BufferResult decode(ResourceRecord &rr) const;
+    // decode only the RDATA into rdata of the same type (InvalidData for another type, RDataUnknown takes any),
+    // its members are reused, eg: RDataA/RDataAAAA don't allocate, names reuse the capacity of their strings
+    BufferResult decodeRData(RData &rdata) const;
+
+private:
+    const uint8_t *mMsg = nullptr;
+    size_t mMsgSize = 0;
+    size_t mOffset = 0;
+};
+
+/**
+ * Packed lookup key of a question: the lowercased uncompressed wire-form name followed by QTYPE and QCLASS
+ * (network byte order), eg: for routing, rate limiting or as a cache key. It is a flat value without heap allocation,
+ * two keys are equal if the questions match case-insensitively.
+ */
+class QuestionKey {
+public:
+    static const size_t kMaxSize = kMaxDomainLen + 2 + 4;
+
+    QuestionKey() = default;
+    QuestionKey(const std::string &name, RecordType type, RecordClass cls = RecordClass::kIN) { assign(name, type, cls); }
+
+    BufferResult assign(const std::string &name, RecordType type, RecordClass cls = RecordClass::kIN);
+
+    // pack the question at offset of msg, the name must not contain links (a query has nothing to link to
+    // before its first question)
+    BufferResult parse(const uint8_t *msg, size_t msgSize, size_t offset, size_t &end);
+
+    inline const uint8_t *data() const { return mData; }
+    inline size_t size() const { return mSize; }
+    inline bool empty() const { return mSize == 0; }
+
+    inline const uint8_t *nameWire() const { return mData; }
+    inline size_t nameWireSize() const { return mSize ? mSize - 4 : 0; }
+    inline RecordType type() const { return mSize ? (RecordType) ((mData[mSize - 4] << 8) + mData[mSize - 3]) : RecordType::kNone; }
+    inline RecordClass cls() const { return mSize ? (RecordClass) ((mData[mSize - 2] << 8) + mData[mSize - 1]) : RecordClass::kNone; }
+
+    bool operator==(const QuestionKey &other) const;
+    bool operator!=(const QuestionKey &other) const { return !(*this == other); }
+
+    size_t hash() const;
+    struct Hash {
+        size_t operator()(const QuestionKey &key) const { return key.hash(); }
+    };
+
+private:
+    uint8_t mData[kMaxSize];
+    size_t mSize = 0;
+};
+
+/**
+ * Read-only view of a DNS message which references the wire buffer instead of copying it.
+ *
+ * parse() validates the structure of all sections once (without following links), after that header fields,
+ * questions and resource records are accessed lazily and without heap allocation:
+ *
+ *     dns::MessageView view;
+ *     if (view.parse(buf, size) == dns::BufferResult::NoError) {
+ *         for (auto &rr : view.answers()) {
+ *             if (rr.mType == dns::RecordType::kA && rr.mName.equals("example.com")) ...
+ *         }
+ *     }
+ */
+class MessageView {
+public:
+    uint16_t mId = 0;
+    uint16_t mQr = 0;
+    uint16_t mOpCode = 0;
+    uint16_t mAA = 0;
+    uint16_t mTC = 0;
+    uint16_t mRD = 0;
+    uint16_t mRA = 0;
+    uint16_t mRCode = 0;
+
+    // entry counts claimed by the header, they are set by all parse functions
+    uint16_t mQdCount = 0;
+    uint16_t mAnCount = 0;
+    uint16_t mNsCount = 0;
+    uint16_t mArCount = 0;
+
+    template<typename T>
+    class Section {
+    public:
+        class iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef T value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const T *pointer;
+            typedef const T &reference;
+
+            iterator(const uint8_t *msg, size_t msgSize, size_t offset, size_t remain) : mMsg(msg), mMsgSize(msgSize), mRemain(remain) {
+                if (mRemain) mEntry.parse(mMsg, mMsgSize, offset, mNext);
+            }
+            const T &operator*() const { return mEntry; }
+            const T *operator->() const { return &mEntry; }
+            iterator &operator++() {
+                if (--mRemain) mEntry.parse(mMsg, mMsgSize, mNext, mNext);
+                return *this;
+            }
+            bool operator==(const iterator &other) const { return mRemain == other.mRemain; }
+            bool operator!=(const iterator &other) const { return mRemain != other.mRemain; }
+        private:
+            const uint8_t *mMsg;
+            size_t mMsgSize;
+            size_t mRemain;
+            size_t mNext = 0;
+            T mEntry;
+        };
+
+        Section(const uint8_t *msg, size_t msgSize, size_t offset, size_t count) : mMsg(msg), mMsgSize(msgSize), mOffset(offset), mCount(count) {}
+        iterator begin() const { return iterator(mMsg, mMsgSize, mOffset, mCount); }
+        iterator end() const { return iterator(mMsg, mMsgSize, mOffset, 0); }
+        size_t size() const { return mCount; }
+        bool empty() const { return mCount == 0; }
+
+    private:
+        const uint8_t *mMsg;
+        size_t mMsgSize;
+        size_t mOffset;
+        size_t mCount;
+    };
+
+    BufferResult parse(const uint8_t *buf, size_t size);
+
+    // fast paths which stop early and do not look at the rest of the message, all sections stay empty:
+    // parseHeader only reads the 12-byte header, parseQuestion also packs the first question into key
+    BufferResult parseHeader(const uint8_t *buf, size_t size);
+    BufferResult parseQuestion(const uint8_t *buf, size_t size, QuestionKey &key);
+
+    Section<QuestionView> questions() const { return Section<QuestionView>(mMsg, mMsgSize, mOffsets[0], mCounts[0]); }
+    Section<RecordView> answers() const { return Section<RecordView>(mMsg, mMsgSize, mOffsets[1], mCounts[1]); }
+    Section<RecordView> authorities() const { return Section<RecordView>(mMsg, mMsgSize, mOffsets[2], mCounts[2]); }
+    Section<RecordView> additions() const { return Section<RecordView>(mMsg, mMsgSize, mOffsets[3], mCounts[3]); }
+
+private:
+    const uint8_t *mMsg = nullptr;
+    size_t mMsgSize = 0;
+    size_t mOffsets[4] = {}; // start offsets of sections
+    size_t mCounts[4] = {}; // entry counts of sections
+};
+
+/**
+ * Forward reader of a message: one pass over the questions and resource records, without validating the whole
+ * message first like MessageView::parse and without heap allocation. next() parses one entry, which is question()
+ * in the question section and record() in the others. The RDATA stays a slice of the message, it is decoded on
+ * request (decodeRData, or RecordView::decode for the whole record):
+ *
+ *     dns::MessageReader reader(buf, size);
+ *     while (reader.next()) {
+ *         if (reader.section() == dns::MessageReader::kAnswer && reader.record().mType == dns::RecordType::kA) {
+ *             auto addr = reader.record().mRData; // 4 bytes
+ *         }
+ *     }
+ *     if (reader.result() != dns::BufferResult::NoError) ... // the message is cut off or invalid
+ */
+class MessageReader {
+public:
+    enum Section {
+        kQuestion = 0, kAnswer, kAuthority, kAdditional, kEnd
+    };
+
+    MessageReader(const uint8_t *buf, size_t size);
+
+    // the header fields and counts, only the header is parsed
+    inline const MessageView &header() const { return mHeader; }
+
+    // move to the next entry, false at the end of the message or if the entry can't be parsed (see result)
+    bool next();
+
+    inline Section section() const { return mSection; }
+    inline const QuestionView &question() const { return mQuestion; }
+    inline const RecordView &record() const { return mRecord; }
+    inline size_t offset() const { return mEntryOffset; } // of the current entry
+
+    // like RecordView::decodeRData for the current record, the names decoded by the reader are cached,
+    // so names linking to them are not walked again
+    BufferResult decodeRData(RData &rdata);
+
+    // InvalidData if there are bytes after the last entry
+    inline BufferResult result() const { return mResult; }
+
+private:
+    const uint8_t *mMsg;
+    size_t mMsgSize;
+    MessageView mHeader;
+    BufferResult mResult;
+    Section mSection = kQuestion;
+    size_t mRemain = 0; // entries of the section after the current one
+    size_t mOffset = 12; // of the next entry
+    size_t mEntryOffset = 12;
+    QuestionView mQuestion;
+    RecordView mRecord;
+    Buffer mBuff; // for decodeRData
+};
+
+} // namespace
+#endif /* _DNS_VIEW_H */
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include "writer.h"
+
+using namespace dns;
+
+static const size_t kHeaderSize = 12;
+
+MessageWriter::MessageWriter(uint8_t *buf, size_t size) : mBuff(buf, size) {
+    reset();
+}
+
+MessageWriter::MessageWriter(std::vector<uint8_t> &out) : mBuff(out), mOut(&out) {
+    reset();
+}
+
+void MessageWriter::reset() {
+    mBuff.reset();
+    mBuff.seek(kHeaderSize); // written by finish
+    mResult = mBuff.result();
+    mSection = kQuestion;
+    for (auto &count : mCounts) {
+        count = 0;
+    }
+}
+
+BufferResult MessageWriter::startSection(Section section) {
+    if (section < mSection) {
+        return BufferResult::InvalidData;
+    }
+    mSection = section;
+    return BufferResult::NoError;
+}
+
+BufferResult MessageWriter::addQuestion(const std::string &name, RecordType type) {
+    if (mResult != BufferResult::NoError) {
+        return mResult;
+    }
+    if (mSection != kQuestion) {
+        return BufferResult::InvalidData;
+    }
+    if (mCounts[kQuestion] == 0xFFFF) {
+        return BufferResult::LimitExceeded;
+    }
+    auto cp = mBuff.checkpoint();
+    mBuff.writeDomainName(name);
+    mBuff.writeUint16((uint16_t) type);
+    mBuff.writeUint16((uint16_t) mClass);
+    if (mBuff.isBroken()) {
+        auto result = mBuff.result();
+        mBuff.rollback(cp);
+        return result;
+    }
+    mCounts[kQuestion]++;
+    return BufferResult::NoError;
+}
+
+bool MessageWriter::beginRecord(const std::string &name, RecordType type, RecordClass cls, uint32_t ttl,
+                                Buffer::Checkpoint &cp, BufferResult &result) {
+    result = mResult;
+    if (result != BufferResult::NoError) {
+        return false;
+    }
+    if (mSection == kQuestion) {
+        mSection = kAnswer;
+    }
+    if (mCounts[mSection] == 0xFFFF) {
+        result = BufferResult::LimitExceeded;
+        return false;
+    }
+    cp = mBuff.checkpoint();
+    mBuff.writeDomainName(name);
+    mBuff.writeUint16((uint16_t) type);
+    mBuff.writeUint16((uint16_t) cls);
+    mBuff.writeUint32(ttl);
+    mBuff.writeUint16(0); // RDATA length, set by endRecord
+    return true;
+}
+
+BufferResult MessageWriter::endRecord(const Buffer::Checkpoint &cp, size_t rdataPos) {
+    auto dataLen = mBuff.pos() - rdataPos;
+    if (!mBuff.isBroken() && dataLen > 0xFFFF) {
+        mBuff.markBroken(BufferResult::InvalidData);
+    }
+    if (mBuff.isBroken()) {
+        auto result = mBuff.result();
+        mBuff.rollback(cp);
+        return result;
+    }
+    auto end = mBuff.pos();
+    mBuff.seek(rdataPos - 2);
+    mBuff.writeUint16((uint16_t) dataLen);
+    mBuff.seek(end);
+    mCounts[mSection]++;
+    return BufferResult::NoError;
+}
+
+BufferResult MessageWriter::addA(const std::string &name, uint32_t ttl, const uint8_t *addr) {
+    return addRecord(name, RecordType::kA, ttl, addr, 4);
+}
+
+BufferResult MessageWriter::addAAAA(const std::string &name, uint32_t ttl, const uint8_t *addr) {
+    return addRecord(name, RecordType::kAAAA, ttl, addr, 16);
+}
+
+BufferResult MessageWriter::addCNAME(const std::string &name, uint32_t ttl, const std::string &target) {
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    if (!beginRecord(name, RecordType::kCNAME, mClass, ttl, cp, result)) {
+        return result;
+    }
+    auto rdataPos = mBuff.pos();
+    mBuff.writeDomainName(target);
+    return endRecord(cp, rdataPos);
+}
+
+BufferResult MessageWriter::addNS(const std::string &name, uint32_t ttl, const std::string &host) {
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    if (!beginRecord(name, RecordType::kNS, mClass, ttl, cp, result)) {
+        return result;
+    }
+    auto rdataPos = mBuff.pos();
+    mBuff.writeDomainName(host);
+    return endRecord(cp, rdataPos);
+}
+
+BufferResult MessageWriter::addPTR(const std::string &name, uint32_t ttl, const std::string &target) {
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    if (!beginRecord(name, RecordType::kPTR, mClass, ttl, cp, result)) {
+        return result;
+    }
+    auto rdataPos = mBuff.pos();
+    mBuff.writeDomainName(target);
+    return endRecord(cp, rdataPos);
+}
+
+BufferResult MessageWriter::addMX(const std::string &name, uint32_t ttl, uint16_t preference, const std::string &exchange) {
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    if (!beginRecord(name, RecordType::kMX, mClass, ttl, cp, result)) {
+        return result;
+    }
+    auto rdataPos = mBuff.pos();
+    mBuff.writeUint16(preference);
+    mBuff.writeDomainName(exchange);
+    return endRecord(cp, rdataPos);
+}
+
+BufferResult MessageWriter::addTXT(const std::string &name, uint32_t ttl, const std::string &text) {
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    if (!beginRecord(name, RecordType::kTXT, mClass, ttl, cp, result)) {
+        return result;
+    }
+    auto rdataPos = mBuff.pos();
+    size_t pos = 0;
+    do {
+        auto len = text.size() - pos < 255 ? text.size() - pos : 255;
+        mBuff.writeUint8((uint8_t) len);
+        mBuff.writeBytes((const uint8_t *) text.data() + pos, len);
+        pos += len;
+    } while (pos < text.size());
+    return endRecord(cp, rdataPos);
+}
+
+BufferResult MessageWriter::addSRV(const std::string &name, uint32_t ttl, uint16_t priority, uint16_t weight,
+                                   uint16_t port, const std::string &target) {
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    if (!beginRecord(name, RecordType::kSRV, mClass, ttl, cp, result)) {
+        return result;
+    }
+    auto rdataPos = mBuff.pos();
+    mBuff.writeUint16(priority);
+    mBuff.writeUint16(weight);
+    mBuff.writeUint16(port);
+    mBuff.writeDomainName(target);
+    return endRecord(cp, rdataPos);
+}
+
+BufferResult MessageWriter::addSOA(const std::string &name, uint32_t ttl, const std::string &mname,
+                                   const std::string &rname, uint32_t serial, uint32_t refresh, uint32_t retry,
+                                   uint32_t expire, uint32_t minimum) {
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    if (!beginRecord(name, RecordType::SOA, mClass, ttl, cp, result)) {
+        return result;
+    }
+    auto rdataPos = mBuff.pos();
+    mBuff.writeDomainName(mname);
+    mBuff.writeDomainName(rname);
+    mBuff.writeUint32(serial);
+    mBuff.writeUint32(refresh);
+    mBuff.writeUint32(retry);
+    mBuff.writeUint32(expire);
+    mBuff.writeUint32(minimum);
+    return endRecord(cp, rdataPos);
+}
+
+BufferResult MessageWriter::addRecord(const std::string &name, RecordType type, uint32_t ttl, const uint8_t *rdata,
+                                      size_t size) {
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    if (!beginRecord(name, type, mClass, ttl, cp, result)) {
+        return result;
+    }
+    auto rdataPos = mBuff.pos();
+    mBuff.writeBytes(rdata, size);
+    return endRecord(cp, rdataPos);
+}
+
+BufferResult MessageWriter::addOPT(uint16_t payloadSize, uint16_t flags, uint8_t extendedRCode) {
+    if (mSection < kAdditional) {
+        mSection = kAdditional;
+    }
+    Buffer::Checkpoint cp{};
+    BufferResult result;
+    // CLASS is the payload size, TTL the extended RCODE, version 0 and the flags
+    if (!beginRecord("", RecordType::kOPT, (RecordClass) payloadSize, ((uint32_t) extendedRCode << 24) | flags, cp, result)) {
+        return result;
+    }
+    return endRecord(cp, mBuff.pos());
+}
+
+BufferResult MessageWriter::finish(size_t &size) {
+    size = 0;
+    if (mResult != BufferResult::NoError) {
+        return mResult;
+    }
+    auto end = mBuff.pos();
+    mBuff.seek(0);
+    mBuff.writeUint16(mId);
+    uint16_t fields = ((mQr & 1) << 15);
+    fields |= ((mOpCode & 15) << 11);
+    fields |= ((mAA & 1) << 10);
+    fields |= ((mTC & 1) << 9);
+    fields |= ((mRD & 1) << 8);
+    fields |= ((mRA & 1) << 7);
+    fields |= ((mRCode & 15));
+    mBuff.writeUint16(fields);
+    for (auto count : mCounts) {
+        mBuff.writeUint16(count);
+    }
+    mBuff.seek(end);
+    if (mOut) {
+        mOut->resize(end);
+    }
+    size = end;
+    return BufferResult::NoError;
+}
+
+BufferResult MessageWriter::finish() {
+    size_t size;
+    return finish(size);
+}
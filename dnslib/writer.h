@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_WRITER_H
+#define _DNS_WRITER_H
+
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "buffer.h"
+
+namespace dns {
+
+/**
+ * Builder which writes a message directly in wire form, without Message, ResourceRecord or RData objects:
+ *
+ *     dns::MessageWriter w(out);
+ *     w.mId = query.mId;
+ *     w.mQr = 1;
+ *     w.addQuestion("example.com", dns::RecordType::kA);
+ *     w.addA("example.com", 300, addr);
+ *     w.startSection(dns::MessageWriter::kAuthority);
+ *     w.addNS("example.com", 3600, "ns1.example.com");
+ *     w.finish();
+ *
+ * Names are compressed like Message::encode does, so the result is the same as encoding the same Message.
+ * Entries are added section by section, records added before startSection() go to the answer section.
+ * The header is written by finish(), with the header fields below and the number of entries of every section.
+ *
+ * An entry which doesn't fit into a fixed buffer is removed again and BufferOverflow returned, the writer stays
+ * usable, eg: to set mTC and finish the message with the entries written so far.
+ */
+class MessageWriter {
+public:
+    enum Section {
+        kQuestion = 0, kAnswer, kAuthority, kAdditional
+    };
+
+    // header fields, see Message
+    uint16_t mId = 0;
+    uint16_t mQr = 0;
+    uint16_t mOpCode = 0;
+    uint16_t mAA = 0;
+    uint16_t mTC = 0;
+    uint16_t mRD = 0;
+    uint16_t mRA = 0;
+    uint16_t mRCode = 0;
+
+    RecordClass mClass = RecordClass::kIN; // of the questions and records added
+
+    // write into a fixed buffer, or into a growable vector which finish() resizes to the message
+    MessageWriter(uint8_t *buf, size_t size);
+    explicit MessageWriter(std::vector<uint8_t> &out);
+    MessageWriter(const MessageWriter&) = delete;
+    MessageWriter& operator=(const MessageWriter&) = delete;
+
+    // move on to a later section, InvalidData if it is before the current one
+    BufferResult startSection(Section section);
+    inline Section section() const { return mSection; }
+    inline size_t count(Section section) const { return mCounts[section]; }
+
+    // InvalidData if records have been added already
+    BufferResult addQuestion(const std::string &name, RecordType type);
+
+    BufferResult addA(const std::string &name, uint32_t ttl, const uint8_t *addr); // 4 bytes
+    BufferResult addAAAA(const std::string &name, uint32_t ttl, const uint8_t *addr); // 16 bytes
+    BufferResult addCNAME(const std::string &name, uint32_t ttl, const std::string &target);
+    BufferResult addNS(const std::string &name, uint32_t ttl, const std::string &host);
+    BufferResult addPTR(const std::string &name, uint32_t ttl, const std::string &target);
+    BufferResult addMX(const std::string &name, uint32_t ttl, uint16_t preference, const std::string &exchange);
+    // text longer than 255 bytes is split into several <character-string>
+    BufferResult addTXT(const std::string &name, uint32_t ttl, const std::string &text);
+    BufferResult addSRV(const std::string &name, uint32_t ttl, uint16_t priority, uint16_t weight, uint16_t port,
+                        const std::string &target);
+    BufferResult addSOA(const std::string &name, uint32_t ttl, const std::string &mname, const std::string &rname,
+                        uint32_t serial, uint32_t refresh, uint32_t retry, uint32_t expire, uint32_t minimum);
+    // any type, the RDATA is written as it is
+    BufferResult addRecord(const std::string &name, RecordType type, uint32_t ttl, const uint8_t *rdata, size_t size);
+    // EDNS(0) OPT record without options, it starts the additional section
+    BufferResult addOPT(uint16_t payloadSize, uint16_t flags = 0, uint8_t extendedRCode = 0);
+
+    // write the header, size is the size of the message
+    BufferResult finish(size_t &size);
+    BufferResult finish();
+
+    // start a new message in the same buffer, the header fields are kept
+    void reset();
+
+private:
+    Buffer mBuff;
+    std::vector<uint8_t> *mOut = nullptr;
+    BufferResult mResult = BufferResult::NoError; // BufferOverflow if the buffer can't hold the header
+    Section mSection = kQuestion;
+    uint16_t mCounts[4] = {};
+
+    // the part of a record before the RDATA, and the RDATA length after it
+    bool beginRecord(const std::string &name, RecordType type, RecordClass cls, uint32_t ttl, Buffer::Checkpoint &cp,
+                     BufferResult &result);
+    BufferResult endRecord(const Buffer::Checkpoint &cp, size_t rdataPos);
+};
+
+} // namespace
+#endif /* _DNS_WRITER_H */
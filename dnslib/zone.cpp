@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include "zone.h"
+
+using namespace dns;
+
+// longest CNAME chain followed inside a zone
+static const size_t kMaxCnameChain = 8;
+
+static inline char toLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// case-insensitive comparison of a name with a lookup name, the trailing dot of name is ignored
+static bool equalsLookupName(const std::string &name, const std::string &lowerName) {
+    auto len = name.size();
+    if (len && name[len - 1] == '.') {
+        len--;
+    }
+    if (len != lowerName.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (toLower(name[i]) != lowerName[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/////////// Zone ///////////
+
+Zone::Zone(const std::string &origin, RecordClass cls) : mClass(cls) {
+    toLookupName(origin, mOrigin);
+    mOriginNode = &mNodes[mOrigin];
+}
+
+void Zone::toLookupName(const std::string &name, std::string &out) {
+    auto len = name.size();
+    if (len && name[len - 1] == '.') {
+        len--;
+    }
+    out.resize(len);
+    for (size_t i = 0; i < len; i++) {
+        out[i] = toLower(name[i]);
+    }
+}
+
+bool Zone::isInside(const std::string &lowerName) const {
+    if (mOrigin.empty()) {
+        return true;
+    }
+    if (lowerName.size() == mOrigin.size()) {
+        return lowerName == mOrigin;
+    }
+    return lowerName.size() > mOrigin.size() && lowerName[lowerName.size() - mOrigin.size() - 1] == '.' &&
+           lowerName.compare(lowerName.size() - mOrigin.size(), mOrigin.size(), mOrigin) == 0;
+}
+
+bool Zone::hasSoa() const {
+    for (auto &entry : mOriginNode->mEntries) {
+        if (entry.mRecord.mType == RecordType::SOA) {
+            return true;
+        }
+    }
+    return false;
+}
+
+BufferResult Zone::add(ResourceRecord rr) {
+    auto rData = rr.getRData<RData>();
+    if (!rData) {
+        return BufferResult::InvalidData;
+    }
+    rr.mType = rr.getType();
+    if (rr.mClass == RecordClass::kNone) {
+        rr.mClass = mClass;
+    }
+    std::string name;
+    toLookupName(rr.mName, name);
+    if (rr.mClass != mClass || rr.mType == RecordType::kOPT || !isInside(name)) {
+        return BufferResult::InvalidData;
+    }
+
+    Entry entry;
+    switch (rr.mType) {
+        case RecordType::kNS:
+        case RecordType::kCNAME:
+            toLookupName(std::static_pointer_cast<RDataWithName>(rData)->mName, entry.mTarget);
+            break;
+        case RecordType::kMX:
+            toLookupName(std::static_pointer_cast<RDataMX>(rData)->mExchange, entry.mTarget);
+            break;
+        case RecordType::kSRV:
+            toLookupName(std::static_pointer_cast<RDataSRV>(rData)->mTarget, entry.mTarget);
+            break;
+        case RecordType::SOA:
+            if (name == mOrigin) {
+                mSoaMinimum = std::static_pointer_cast<RDataSOA>(rData)->mMinimum;
+            }
+            break;
+        default:
+            break;
+    }
+
+    auto &node = mNodes[name];
+    node.mHasCname |= rr.mType == RecordType::kCNAME;
+    if (rr.mType == RecordType::kNS && name != mOrigin) {
+        node.mHasNs = true;
+        mHasDelegations = true;
+    }
+    entry.mRecord = std::move(rr);
+    node.mEntries.push_back(std::move(entry));
+    mRecordCount++;
+
+    // the names between the owner and the origin exist too (empty non-terminals)
+    auto originPos = name.size() - mOrigin.size();
+    for (auto pos = name.find('.'); pos != std::string::npos && pos < originPos; pos = name.find('.', pos + 1)) {
+        if (!mNodes.emplace(name.substr(pos + 1), Node()).second) {
+            break; // it has been added with its parents before
+        }
+    }
+    return BufferResult::NoError;
+}
+
+void Zone::forEachName(const std::function<void(const std::string &, const std::vector<const ResourceRecord *> &)> &fn) const {
+    std::vector<const ResourceRecord *> records;
+    for (auto &it : mNodes) {
+        records.clear();
+        for (auto &entry : it.second.mEntries) {
+            records.push_back(&entry.mRecord);
+        }
+        fn(it.first, records);
+    }
+}
+
+const Zone::Node *Zone::findNode(const std::string &lowerName) const {
+    auto it = mNodes.find(lowerName);
+    return it == mNodes.end() ? nullptr : &it->second;
+}
+
+// walk from the origin down to the name: returns the node with NS records of a zone cut on the way,
+// otherwise node is set to the node of the name, or nullptr and encloserPos to the closest encloser
+const Zone::Node *Zone::findCut(const std::string &lowerName, std::string &scratch, const Node *&node, size_t &encloserPos) const {
+    node = nullptr;
+    if (!mHasDelegations) {
+        node = findNode(lowerName);
+        if (node) {
+            return nullptr;
+        }
+    }
+
+    size_t positions[kMaxDomainLen / 2 + 1]; // start of the names between the origin (exclusive) and lowerName
+    size_t count = 0;
+    encloserPos = lowerName.size() - mOrigin.size();
+    for (size_t pos = 0; pos < encloserPos && count < sizeof(positions) / sizeof(positions[0]);) {
+        positions[count++] = pos;
+        auto dot = lowerName.find('.', pos);
+        pos = dot == std::string::npos ? lowerName.size() : dot + 1;
+    }
+    if (count == 0) {
+        node = mOriginNode;
+        return nullptr;
+    }
+    for (size_t i = count; i-- > 0;) {
+        scratch.assign(lowerName, positions[i], std::string::npos);
+        auto it = mNodes.find(scratch);
+        if (it == mNodes.end()) {
+            return nullptr;
+        }
+        encloserPos = positions[i];
+        if (it->second.mHasNs) {
+            return &it->second;
+        }
+        if (i == 0) {
+            node = &it->second;
+        }
+    }
+    return nullptr;
+}
+
+void Zone::answer(const QuestionSection &question, const std::string &lowerName, Message &response, std::string &scratch) const {
+    response.mAA = 1;
+    response.mRCode = (uint16_t) ResponseCode::kNOERROR;
+
+    auto qtype = question.mType;
+    const std::string *name = &lowerName;
+    for (size_t chain = 0; chain <= kMaxCnameChain; chain++) {
+        const Node *node;
+        size_t encloserPos;
+        auto cut = findCut(*name, scratch, node, encloserPos);
+        if (cut) {
+            // referral, only authoritative for the CNAMEs followed so far
+            response.mAA = chain ? 1 : 0;
+            for (auto &entry : cut->mEntries) {
+                if (entry.mRecord.mType == RecordType::kNS) {
+                    response.authorities.push_back(entry.mRecord);
+                    addAdditional(entry, response);
+                }
+            }
+            return;
+        }
+
+        bool synthesized = false;
+        if (!node) {
+            // wildcard at the closest encloser (RFC 4592)
+            scratch.assign("*");
+            if (encloserPos < name->size()) {
+                scratch.push_back('.');
+                scratch.append(*name, encloserPos, std::string::npos);
+            }
+            node = findNode(scratch);
+            if (!node) {
+                response.mRCode = (uint16_t) ResponseCode::kNXDOMAIN;
+                addNegative(response);
+                return;
+            }
+            synthesized = true;
+        }
+
+        const Entry *cname = nullptr;
+        auto answerCount = response.answers.size();
+        for (auto &entry : node->mEntries) {
+            if (entry.mRecord.mType == qtype || qtype == RecordType::kANY) {
+                response.answers.push_back(entry.mRecord);
+                if (synthesized) {
+                    response.answers.back().mName = chain ? *name : question.mName;
+                }
+                addAdditional(entry, response);
+            } else if (entry.mRecord.mType == RecordType::kCNAME) {
+                cname = &entry;
+            }
+        }
+        if (response.answers.size() != answerCount) {
+            return;
+        }
+        if (!cname) {
+            addNegative(response); // NODATA
+            return;
+        }
+        response.answers.push_back(cname->mRecord);
+        if (synthesized) {
+            response.answers.back().mName = chain ? *name : question.mName;
+        }
+        name = &cname->mTarget;
+        if (!isInside(*name)) {
+            return; // the resolver follows the CNAME
+        }
+    }
+}
+
+void Zone::addNegative(Message &response) const {
+    for (auto &entry : mOriginNode->mEntries) {
+        if (entry.mRecord.mType == RecordType::SOA) {
+            response.authorities.push_back(entry.mRecord);
+            auto &soa = response.authorities.back();
+            if (soa.mTtl > mSoaMinimum) {
+                soa.mTtl = mSoaMinimum;
+            }
+            return;
+        }
+    }
+}
+
+void Zone::addAdditional(const Entry &entry, Message &response) const {
+    auto type = entry.mRecord.mType;
+    if ((type != RecordType::kNS && type != RecordType::kMX && type != RecordType::kSRV) || !isInside(entry.mTarget)) {
+        return;
+    }
+    for (auto &rr : response.additions) {
+        if (equalsLookupName(rr.mName, entry.mTarget)) {
+            return;
+        }
+    }
+    auto node = findNode(entry.mTarget);
+    if (!node) {
+        return;
+    }
+    for (auto &e : node->mEntries) {
+        if (e.mRecord.mType == RecordType::kA || e.mRecord.mType == RecordType::kAAAA) {
+            response.additions.push_back(e.mRecord);
+        }
+    }
+}
+
+/////////// ZoneStore ///////////
+
+// epoch of the zone set a reader uses, 0 if it doesn't use any
+struct ZoneStore::ReaderSlot {
+    std::atomic<uint64_t> mEpoch{0};
+    bool mUsed = false; // protected by mWriterMutex
+    char padding[64 - sizeof(std::atomic<uint64_t>) - sizeof(bool)];
+};
+
+ZoneStore::ZoneStore() : mCurrent(new ZoneSet()) {
+}
+
+ZoneStore::~ZoneStore() {
+    delete mCurrent.load();
+    for (auto &retired : mRetired) {
+        delete retired.mSet;
+    }
+}
+
+void ZoneStore::update(std::shared_ptr<const Zone> zone) {
+    std::lock_guard<std::mutex> lock(mWriterMutex);
+    auto set = new ZoneSet(*mCurrent.load());
+    set->mZones[zone->origin()] = std::move(zone);
+    publish(set);
+}
+
+void ZoneStore::remove(const std::string &origin) {
+    std::lock_guard<std::mutex> lock(mWriterMutex);
+    std::string name;
+    Zone::toLookupName(origin, name);
+    auto set = new ZoneSet(*mCurrent.load());
+    set->mZones.erase(name);
+    publish(set);
+}
+
+size_t ZoneStore::zoneCount() const {
+    std::lock_guard<std::mutex> lock(mWriterMutex);
+    return mCurrent.load()->mZones.size();
+}
+
+void ZoneStore::publish(ZoneSet *set) {
+    // a reader which announced an epoch before the increment may use the old set, later readers get the new one
+    auto old = mCurrent.exchange(set);
+    auto epoch = mEpoch.fetch_add(1) + 1;
+    mRetired.push_back(Retired{old, epoch});
+    reclaim();
+}
+
+void ZoneStore::reclaim() {
+    auto minEpoch = UINT64_MAX;
+    for (auto &slot : mSlots) {
+        auto epoch = slot->mEpoch.load();
+        if (epoch && epoch < minEpoch) {
+            minEpoch = epoch;
+        }
+    }
+    size_t kept = 0;
+    for (auto &retired : mRetired) {
+        if (retired.mEpoch <= minEpoch) {
+            delete retired.mSet;
+        } else {
+            mRetired[kept++] = retired;
+        }
+    }
+    mRetired.resize(kept);
+}
+
+ZoneStore::Reader::Reader(ZoneStore &store) : mStore(store), mSlot(nullptr) {
+    std::lock_guard<std::mutex> lock(store.mWriterMutex);
+    for (auto &slot : store.mSlots) {
+        if (!slot->mUsed) {
+            mSlot = slot.get();
+            break;
+        }
+    }
+    if (!mSlot) {
+        store.mSlots.emplace_back(new ReaderSlot());
+        mSlot = store.mSlots.back().get();
+    }
+    mSlot->mUsed = true;
+}
+
+ZoneStore::Reader::~Reader() {
+    release();
+    std::lock_guard<std::mutex> lock(mStore.mWriterMutex);
+    mSlot->mUsed = false;
+}
+
+void ZoneStore::Reader::release() {
+    mSlot->mEpoch.store(0);
+}
+
+void ZoneStore::Reader::answer(const Message &query, Message &response) {
+    response.mId = query.mId;
+    response.mQr = 1;
+    response.mOpCode = query.mOpCode;
+    response.mAA = 0;
+    response.mTC = 0;
+    response.mRD = query.mRD;
+    response.mRA = 0;
+    response.mRCode = (uint16_t) ResponseCode::kNOERROR;
+    response.questions = query.questions;
+    response.answers.clear();
+    response.authorities.clear();
+    response.additions.clear();
+
+    if (query.mOpCode != 0) {
+        response.mRCode = (uint16_t) ResponseCode::kNOTIMP;
+        return;
+    }
+    if (query.questions.size() != 1) {
+        response.mRCode = (uint16_t) ResponseCode::kFORMERR;
+        return;
+    }
+    auto &question = query.questions[0];
+    Zone::toLookupName(question.mName, mName);
+
+    // pin the current zone set until the next answer or release
+    mSlot->mEpoch.store(mStore.mEpoch.load());
+    auto set = mStore.mCurrent.load();
+
+    // the zone with the longest origin which contains the name
+    const Zone *zone = nullptr;
+    for (size_t pos = 0;;) {
+        mSuffix.assign(mName, pos, std::string::npos);
+        auto it = set->mZones.find(mSuffix);
+        if (it != set->mZones.end()) {
+            zone = it->second.get();
+            break;
+        }
+        if (pos >= mName.size()) {
+            break;
+        }
+        auto dot = mName.find('.', pos);
+        pos = dot == std::string::npos ? mName.size() : dot + 1;
+    }
+    if (!zone || (question.mClass != zone->recordClass() && (uint16_t) question.mClass != 255)) {
+        response.mRCode = (uint16_t) ResponseCode::kREFUSED;
+        return;
+    }
+    zone->answer(question, mName, response, mSuffix);
+}
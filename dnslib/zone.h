@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_ZONE_H
+#define _DNS_ZONE_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dns.h"
+#include "message.h"
+#include "rr.h"
+
+namespace dns {
+
+/**
+ * Authoritative data of one zone: resource records indexed by owner name (case-insensitive) and type.
+ *
+ * A zone is filled by add() and then published to a ZoneStore, after that it must not be changed any more.
+ * Responses made from the zone share the RData of its records.
+ *
+ * Answers follow RFC 1034 4.3.2: CNAMEs inside the zone are followed, NS records below the origin make a
+ * referral (with glue from the zone), "*" labels are wildcards, and NXDOMAIN/NODATA responses have the SOA of
+ * the zone in the authority section with the TTL limited by its MINIMUM field (RFC 2308).
+ * A/AAAA records of NS, MX and SRV targets inside the zone are added to the additional section.
+ */
+class Zone {
+public:
+    explicit Zone(const std::string &origin, RecordClass cls = RecordClass::kIN);
+    Zone(const Zone&) = delete;
+    Zone& operator=(const Zone&) = delete;
+
+    inline const std::string &origin() const { return mOrigin; } // lowercase, without the trailing dot
+    inline RecordClass recordClass() const { return mClass; }
+    inline size_t recordCount() const { return mRecordCount; }
+    bool hasSoa() const;
+
+    // add a record (RData must be set), InvalidData if the owner is not inside the zone or the class differs
+    BufferResult add(ResourceRecord rr);
+
+    // fill the sections of response and set mAA/mRCode for the question, lowerName is the question name
+    // in lowercase without the trailing dot and must be inside the zone, scratch is reused between calls
+    void answer(const QuestionSection &question, const std::string &lowerName, Message &response, std::string &scratch) const;
+
+    // call fn for every name of the zone (including the empty non-terminals) with its records, eg: to compile it
+    void forEachName(const std::function<void(const std::string &lowerName, const std::vector<const ResourceRecord *> &records)> &fn) const;
+
+    // name in lowercase without the trailing dot, the form used by the lookups
+    static void toLookupName(const std::string &name, std::string &out);
+
+private:
+    struct Entry {
+        ResourceRecord mRecord;
+        std::string mTarget; // lowercase name for the additional section (NS, MX, SRV) or to follow (CNAME)
+    };
+    struct Node {
+        std::vector<Entry> mEntries; // empty for the names between the records and the origin
+        bool mHasCname = false;
+        bool mHasNs = false;
+    };
+
+    std::string mOrigin;
+    RecordClass mClass;
+    std::unordered_map<std::string, Node> mNodes;
+    size_t mRecordCount = 0;
+    const Node *mOriginNode;
+    bool mHasDelegations = false;
+    uint32_t mSoaMinimum = 0;
+
+    bool isInside(const std::string &lowerName) const;
+    const Node *findNode(const std::string &lowerName) const;
+    const Node *findCut(const std::string &lowerName, std::string &scratch, const Node *&node, size_t &encloserPos) const;
+    void addNegative(Message &response) const;
+    void addAdditional(const Entry &entry, Message &response) const;
+};
+
+/**
+ * Set of zones shared by the threads of a server.
+ *
+ * Lookups are lock-free: every thread uses its own Reader, which only announces the zone set it is reading
+ * with an atomic store. Updates build a new zone set, publish it with an atomic pointer swap and free the old
+ * one once no reader can use it any more, so readers never wait for a writer and never touch reference counts.
+ */
+class ZoneStore {
+    struct ReaderSlot;
+
+public:
+    ZoneStore();
+    ZoneStore(const ZoneStore&) = delete;
+    ZoneStore& operator=(const ZoneStore&) = delete;
+    ~ZoneStore(); // all readers must be destroyed before the store
+
+    // add a zone or replace the zone with the same origin
+    void update(std::shared_ptr<const Zone> zone);
+    void remove(const std::string &origin);
+
+    size_t zoneCount() const;
+
+    class Reader {
+    public:
+        explicit Reader(ZoneStore &store);
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        ~Reader();
+
+        // make the response of query: the zone set is pinned, so the response (which shares RData with the
+        // zones) must be encoded before the next call to answer() or release().
+        // The response has REFUSED if no zone matches, FORMERR/NOTIMP for unsupported queries.
+        void answer(const Message &query, Message &response);
+
+        // unpin the zone set, eg: before the thread goes idle, so old zone sets can be freed
+        void release();
+
+    private:
+        ZoneStore &mStore;
+        ReaderSlot *mSlot;
+        std::string mName; // scratch for the lowercase question name
+        std::string mSuffix;
+    };
+
+private:
+    struct ZoneSet {
+        std::unordered_map<std::string, std::shared_ptr<const Zone>> mZones;
+    };
+    struct Retired {
+        const ZoneSet *mSet;
+        uint64_t mEpoch;
+    };
+
+    std::atomic<const ZoneSet *> mCurrent;
+    std::atomic<uint64_t> mEpoch{1};
+    mutable std::mutex mWriterMutex; // serializes the writers and protects the members below
+    std::vector<std::unique_ptr<ReaderSlot>> mSlots;
+    std::vector<Retired> mRetired;
+
+    void publish(ZoneSet *set);
+    void reclaim();
+};
+
+} // namespace
+#endif /* _DNS_ZONE_H */
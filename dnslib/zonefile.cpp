@@ -0,0 +1,710 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <fstream>
+#include <sstream>
+#include <Ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "zonefile.h"
+
+using namespace dns;
+
+// parsed pages of a mapped file are released in chunks of this size
+static const size_t kReleaseChunk = 64 * 1024 * 1024;
+
+static inline bool isDelimiter(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ';' || c == '(' || c == ')' || c == '"';
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static void toUpper(std::string &s) {
+    for (auto &c : s) {
+        if (c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
+        }
+    }
+}
+
+// decode \X and \DDD escapes, false if an escape is invalid
+static bool unescape(const char *p, size_t size, std::string &out) {
+    out.clear();
+    for (size_t i = 0; i < size; i++) {
+        if (p[i] != '\\') {
+            out.push_back(p[i]);
+            continue;
+        }
+        if (i + 1 >= size) {
+            return false;
+        }
+        if (isDigit(p[i + 1])) {
+            if (i + 3 >= size || !isDigit(p[i + 2]) || !isDigit(p[i + 3])) {
+                return false;
+            }
+            int value = (p[i + 1] - '0') * 100 + (p[i + 2] - '0') * 10 + (p[i + 3] - '0');
+            if (value > 255) {
+                return false;
+            }
+            out.push_back((char) value);
+            i += 3;
+        } else {
+            out.push_back(p[++i]);
+        }
+    }
+    return true;
+}
+
+// type mnemonic or TYPEnnn (RFC 3597), text is uppercase
+static bool parseType(const std::string &text, RecordType &type) {
+    if (text.compare(0, 4, "TYPE") == 0 && text.size() > 4) {
+        uint32_t value = 0;
+        for (size_t i = 4; i < text.size(); i++) {
+            if (!isDigit(text[i]) || (value = value * 10 + (text[i] - '0')) > 0xFFFF) {
+                return false;
+            }
+        }
+        type = (RecordType) value;
+        return true;
+    }
+    static const RecordType types[] = {
+            RecordType::kA, RecordType::kNS, RecordType::kMD, RecordType::kMF, RecordType::kCNAME, RecordType::SOA,
+            RecordType::kMB, RecordType::kMG, RecordType::kMR, RecordType::kNUL, RecordType::kWKS, RecordType::kPTR,
+            RecordType::kHINFO, RecordType::kMINFO, RecordType::kMX, RecordType::kTXT, RecordType::kAAAA,
+            RecordType::kSRV, RecordType::kNAPTR, RecordType::kOPT,
+    };
+    static const char *names[] = {
+            "A", "NS", "MD", "MF", "CNAME", "SOA", "MB", "MG", "MR", "NULL", "WKS", "PTR",
+            "HINFO", "MINFO", "MX", "TXT", "AAAA", "SRV", "NAPTR", "OPT",
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (text == names[i]) {
+            type = types[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// class mnemonic or CLASSnnn, text is uppercase
+static bool parseClass(const std::string &text, RecordClass &cls) {
+    static const char *names[] = {"IN", "CS", "CH", "HS"};
+    for (size_t i = 0; i < 4; i++) {
+        if (text == names[i]) {
+            cls = (RecordClass) (i + 1);
+            return true;
+        }
+    }
+    if (text.compare(0, 5, "CLASS") == 0 && text.size() > 5) {
+        uint32_t value = 0;
+        for (size_t i = 5; i < text.size(); i++) {
+            if (!isDigit(text[i]) || (value = value * 10 + (text[i] - '0')) > 0xFFFF) {
+                return false;
+            }
+        }
+        cls = (RecordClass) value;
+        return true;
+    }
+    return false;
+}
+
+ZoneFileParser::ZoneFileParser(const std::string &origin, uint32_t defaultTtl) : mInitialTtl(defaultTtl) {
+    mInitialOrigin = origin;
+    if (!mInitialOrigin.empty() && mInitialOrigin.back() == '.') {
+        mInitialOrigin.pop_back();
+    }
+}
+
+BufferResult ZoneFileParser::fail(const std::string &message) {
+    mError = message;
+    mErrorLine = mEntryLine;
+    return BufferResult::InvalidData;
+}
+
+BufferResult ZoneFileParser::parseFile(const std::string &path, const RecordCallback &onRecord) {
+#ifdef _WIN32
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        mEntryLine = 0;
+        return fail("can't open " + path);
+    }
+    std::stringstream content;
+    content << in.rdbuf();
+    auto text = content.str();
+    return parse(text.data(), text.size(), onRecord, false);
+#else
+    mEntryLine = 0;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return fail("can't open " + path + " (" + strerror(errno) + ")");
+    }
+    struct stat st{};
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return fail("can't stat " + path + " (" + strerror(errno) + ")");
+    }
+    auto size = (size_t) st.st_size;
+    if (size == 0) {
+        close(fd);
+        return parse("", 0, onRecord, false);
+    }
+    auto text = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        return fail("can't map " + path + " (" + strerror(errno) + ")");
+    }
+    madvise(text, size, MADV_SEQUENTIAL);
+    auto result = parse((const char *) text, size, onRecord, true);
+    munmap(text, size);
+    return result;
+#endif
+}
+
+BufferResult ZoneFileParser::parse(const char *text, size_t size, const RecordCallback &onRecord) {
+    return parse(text, size, onRecord, false);
+}
+
+BufferResult ZoneFileParser::parse(const char *text, size_t size, const RecordCallback &onRecord, bool mapped) {
+    mOrigin = mInitialOrigin;
+    mDefaultTtl = mInitialTtl;
+    mHasTtlDirective = false;
+    mHasOwner = false;
+    mClass = RecordClass::kIN;
+    mPos = text;
+    mEnd = text + size;
+    mLine = 1;
+    mError.clear();
+    mErrorLine = 0;
+
+#ifndef _WIN32
+    auto released = text; // the mapped pages before it are released
+#endif
+    for (;;) {
+        bool found, ownerOmitted;
+        auto result = readEntry(found, ownerOmitted);
+        if (result != BufferResult::NoError || !found) {
+            return result;
+        }
+        ResourceRecord rr;
+        bool isRecord;
+        result = parseEntry(ownerOmitted, rr, isRecord);
+        if (result != BufferResult::NoError) {
+            return result;
+        }
+        if (isRecord && !onRecord(rr)) {
+            return BufferResult::NoError;
+        }
+#ifndef _WIN32
+        // the mapping starts at a page boundary, so the chunk offsets are page aligned too
+        if (mapped && (size_t) (mPos - released) >= kReleaseChunk) {
+            auto end = released + (size_t) (mPos - released) / kReleaseChunk * kReleaseChunk;
+            madvise((void *) released, end - released, MADV_DONTNEED);
+            released = end;
+        }
+#else
+        (void) mapped;
+#endif
+    }
+}
+
+BufferResult ZoneFileParser::readEntry(bool &found, bool &ownerOmitted) {
+    found = false;
+    mTokens.clear();
+    while (mPos < mEnd && mTokens.empty()) {
+        mEntryLine = mLine;
+        ownerOmitted = *mPos == ' ' || *mPos == '\t';
+        int depth = 0;
+        while (mPos < mEnd) {
+            auto c = *mPos;
+            if (c == '\n') {
+                mLine++;
+                mPos++;
+                if (!depth) {
+                    break;
+                }
+            } else if (c == ' ' || c == '\t' || c == '\r') {
+                mPos++;
+            } else if (c == ';') {
+                while (mPos < mEnd && *mPos != '\n') {
+                    mPos++;
+                }
+            } else if (c == '(') {
+                depth++;
+                mPos++;
+            } else if (c == ')') {
+                if (!depth) {
+                    return fail("unbalanced parentheses");
+                }
+                depth--;
+                mPos++;
+            } else if (c == '"') {
+                auto start = ++mPos;
+                while (mPos < mEnd && *mPos != '"') {
+                    if (*mPos == '\\' && mPos + 1 < mEnd) {
+                        mPos++;
+                    }
+                    if (*mPos == '\n') {
+                        mLine++;
+                    }
+                    mPos++;
+                }
+                if (mPos >= mEnd) {
+                    return fail("unterminated quoted string");
+                }
+                mTokens.push_back(Token{start, (size_t) (mPos - start), true});
+                mPos++;
+            } else {
+                auto start = mPos;
+                while (mPos < mEnd && !isDelimiter(*mPos)) {
+                    if (*mPos == '\\' && mPos + 1 < mEnd) {
+                        mPos++;
+                    }
+                    mPos++;
+                }
+                mTokens.push_back(Token{start, (size_t) (mPos - start), false});
+            }
+        }
+        if (depth) {
+            return fail("unbalanced parentheses");
+        }
+    }
+    found = !mTokens.empty();
+    return BufferResult::NoError;
+}
+
+BufferResult ZoneFileParser::parseEntry(bool ownerOmitted, ResourceRecord &rr, bool &isRecord) {
+    isRecord = false;
+    mNext = 0;
+    auto &first = mTokens[0];
+    if (!ownerOmitted && !first.mQuoted && first.mData[0] == '$') {
+        std::string directive(first.mData, first.mSize);
+        toUpper(directive);
+        mNext = 1;
+        if (directive == "$ORIGIN") {
+            std::string origin;
+            if (!readName(origin, "origin")) {
+                return BufferResult::InvalidData;
+            }
+            mOrigin = origin;
+        } else if (directive == "$TTL") {
+            if (!readTtl(mDefaultTtl, "TTL")) {
+                return BufferResult::InvalidData;
+            }
+            mHasTtlDirective = true;
+        } else {
+            return fail("unsupported directive " + directive);
+        }
+        return hasMoreTokens() ? fail("unexpected data after " + directive) : BufferResult::NoError;
+    }
+
+    if (!ownerOmitted) {
+        if (!readName(mOwner, "owner name")) {
+            return BufferResult::InvalidData;
+        }
+        mHasOwner = true;
+    } else if (!mHasOwner) {
+        return fail("missing owner name");
+    }
+
+    // [TTL] [class] type, TTL and class may be in any order
+    uint32_t ttl = mDefaultTtl;
+    bool hasTtl = false, hasClass = false;
+    auto cls = mClass;
+    RecordType type;
+    for (;;) {
+        if (!hasMoreTokens()) {
+            return fail("missing type");
+        }
+        auto &token = mTokens[mNext];
+        if (!hasTtl && !token.mQuoted && isDigit(token.mData[0])) {
+            if (!readTtl(ttl, "TTL")) {
+                return BufferResult::InvalidData;
+            }
+            hasTtl = true;
+            continue;
+        }
+        if (!unescape(token.mData, token.mSize, mText)) {
+            return fail("invalid escape");
+        }
+        toUpper(mText);
+        mNext++;
+        if (!hasClass && parseClass(mText, cls)) {
+            hasClass = true;
+            continue;
+        }
+        if (!parseType(mText, type)) {
+            return fail("unknown type " + mText);
+        }
+        break;
+    }
+    if (hasTtl && !mHasTtlDirective) {
+        mDefaultTtl = ttl; // RFC 1035: the last explicit TTL is the default
+    }
+    mClass = cls;
+
+    rr.mName = mOwner;
+    rr.mType = type;
+    rr.mClass = cls;
+    rr.mTtl = ttl;
+    auto result = parseRData(rr);
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+    if (hasMoreTokens()) {
+        return fail("unexpected data after RDATA");
+    }
+    isRecord = true;
+    return BufferResult::NoError;
+}
+
+BufferResult ZoneFileParser::parseRData(ResourceRecord &rr) {
+    if (hasMoreTokens()) {
+        auto &token = mTokens[mNext];
+        if (!token.mQuoted && token.mSize == 2 && token.mData[0] == '\\' && token.mData[1] == '#') {
+            mNext++;
+            return parseGenericRData(rr);
+        }
+    }
+
+    switch (rr.mType) {
+        case RecordType::kA: {
+            uint8_t addr[4];
+            if (!readText(mText, "address")) {
+                return BufferResult::InvalidData;
+            }
+            if (inet_pton(AF_INET, mText.c_str(), addr) != 1) {
+                return fail("invalid IPv4 address " + mText);
+            }
+            auto rData = std::make_shared<RDataA>();
+            rData->setAddress(addr);
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kAAAA: {
+            uint8_t addr[16];
+            if (!readText(mText, "address")) {
+                return BufferResult::InvalidData;
+            }
+            if (inet_pton(AF_INET6, mText.c_str(), addr) != 1) {
+                return fail("invalid IPv6 address " + mText);
+            }
+            auto rData = std::make_shared<RDataAAAA>();
+            rData->setAddress(addr);
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kNS:
+        case RecordType::kCNAME:
+        case RecordType::kPTR:
+        case RecordType::kMB:
+        case RecordType::kMD:
+        case RecordType::kMF:
+        case RecordType::kMG:
+        case RecordType::kMR: {
+            std::shared_ptr<RDataWithName> rData;
+            switch (rr.mType) {
+                case RecordType::kNS: rData = std::make_shared<RDataNS>(); break;
+                case RecordType::kCNAME: rData = std::make_shared<RDataCNAME>(); break;
+                case RecordType::kPTR: rData = std::make_shared<RDataPTR>(); break;
+                case RecordType::kMB: rData = std::make_shared<RDataMB>(); break;
+                case RecordType::kMD: rData = std::make_shared<RDataMD>(); break;
+                case RecordType::kMF: rData = std::make_shared<RDataMF>(); break;
+                case RecordType::kMG: rData = std::make_shared<RDataMG>(); break;
+                default: rData = std::make_shared<RDataMR>(); break;
+            }
+            if (!readName(rData->mName, "name")) {
+                return BufferResult::InvalidData;
+            }
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kMINFO: {
+            auto rData = std::make_shared<RDataMINFO>();
+            if (!readName(rData->mRMailBx, "RMAILBX") || !readName(rData->mMailBx, "EMAILBX")) {
+                return BufferResult::InvalidData;
+            }
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kMX: {
+            auto rData = std::make_shared<RDataMX>();
+            uint32_t preference;
+            if (!readUint(preference, 0xFFFF, "preference") || !readName(rData->mExchange, "exchange")) {
+                return BufferResult::InvalidData;
+            }
+            rData->mPreference = preference;
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::SOA: {
+            auto rData = std::make_shared<RDataSOA>();
+            if (!readName(rData->mMName, "MNAME") || !readName(rData->mRName, "RNAME") ||
+                !readUint(rData->mSerial, 0xFFFFFFFF, "serial") || !readTtl(rData->mRefresh, "refresh") ||
+                !readTtl(rData->mRetry, "retry") || !readTtl(rData->mExpire, "expire") ||
+                !readTtl(rData->mMinimum, "minimum")) {
+                return BufferResult::InvalidData;
+            }
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kTXT: {
+            auto rData = std::make_shared<RDataTXT>();
+            do {
+                rData->mTexts.emplace_back();
+                if (!readString(rData->mTexts.back(), "text")) {
+                    return BufferResult::InvalidData;
+                }
+            } while (hasMoreTokens());
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kHINFO: {
+            auto rData = std::make_shared<RDataHINFO>();
+            if (!readString(rData->mCpu, "CPU") || !readString(rData->mOs, "OS")) {
+                return BufferResult::InvalidData;
+            }
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kWKS: {
+            auto rData = std::make_shared<RDataWKS>();
+            uint8_t addr[4];
+            if (!readText(mText, "address")) {
+                return BufferResult::InvalidData;
+            }
+            if (inet_pton(AF_INET, mText.c_str(), addr) != 1) {
+                return fail("invalid IPv4 address " + mText);
+            }
+            rData->setAddress(addr);
+            if (!readText(mText, "protocol")) {
+                return BufferResult::InvalidData;
+            }
+            toUpper(mText);
+            uint32_t protocol;
+            if (mText == "TCP" || mText == "UDP") {
+                protocol = mText == "TCP" ? 6 : 17;
+            } else {
+                mNext--;
+                if (!readUint(protocol, 255, "protocol")) {
+                    return BufferResult::InvalidData;
+                }
+            }
+            rData->mProtocol = protocol;
+            while (hasMoreTokens()) {
+                uint32_t port;
+                if (!readUint(port, 0xFFFF, "port")) {
+                    return BufferResult::InvalidData;
+                }
+                if (rData->mBitmap.size() <= port / 8) {
+                    rData->mBitmap.resize(port / 8 + 1);
+                }
+                rData->mBitmap[port / 8] |= 0x80 >> (port % 8);
+            }
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kSRV: {
+            auto rData = std::make_shared<RDataSRV>();
+            uint32_t priority, weight, port;
+            if (!readUint(priority, 0xFFFF, "priority") || !readUint(weight, 0xFFFF, "weight") ||
+                !readUint(port, 0xFFFF, "port") || !readName(rData->mTarget, "target")) {
+                return BufferResult::InvalidData;
+            }
+            rData->mPriority = priority;
+            rData->mWeight = weight;
+            rData->mPort = port;
+            rr.setRData(rData);
+            break;
+        }
+        case RecordType::kNAPTR: {
+            auto rData = std::make_shared<RDataNAPTR>();
+            uint32_t order, preference;
+            if (!readUint(order, 0xFFFF, "order") || !readUint(preference, 0xFFFF, "preference") ||
+                !readString(rData->mFlags, "flags") || !readString(rData->mServices, "services") ||
+                !readString(rData->mRegExp, "regexp") || !readName(rData->mReplacement, "replacement")) {
+                return BufferResult::InvalidData;
+            }
+            rData->mOrder = order;
+            rData->mPreference = preference;
+            rr.setRData(rData);
+            break;
+        }
+        default:
+            return fail("type " + toString(rr.mType) + " needs the generic RDATA format (\\# length hex)");
+    }
+    return BufferResult::NoError;
+}
+
+// RFC 3597: \# length hex, the RDATA is decoded like a received record
+BufferResult ZoneFileParser::parseGenericRData(ResourceRecord &rr) {
+    uint32_t length;
+    if (!readUint(length, 0xFFFF, "RDATA length")) {
+        return BufferResult::InvalidData;
+    }
+    if (rr.mType == RecordType::kOPT) {
+        return fail("OPT records can't be in a zone file");
+    }
+
+    // the record with root owner name, the owner is set again after decoding
+    uint8_t header[11] = {0, (uint8_t) ((uint16_t) rr.mType >> 8), (uint8_t) rr.mType, (uint8_t) ((uint16_t) rr.mClass >> 8),
+                          (uint8_t) rr.mClass, 0, 0, 0, 0, (uint8_t) (length >> 8), (uint8_t) length};
+    mWire.assign(header, header + sizeof(header));
+    int high = -1;
+    while (hasMoreTokens()) {
+        auto &token = mTokens[mNext++];
+        for (size_t i = 0; i < token.mSize; i++) {
+            auto c = token.mData[i];
+            int nibble = isDigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if (nibble < 0 || token.mQuoted) {
+                return fail("invalid hex data");
+            }
+            if (high < 0) {
+                high = nibble;
+            } else {
+                mWire.push_back((uint8_t) (high * 16 + nibble));
+                high = -1;
+            }
+        }
+    }
+    if (high >= 0 || mWire.size() - sizeof(header) != length) {
+        return fail("RDATA length mismatch");
+    }
+
+    auto name = std::move(rr.mName);
+    auto ttl = rr.mTtl;
+    Buffer buff(mWire.data(), mWire.size());
+    rr.decode(buff);
+    if (buff.isBroken() || buff.pos() != mWire.size()) {
+        return fail("invalid RDATA for type " + toString(rr.mType));
+    }
+    rr.mName = std::move(name);
+    rr.mTtl = ttl;
+    return BufferResult::NoError;
+}
+
+bool ZoneFileParser::readText(std::string &out, const char *what) {
+    if (!hasMoreTokens()) {
+        fail(std::string("missing ") + what);
+        return false;
+    }
+    auto &token = mTokens[mNext++];
+    if (!unescape(token.mData, token.mSize, out)) {
+        fail(std::string("invalid escape in ") + what);
+        return false;
+    }
+    return true;
+}
+
+bool ZoneFileParser::readString(std::string &out, const char *what) {
+    if (!readText(out, what)) {
+        return false;
+    }
+    if (out.size() > 255) {
+        fail(std::string(what) + " is longer than 255 characters");
+        return false;
+    }
+    return true;
+}
+
+bool ZoneFileParser::readName(std::string &out, const char *what) {
+    if (!readText(mText, what)) {
+        return false;
+    }
+    auto &token = mTokens[mNext - 1];
+    bool absolute = token.mData[token.mSize - 1] == '.' && (token.mSize < 2 || token.mData[token.mSize - 2] != '\\');
+    if (mText == "@") {
+        out = mOrigin;
+    } else if (mText == ".") {
+        out.clear();
+    } else if (absolute) {
+        out.assign(mText, 0, mText.size() - 1);
+    } else {
+        out = mText;
+        if (!mOrigin.empty()) {
+            out.push_back('.');
+            out.append(mOrigin);
+        }
+    }
+    uint8_t wire[kMaxDomainLen + 2];
+    size_t wireLen;
+    if (Buffer::toWireDomainName(out, wire, wireLen) != BufferResult::NoError) {
+        fail(std::string("invalid ") + what + " " + out);
+        return false;
+    }
+    return true;
+}
+
+bool ZoneFileParser::readUint(uint32_t &out, uint32_t max, const char *what) {
+    if (!readText(mText, what)) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (auto c : mText) {
+        if (!isDigit(c) || (value = value * 10 + (c - '0')) > max) {
+            fail(std::string("invalid ") + what + " " + mText);
+            return false;
+        }
+    }
+    if (mText.empty()) {
+        fail(std::string("invalid ") + what);
+        return false;
+    }
+    out = (uint32_t) value;
+    return true;
+}
+
+// seconds, or a sequence of numbers with the units w/d/h/m/s, eg: 1h30m
+bool ZoneFileParser::readTtl(uint32_t &out, const char *what) {
+    if (!readText(mText, what)) {
+        return false;
+    }
+    uint64_t total = 0, value = 0;
+    bool hasDigits = false;
+    for (auto c : mText) {
+        if (isDigit(c)) {
+            value = value * 10 + (c - '0');
+            hasDigits = true;
+        } else {
+            uint64_t unit;
+            switch (c) {
+                case 'w': case 'W': unit = 7 * 86400; break;
+                case 'd': case 'D': unit = 86400; break;
+                case 'h': case 'H': unit = 3600; break;
+                case 'm': case 'M': unit = 60; break;
+                case 's': case 'S': unit = 1; break;
+                default: unit = 0; break;
+            }
+            if (!unit || !hasDigits) {
+                fail(std::string("invalid ") + what + " " + mText);
+                return false;
+            }
+            total += value * unit;
+            value = 0;
+            hasDigits = false;
+        }
+        if (value > 0xFFFFFFFF || total > 0xFFFFFFFF) {
+            fail(std::string("invalid ") + what + " " + mText);
+            return false;
+        }
+    }
+    total += value;
+    if (mText.empty() || total > 0xFFFFFFFF) {
+        fail(std::string("invalid ") + what + " " + mText);
+        return false;
+    }
+    out = (uint32_t) total;
+    return true;
+}
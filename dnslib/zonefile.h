@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_ZONEFILE_H
+#define _DNS_ZONEFILE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "buffer.h"
+#include "rr.h"
+
+namespace dns {
+
+/**
+ * Streaming parser of zone files (master files, RFC 1035 section 5).
+ *
+ * Records are passed to the callback one by one as soon as they are parsed (the callback may move the record
+ * away, and returns false to stop), nothing else is kept. Files are mapped into memory and read sequentially,
+ * pages which have been parsed are released again, so files much larger than the memory can be parsed.
+ *
+ * Supported: $ORIGIN, $TTL, "@", relative names, omitted owner/TTL/class, parentheses, comments, quoted strings,
+ * \X and \DDD escapes, TTL units (1h30m, BIND style), TYPEnnn/CLASSnnn and the generic RDATA format of RFC 3597
+ * (\# length hex) for any type. Every type of rr.h except OPT has its presentation format.
+ * $INCLUDE and $GENERATE are not supported. Names are returned without the trailing dot.
+ */
+class ZoneFileParser {
+public:
+    typedef std::function<bool(ResourceRecord &rr)> RecordCallback;
+
+    // origin is used until the first $ORIGIN, defaultTtl for records without TTL until the first $TTL
+    explicit ZoneFileParser(const std::string &origin = "", uint32_t defaultTtl = 3600);
+
+    BufferResult parseFile(const std::string &path, const RecordCallback &onRecord);
+    BufferResult parse(const char *text, size_t size, const RecordCallback &onRecord);
+
+    // line (starting with 1) and description of the error after parse failed
+    inline size_t errorLine() const { return mErrorLine; }
+    inline const std::string &errorMessage() const { return mError; }
+
+private:
+    struct Token {
+        const char *mData;
+        size_t mSize;
+        bool mQuoted;
+    };
+
+    std::string mInitialOrigin;
+    uint32_t mInitialTtl;
+
+    std::string mOrigin;
+    uint32_t mDefaultTtl;
+    bool mHasTtlDirective = false;
+    std::string mOwner;
+    bool mHasOwner = false;
+    RecordClass mClass = RecordClass::kIN;
+
+    const char *mPos = nullptr;
+    const char *mEnd = nullptr;
+    size_t mLine = 1;
+    size_t mEntryLine = 1; // line where the current entry starts
+    std::vector<Token> mTokens; // tokens of the current entry
+    size_t mNext = 0; // next token to read
+    std::string mText; // scratch for unescaped tokens
+    std::vector<uint8_t> mWire; // scratch for RFC 3597 RDATA
+
+    size_t mErrorLine = 0;
+    std::string mError;
+
+    BufferResult parse(const char *text, size_t size, const RecordCallback &onRecord, bool mapped);
+    BufferResult readEntry(bool &found, bool &ownerOmitted);
+    BufferResult parseEntry(bool ownerOmitted, ResourceRecord &rr, bool &isRecord);
+    BufferResult parseRData(ResourceRecord &rr);
+    BufferResult parseGenericRData(ResourceRecord &rr);
+
+    // read the next token of the entry as a field, false (with the error set) if it is missing or invalid
+    bool readText(std::string &out, const char *what);
+    bool readString(std::string &out, const char *what); // <character-string>
+    bool readName(std::string &out, const char *what);
+    bool readUint(uint32_t &out, uint32_t max, const char *what);
+    bool readTtl(uint32_t &out, const char *what);
+    bool hasMoreTokens() const { return mNext < mTokens.size(); }
+
+    BufferResult fail(const std::string &message);
+};
+
+} // namespace
+#endif /* _DNS_ZONEFILE_H */
@@ -0,0 +1,708 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "zoneimage.h"
+#include "value.h"
+#include "view.h"
+
+using namespace dns;
+
+static const char kMagic[8] = {'D', 'N', 'S', 'Z', 'I', 'M', 'G', '\0'};
+static const size_t kHeaderSize = 40;
+static const size_t kRecordHeaderSize = 8; // type, TTL, RDATA length
+
+static const uint16_t kImageHasDelegations = 1;
+static const uint8_t kNodeHasNs = 1; // NS records below the origin, a zone cut
+static const uint8_t kNodeHasCname = 2;
+
+// longest CNAME chain followed inside a zone, same as Zone
+static const size_t kMaxCnameChain = 8;
+// NS/MX/SRV targets of a response which are looked up for the additional section
+static const size_t kMaxTargets = 32;
+
+static inline uint16_t readLe16(const uint8_t *p) {
+    return p[0] + (((uint16_t) p[1]) << 8);
+}
+
+static inline uint32_t readLe32(const uint8_t *p) {
+    return p[0] + (((uint32_t) p[1]) << 8) + (((uint32_t) p[2]) << 16) + (((uint32_t) p[3]) << 24);
+}
+
+static inline void writeLe16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static inline void writeLe32(uint8_t *p, uint32_t v) {
+    for (size_t i = 0; i < 4; i++) {
+        p[i] = (v >> (i * 8)) & 0xFF;
+    }
+}
+
+static inline void appendLe16(std::vector<uint8_t> &out, uint16_t v) {
+    out.push_back(v & 0xFF);
+    out.push_back(v >> 8);
+}
+
+static inline void appendLe32(std::vector<uint8_t> &out, uint32_t v) {
+    for (size_t i = 0; i < 4; i++) {
+        out.push_back((v >> (i * 8)) & 0xFF);
+    }
+}
+
+static inline uint16_t readUint16(const uint8_t *p) {
+    return (((uint16_t) p[0]) << 8) + p[1];
+}
+
+static inline void writeUint16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+// length bytes of labels are at most 63, so only the letters of the labels are changed
+static void toLowerWire(const uint8_t *name, size_t len, uint8_t *out) {
+    for (size_t i = 0; i < len; i++) {
+        auto c = name[i];
+        out[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+}
+
+// length of the uncompressed wire name at p, 0 if it does not end before end
+static size_t wireNameLength(const uint8_t *p, const uint8_t *end) {
+    size_t len = 0;
+    while (p + len < end) {
+        auto labelLen = p[len];
+        if (labelLen == 0) {
+            return len + 1;
+        }
+        if (labelLen > kMaxLabelLen) {
+            return 0;
+        }
+        len += labelLen + 1;
+    }
+    return 0;
+}
+
+// byte order of the wire names, the order of the index
+static int compareNames(const uint8_t *a, size_t aLen, const uint8_t *b, size_t bLen) {
+    auto c = memcmp(a, b, std::min(aLen, bLen));
+    if (c) {
+        return c;
+    }
+    return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+}
+
+// offset of the name in RDATA which is looked up for the additional section, -1 if there is none
+static int targetOffset(RecordType type) {
+    switch (type) {
+        case RecordType::kNS:
+            return 0;
+        case RecordType::kMX:
+            return 2;
+        case RecordType::kSRV:
+            return 6;
+        default:
+            return -1;
+    }
+}
+
+/////////// compile ///////////
+
+BufferResult ZoneImage::compile(const Zone &zone, std::vector<uint8_t> &image) {
+    struct Name {
+        std::string mWire; // lowercase
+        uint8_t mFlags = 0;
+        std::vector<RecordValue> mRecords;
+    };
+    std::vector<Name> names;
+    std::string originWire;
+    uint32_t soaMinimum = 0;
+    size_t recordCount = 0;
+    bool hasDelegations = false;
+
+    // records are converted to RecordValue, which expands the names in RDATA, all of them share the scratch buffer
+    std::vector<uint8_t> scratch;
+    BufferResult result = BufferResult::NoError;
+    zone.forEachName([&](const std::string &lowerName, const std::vector<const ResourceRecord *> &records) {
+        if (result != BufferResult::NoError) {
+            return;
+        }
+        uint8_t wire[kMaxDomainLen + 2];
+        size_t wireLen;
+        result = Buffer::toWireDomainName(lowerName, wire, wireLen);
+        if (result != BufferResult::NoError) {
+            return;
+        }
+        if (records.size() > 0xFFFF) {
+            result = BufferResult::InvalidData;
+            return;
+        }
+        names.emplace_back();
+        auto &name = names.back();
+        name.mWire.assign((const char *) wire, wireLen);
+        bool isOrigin = lowerName == zone.origin();
+        if (isOrigin) {
+            originWire = name.mWire;
+        }
+        for (auto record : records) {
+            ResourceRecord rr = *record; // encode is not const, the copy shares RData
+            name.mRecords.emplace_back();
+            auto &value = name.mRecords.back();
+            result = value.fromResourceRecord(rr, scratch);
+            if (result != BufferResult::NoError) {
+                return;
+            }
+            if (value.mType == RecordType::kNS && !isOrigin) {
+                name.mFlags |= kNodeHasNs;
+                hasDelegations = true;
+            } else if (value.mType == RecordType::kCNAME) {
+                name.mFlags |= kNodeHasCname;
+            } else if (value.mType == RecordType::SOA && isOrigin && value.mRData.size() >= 4) {
+                soaMinimum = value.mRData.readUint32(value.mRData.size() - 4);
+            }
+        }
+        recordCount += records.size();
+    });
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+    std::sort(names.begin(), names.end(), [](const Name &a, const Name &b) {
+        return compareNames((const uint8_t *) a.mWire.data(), a.mWire.size(), (const uint8_t *) b.mWire.data(), b.mWire.size()) < 0;
+    });
+
+    image.assign(kHeaderSize, 0);
+    std::vector<uint32_t> offsets;
+    uint32_t originOffset = 0;
+    for (auto &name : names) {
+        offsets.push_back(image.size());
+        if (name.mWire == originWire) {
+            originOffset = image.size();
+        }
+        image.push_back(name.mWire.size());
+        image.insert(image.end(), name.mWire.begin(), name.mWire.end());
+        image.push_back(name.mFlags);
+        appendLe16(image, name.mRecords.size());
+        for (auto &rr : name.mRecords) {
+            appendLe16(image, (uint16_t) rr.mType);
+            appendLe32(image, rr.mTtl);
+            appendLe16(image, rr.mRData.size());
+            image.insert(image.end(), rr.mRData.data(), rr.mRData.data() + rr.mRData.size());
+        }
+        if (image.size() > UINT32_MAX) {
+            return BufferResult::BufferOverflow; // offsets are 32 bits
+        }
+    }
+    auto indexOffset = image.size();
+    for (auto offset : offsets) {
+        appendLe32(image, offset);
+    }
+    if (image.size() > UINT32_MAX) {
+        return BufferResult::BufferOverflow;
+    }
+
+    auto header = image.data();
+    memcpy(header, kMagic, sizeof(kMagic));
+    writeLe32(header + 8, kVersion);
+    writeLe32(header + 12, image.size());
+    writeLe16(header + 16, (uint16_t) zone.recordClass());
+    writeLe16(header + 18, hasDelegations ? kImageHasDelegations : 0);
+    writeLe32(header + 20, soaMinimum);
+    writeLe32(header + 24, names.size());
+    writeLe32(header + 28, indexOffset);
+    writeLe32(header + 32, originOffset);
+    writeLe32(header + 36, recordCount);
+    return BufferResult::NoError;
+}
+
+// remove the temporary file of a failed write, errno still tells why it failed
+static void removeKeepingErrno(const std::string &path) {
+    auto error = errno;
+    std::remove(path.c_str());
+    errno = error;
+}
+
+BufferResult ZoneImage::compileFile(const Zone &zone, const std::string &path) {
+    std::vector<uint8_t> image;
+    auto result = compile(zone, image);
+    if (result != BufferResult::NoError) {
+        return result;
+    }
+    auto tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        out.write((const char *) image.data(), image.size());
+        if (!out.flush()) {
+            removeKeepingErrno(tmpPath);
+            return BufferResult::FileError;
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        removeKeepingErrno(tmpPath);
+        return BufferResult::FileError;
+    }
+    return BufferResult::NoError;
+}
+
+/////////// loading ///////////
+
+BufferResult ZoneImage::open(const std::string &path) {
+    close();
+#ifdef _WIN32
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return BufferResult::InvalidData;
+    }
+    mOwned.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    auto result = load(mOwned.data(), mOwned.size());
+    if (result != BufferResult::NoError) {
+        close();
+    }
+    return result;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return BufferResult::InvalidData;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < kHeaderSize) {
+        ::close(fd);
+        return BufferResult::InvalidData;
+    }
+    auto size = (size_t) st.st_size;
+    // a shared read-only mapping: the pages are those of the page cache, loaded on first use
+    auto data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return BufferResult::InvalidData;
+    }
+    madvise(data, size, MADV_RANDOM);
+    auto result = load((const uint8_t *) data, size);
+    if (result != BufferResult::NoError) {
+        munmap(data, size);
+        return result;
+    }
+    mMapped = data;
+    return BufferResult::NoError;
+#endif
+}
+
+BufferResult ZoneImage::attach(const uint8_t *data, size_t size) {
+    close();
+    return load(data, size);
+}
+
+// only the header is read, the nodes are checked when they are used
+BufferResult ZoneImage::load(const uint8_t *data, size_t size) {
+    if (size < kHeaderSize || memcmp(data, kMagic, sizeof(kMagic)) != 0 || readLe32(data + 8) != kVersion ||
+        readLe32(data + 12) != size) {
+        return BufferResult::InvalidData;
+    }
+    mData = data;
+    mSize = size;
+    mClass = (RecordClass) readLe16(data + 16);
+    mHasDelegations = readLe16(data + 18) & kImageHasDelegations;
+    mSoaMinimum = readLe32(data + 20);
+    mNameCount = readLe32(data + 24);
+    mIndexOffset = readLe32(data + 28);
+    mRecordCount = readLe32(data + 36);
+    if (mIndexOffset < kHeaderSize || mIndexOffset > size || (size - mIndexOffset) / 4 < mNameCount ||
+        !readNode(readLe32(data + 32), mOrigin)) {
+        mData = nullptr;
+        mSize = 0;
+        return BufferResult::InvalidData;
+    }
+    return BufferResult::NoError;
+}
+
+void ZoneImage::close() {
+#ifndef _WIN32
+    if (mMapped) {
+        munmap(mMapped, mSize);
+    }
+#endif
+    mMapped = nullptr;
+    mOwned.clear();
+    mData = nullptr;
+    mSize = 0;
+    mNameCount = 0;
+    mRecordCount = 0;
+}
+
+std::string ZoneImage::origin() const {
+    std::string out;
+    if (!mData) {
+        return out;
+    }
+    for (size_t i = 0; i < mOrigin.mNameLen && mOrigin.mName[i]; i += mOrigin.mName[i] + 1) {
+        if (!out.empty()) {
+            out.push_back('.');
+        }
+        out.append((const char *) mOrigin.mName + i + 1, mOrigin.mName[i]);
+    }
+    return out;
+}
+
+/////////// lookup ///////////
+
+// every access is checked against the size of the image, so a damaged image can't crash the lookups
+bool ZoneImage::readNode(uint32_t offset, Node &node) const {
+    if (offset < kHeaderSize || offset >= mIndexOffset) {
+        return false;
+    }
+    auto p = mData + offset;
+    auto nameLen = p[0];
+    if (offset + 1 + nameLen + 3 > mIndexOffset || nameLen == 0) {
+        return false;
+    }
+    node.mName = p + 1;
+    node.mNameLen = nameLen;
+    node.mFlags = p[1 + nameLen];
+    node.mCount = readLe16(p + 2 + nameLen);
+    node.mRecords = p + 4 + nameLen;
+    return true;
+}
+
+bool ZoneImage::findNode(const uint8_t *name, size_t len, Node &node) const {
+    size_t low = 0, high = mNameCount;
+    auto index = mData + mIndexOffset;
+    while (low < high) {
+        auto mid = low + (high - low) / 2;
+        if (!readNode(readLe32(index + mid * 4), node)) {
+            return false;
+        }
+        auto c = compareNames(node.mName, node.mNameLen, name, len);
+        if (c == 0) {
+            return true;
+        }
+        if (c < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return false;
+}
+
+bool ZoneImage::isInside(const uint8_t *name, size_t len) const {
+    if (len < mOrigin.mNameLen) {
+        return false;
+    }
+    for (size_t pos = 0; pos + mOrigin.mNameLen <= len; pos += name[pos] + 1) {
+        if (pos + mOrigin.mNameLen == len) {
+            return memcmp(name + pos, mOrigin.mName, len - pos) == 0;
+        }
+        if (!name[pos]) {
+            break;
+        }
+    }
+    return false;
+}
+
+// walk from the origin down to the name like Zone::findCut: returns true with cut set to the node of a zone cut
+// on the way, otherwise found tells if node is set to the node of the name, or encloserPos to the closest encloser
+bool ZoneImage::findCut(const uint8_t *name, size_t len, Node &cut, Node &node, bool &found, size_t &encloserPos) const {
+    found = false;
+    if (!mHasDelegations && findNode(name, len, node)) {
+        found = true;
+        return false;
+    }
+
+    size_t positions[kMaxDomainLen / 2 + 1]; // start of the names between the origin (exclusive) and name
+    size_t count = 0;
+    encloserPos = len - mOrigin.mNameLen;
+    for (size_t pos = 0; pos < encloserPos; pos += name[pos] + 1) {
+        positions[count++] = pos;
+    }
+    if (count == 0) {
+        node = mOrigin;
+        found = true;
+        return false;
+    }
+    for (size_t i = count; i-- > 0;) {
+        if (!findNode(name + positions[i], len - positions[i], node)) {
+            return false;
+        }
+        encloserPos = positions[i];
+        if (node.mFlags & kNodeHasNs) {
+            cut = node;
+            return true;
+        }
+    }
+    found = true;
+    return false;
+}
+
+// state of a response being written
+struct ZoneImage::Response {
+    Buffer &mBuff;
+    uint8_t *mOut;
+    uint16_t mCounts[3] = {}; // answer, authority, additional
+    bool mAA = false;
+    bool mTC = false;
+    ResponseCode mRCode = ResponseCode::kNOERROR;
+    const uint8_t *mTargets[kMaxTargets]; // names inside RDATA for the additional section
+    size_t mTargetCount = 0;
+    uint8_t mName[kMaxDomainLen + 2]; // lowercase name of the lookup
+    uint8_t mWildcard[kMaxDomainLen + 2];
+
+    // start of the RRset being written in the answer or authority section
+    Buffer::Checkpoint mSetStart{};
+    uint16_t mSetCount = 0;
+    size_t mSetTargetCount = 0;
+    size_t mSetSection = SIZE_MAX;
+    const uint8_t *mSetOwner = nullptr;
+    RecordType mSetType = RecordType::kNone;
+
+    Response(Buffer &buff, uint8_t *out) : mBuff(buff), mOut(out) {}
+
+    // write a record with the RDATA of the image, false if the image is damaged or the record doesn't fit.
+    // Like Message::encodeTruncated, an answer or authority RRset which doesn't fit is removed whole and TC is set
+    bool write(size_t section, const uint8_t *owner, size_t ownerLen, RecordClass cls, const uint8_t *record, const uint8_t *end,
+               uint32_t maxTtl = UINT32_MAX) {
+        auto rdLen = readLe16(record + 6);
+        if (record + kRecordHeaderSize + rdLen > end) {
+            return false;
+        }
+        auto type = (RecordType) readLe16(record);
+        if (section != 2 && (section != mSetSection || owner != mSetOwner || type != mSetType)) {
+            mSetStart = mBuff.checkpoint();
+            mSetCount = mCounts[section];
+            mSetTargetCount = mTargetCount;
+            mSetSection = section;
+            mSetOwner = owner;
+            mSetType = type;
+        }
+        mBuff.writeDomainNameWire(owner, ownerLen);
+        mBuff.writeUint16((uint16_t) type);
+        mBuff.writeUint16((uint16_t) cls);
+        mBuff.writeUint32(std::min(readLe32(record + 2), maxTtl));
+        auto lenPos = mBuff.pos();
+        mBuff.writeUint16(0);
+        RDataValue::encode(mBuff, type, record + kRecordHeaderSize, rdLen);
+        if (!mBuff.isBroken()) {
+            writeUint16(mOut + lenPos, mBuff.pos() - lenPos - 2);
+        } else if (section != 2 && mBuff.result() == BufferResult::BufferOverflow) {
+            mBuff.rollback(mSetStart);
+            mCounts[section] = mSetCount;
+            mTargetCount = mSetTargetCount;
+            mTC = true;
+            return false;
+        }
+        mCounts[section]++;
+
+        auto offset = targetOffset(type);
+        if (offset >= 0 && (size_t) offset < rdLen && mTargetCount < kMaxTargets) {
+            mTargets[mTargetCount++] = record + kRecordHeaderSize + offset;
+        }
+        return true;
+    }
+};
+
+BufferResult ZoneImage::answer(const uint8_t *query, size_t querySize, uint8_t *out, size_t outSize, size_t &responseSize) const {
+    responseSize = 0;
+    if (querySize < 12) {
+        return BufferResult::BufferOverflow;
+    }
+    auto flags = readUint16(query + 2);
+    if (!mData || (flags & 0x8000)) {
+        return BufferResult::InvalidData;
+    }
+
+    Buffer buff(out, outSize);
+    Response r(buff, out);
+    buff.writeBytes(query, 2);
+    buff.writeBytes((const uint8_t *) "\0\0\0\0\0\0\0\0\0\0", 10);
+
+    uint8_t qname[kMaxDomainLen + 2];
+    size_t qnameLen = 0;
+    QuestionView question;
+    if (readUint16(query + 4) != 1) {
+        r.mRCode = ResponseCode::kFORMERR;
+    } else {
+        size_t end;
+        if (question.parse(query, querySize, 12, end) != BufferResult::NoError) {
+            return BufferResult::InvalidData;
+        }
+        qnameLen = question.mName.toWire(qname, sizeof(qname));
+        if (!qnameLen) {
+            return BufferResult::InvalidData;
+        }
+        buff.writeDomainNameWire(qname, qnameLen);
+        buff.writeUint16((uint16_t) question.mType);
+        buff.writeUint16((uint16_t) question.mClass);
+        if (buff.isBroken()) {
+            return buff.result();
+        }
+        writeUint16(out + 4, 1);
+    }
+
+    if (((flags >> 11) & 15) != 0) {
+        r.mRCode = ResponseCode::kNOTIMP;
+    } else if (qnameLen) {
+        uint8_t lowerName[kMaxDomainLen + 2];
+        toLowerWire(qname, qnameLen, lowerName);
+        if (!isInside(lowerName, qnameLen) || (question.mClass != mClass && (uint16_t) question.mClass != 255)) {
+            r.mRCode = ResponseCode::kREFUSED;
+        } else {
+            auto cp = buff.checkpoint();
+            lookup(r, question.mType, qname, lowerName, qnameLen);
+            if (buff.isBroken()) {
+                // a damaged record: everything after the question is dropped and TC is set
+                buff.rollback(cp);
+                r.mCounts[0] = r.mCounts[1] = 0;
+                r.mTC = true;
+            } else if (!r.mTC) {
+                addAdditional(r);
+            }
+        }
+    }
+
+    // keep opcode and RD of the query, set QR
+    writeUint16(out + 2, 0x8000 | (flags & 0x7900) | (r.mAA << 10) | (r.mTC << 9) | (uint16_t) r.mRCode);
+    for (size_t i = 0; i < 3; i++) {
+        writeUint16(out + 6 + i * 2, r.mCounts[i]);
+    }
+    responseSize = buff.pos();
+    return BufferResult::NoError;
+}
+
+// Zone::answer on the image, owner names of the question name are written as qname (the case of the query)
+void ZoneImage::lookup(Response &r, RecordType qtype, const uint8_t *qname, const uint8_t *lowerName, size_t len) const {
+    r.mAA = true;
+    auto end = mData + mIndexOffset;
+    const uint8_t *owner = qname;
+    for (size_t chain = 0; chain <= kMaxCnameChain; chain++) {
+        Node cut, node;
+        bool found;
+        size_t encloserPos;
+        if (findCut(lowerName, len, cut, node, found, encloserPos)) {
+            // referral, only authoritative for the CNAMEs followed so far
+            r.mAA = chain != 0;
+            auto p = cut.mRecords;
+            for (size_t i = 0; i < cut.mCount && p + kRecordHeaderSize <= end; i++) {
+                if ((RecordType) readLe16(p) == RecordType::kNS && !r.write(1, cut.mName, cut.mNameLen, mClass, p, end)) {
+                    return;
+                }
+                p += kRecordHeaderSize + readLe16(p + 6);
+            }
+            return;
+        }
+
+        if (!found) {
+            // wildcard at the closest encloser (RFC 4592)
+            r.mWildcard[0] = 1;
+            r.mWildcard[1] = '*';
+            memcpy(r.mWildcard + 2, lowerName + encloserPos, len - encloserPos); // at most kMaxDomainLen + 1 bytes
+            if (!findNode(r.mWildcard, len - encloserPos + 2, node)) {
+                r.mRCode = ResponseCode::kNXDOMAIN;
+                addNegative(r);
+                return;
+            }
+        }
+
+        const uint8_t *cname = nullptr;
+        auto answerCount = r.mCounts[0];
+        auto p = node.mRecords;
+        for (size_t i = 0; i < node.mCount && p + kRecordHeaderSize <= end; i++) {
+            auto type = (RecordType) readLe16(p);
+            if (type == qtype || qtype == RecordType::kANY) {
+                if (!r.write(0, owner, len, mClass, p, end)) {
+                    return;
+                }
+            } else if (type == RecordType::kCNAME) {
+                cname = p;
+            }
+            p += kRecordHeaderSize + readLe16(p + 6);
+        }
+        if (r.mCounts[0] != answerCount) {
+            return;
+        }
+        if (!cname) {
+            addNegative(r); // NODATA
+            return;
+        }
+        if (!r.write(0, owner, len, mClass, cname, end)) {
+            return;
+        }
+        auto target = cname + kRecordHeaderSize;
+        len = wireNameLength(target, target + readLe16(cname + 6));
+        if (!len) {
+            return;
+        }
+        owner = target;
+        toLowerWire(target, len, r.mName);
+        lowerName = r.mName;
+        if (!isInside(lowerName, len)) {
+            return; // the resolver follows the CNAME
+        }
+    }
+}
+
+void ZoneImage::addNegative(Response &r) const {
+    auto end = mData + mIndexOffset;
+    auto p = mOrigin.mRecords;
+    for (size_t i = 0; i < mOrigin.mCount && p + kRecordHeaderSize <= end; i++) {
+        if ((RecordType) readLe16(p) == RecordType::SOA) {
+            // the TTL of the SOA is limited by its MINIMUM field (RFC 2308)
+            r.write(1, mOrigin.mName, mOrigin.mNameLen, mClass, p, end, mSoaMinimum);
+            return;
+        }
+        p += kRecordHeaderSize + readLe16(p + 6);
+    }
+}
+
+void ZoneImage::addAdditional(Response &r) const {
+    auto end = mData + mIndexOffset;
+    uint8_t lowerNames[kMaxTargets][kMaxDomainLen + 2];
+    size_t lowerLens[kMaxTargets];
+    for (size_t t = 0; t < r.mTargetCount; t++) {
+        auto target = r.mTargets[t];
+        auto len = wireNameLength(target, end);
+        lowerLens[t] = len;
+        if (!len) {
+            continue;
+        }
+        toLowerWire(target, len, lowerNames[t]);
+        bool seen = false;
+        for (size_t k = 0; k < t && !seen; k++) {
+            seen = lowerLens[k] == len && memcmp(lowerNames[k], lowerNames[t], len) == 0;
+        }
+        Node node;
+        if (seen || !isInside(lowerNames[t], len) || !findNode(lowerNames[t], len, node)) {
+            continue;
+        }
+        auto p = node.mRecords;
+        for (size_t i = 0; i < node.mCount && p + kRecordHeaderSize <= end; i++) {
+            auto type = (RecordType) readLe16(p);
+            if (type == RecordType::kA || type == RecordType::kAAAA) {
+                // additional records are optional, the ones which don't fit are left out
+                auto cp = r.mBuff.checkpoint();
+                auto count = r.mCounts[2];
+                if (!r.write(2, target, len, mClass, p, end)) {
+                    return;
+                }
+                if (r.mBuff.isBroken()) {
+                    r.mBuff.rollback(cp);
+                    r.mCounts[2] = count;
+                    return;
+                }
+            }
+            p += kRecordHeaderSize + readLe16(p + 6);
+        }
+    }
+}
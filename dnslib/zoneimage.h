@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2022 Xiaoguang Wang (mailto:wxiaoguang@gmail.com)
+ * Licensed under the NCSA Open Source License (https://opensource.org/licenses/NCSA). All rights reserved.
+ */
+
+#ifndef _DNS_ZONEIMAGE_H
+#define _DNS_ZONEIMAGE_H
+
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "buffer.h"
+#include "zone.h"
+
+namespace dns {
+
+/**
+ * Precompiled binary image of a zone, which is mapped into memory and answers queries without loading.
+ *
+ * compile() writes a zone once into a flat image: names and RDATA in uncompressed wire form, offsets instead of
+ * pointers, and an index of the names sorted for binary search. open() maps the image read-only, only the header
+ * is checked, so the startup time does not depend on the size of the zone and all processes which map the same
+ * image share its pages in the page cache. answer() makes the wire response of a query directly from the image
+ * (same answers as Zone::answer) without building any records.
+ *
+ * Names are stored in lowercase, so owner names of the answers keep the case of the query but not of the zone file.
+ *
+ * Layout (integers are little-endian):
+ *
+ *     header     "DNSZIMG\0", u32 version, u32 image size, u16 class, u16 flags, u32 SOA MINIMUM,
+ *                u32 name count, u32 index offset, u32 origin node offset, u32 record count
+ *     nodes      u8 name length, lowercase wire name, u8 flags, u16 record count,
+ *                records: u16 type, u32 TTL, u16 RDATA length, RDATA
+ *     index      u32 node offset for every name, sorted by the wire names (byte order)
+ */
+class ZoneImage {
+    struct Response;
+
+public:
+    static const uint32_t kVersion = 1;
+
+    ZoneImage() = default;
+    ZoneImage(const ZoneImage&) = delete;
+    ZoneImage& operator=(const ZoneImage&) = delete;
+    ~ZoneImage() { close(); }
+
+    // write the image of zone, compileFile replaces the file atomically, so servers keep their mapping of the old one,
+    // it returns FileError if the file can't be written
+    static BufferResult compile(const Zone &zone, std::vector<uint8_t> &image);
+    static BufferResult compileFile(const Zone &zone, const std::string &path);
+
+    // map the image file, or use an image in memory (which must stay valid until close),
+    // InvalidData if it is not an image of this version
+    BufferResult open(const std::string &path);
+    BufferResult attach(const uint8_t *data, size_t size);
+    void close();
+
+    inline bool isOpen() const { return mData != nullptr; }
+    std::string origin() const; // lowercase, without the trailing dot
+    inline RecordClass recordClass() const { return mClass; }
+    inline size_t nameCount() const { return mNameCount; }
+    inline size_t recordCount() const { return mRecordCount; }
+
+    // make the response of a query in out, like ZoneStore::Reader::answer and Message::encodeTruncated(outSize):
+    // REFUSED if the name is not inside the zone, FORMERR/NOTIMP for unsupported queries.
+    // InvalidData if the query cannot be parsed, BufferOverflow if out can't hold the question
+    BufferResult answer(const uint8_t *query, size_t querySize, uint8_t *out, size_t outSize, size_t &responseSize) const;
+
+private:
+    struct Node {
+        const uint8_t *mName;
+        size_t mNameLen;
+        uint8_t mFlags;
+        uint16_t mCount;
+        const uint8_t *mRecords;
+    };
+
+    const uint8_t *mData = nullptr;
+    size_t mSize = 0;
+    void *mMapped = nullptr; // mapping of open, unmapped by close
+    std::vector<uint8_t> mOwned; // contents of open without mmap
+
+    RecordClass mClass = RecordClass::kNone;
+    bool mHasDelegations = false;
+    uint32_t mSoaMinimum = 0;
+    uint32_t mNameCount = 0;
+    uint32_t mIndexOffset = 0;
+    uint32_t mRecordCount = 0;
+    Node mOrigin{};
+
+    BufferResult load(const uint8_t *data, size_t size);
+    bool readNode(uint32_t offset, Node &node) const;
+    bool findNode(const uint8_t *name, size_t len, Node &node) const;
+    bool findCut(const uint8_t *name, size_t len, Node &cut, Node &node, bool &found, size_t &encloserPos) const;
+    bool isInside(const uint8_t *name, size_t len) const;
+
+    void lookup(Response &r, RecordType qtype, const uint8_t *qname, const uint8_t *lowerName, size_t len) const;
+    void addNegative(Response &r) const;
+    void addAdditional(Response &r) const;
+};
+
+} // namespace
+#endif /* _DNS_ZONEIMAGE_H */